@@ -1,13 +1,76 @@
 #include "Activation.h"
+#include "Gemm.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
 
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  using linalg::vec_t;
+
+  typedef int32_t ivec_t __attribute__((vector_size(VEC_WIDTH*
+                                                    sizeof(int32_t))));
+
+  //exp(r) = 1 + r + r^2*P(r) on [-ln2/2, ln2/2], Cephes expf coefficients
+  const float EXP_P[] = {1.9875691500E-4F, 1.3981999507E-3F, 8.3334519073E-3F,
+                         4.1665795894E-2F, 1.6666665459E-1F, 5.0000001201E-1F};
+  const float LOG2E = 1.44269504088896341F;
+  const float LN2_HI = 0.693359375F;      // exact in 10 bits, n*LN2_HI is too
+  const float LN2_LO = -2.12194440E-4F;   // ln2 - LN2_HI
+  const float ROUND_MAGIC = 12582912.0F;  // 1.5*2^23, adding it rounds
+
+
+  /**
+   * @return exp of every lane, see activation::exp_span
+   */
+  inline vec_t exp_vec(vec_t x)
+  {
+    const vec_t zero = {};
+    const vec_t lo = zero + EXP_MIN_ARG, hi = zero + EXP_MAX_ARG;
+    const vec_t clamped = (x < lo) ? lo : ((x > hi) ? hi : x);
+
+    //x = n*ln2 + r, |r| <= ln2/2
+    const vec_t n = (clamped*LOG2E + ROUND_MAGIC) - ROUND_MAGIC;
+    const vec_t r = clamped - n*LN2_HI - n*LN2_LO;
+    vec_t poly = zero + EXP_P[0];
+    for(int coef=1; coef<6; coef++)
+    {
+      poly = poly*r + EXP_P[coef];
+    }
+    const vec_t exp_r = r*r*poly + r + 1.0F;
+
+    //2^n in two exponent-bit factors, n is in [-126, 128] and 2^128 is not
+    //a float, though exp_r*2^128 can be
+    const ivec_t n_int = __builtin_convertvector(n, ivec_t);
+    const ivec_t n_half = n_int >> 1;
+    const ivec_t bits[2] = {(n_half + 127) << 23, (n_int - n_half + 127) << 23};
+    vec_t scale[2];
+    memcpy(scale, bits, sizeof(scale));
+    const vec_t result = exp_r*scale[0]*scale[1];
+    return (x < lo) ? zero : ((x > hi) ? zero + INFINITY : result);
+  }
+
+
+  /**
+   * loads the n < VEC_WIDTH floats of x, the other lanes are pad
+   */
+  inline vec_t load_tail(const float* x, int n, float pad)
+  {
+    vec_t v = vec_t{} + pad;
+    memcpy(&v, x, n*sizeof(float));
+    return v;
+  }
+}
+
+/////////////////////////////// ALLOCATING ////////////////////////////////////
 
 Matrix activation::relu(const Matrix& mat)
 {
+  //a fresh Matrix, a copy may share read-only mapped storage
   Matrix new_mat = Matrix(mat.get_rows(), mat.get_cols());
-  for(int index=0; index<ALL_COORDS; index++)
-  {
-    new_mat[index] = (mat[index]<=0) ? 0 : mat[index];
-  }
+  memcpy(new_mat.data(), mat.data(), ALL_COORDS*CELL_SIZE);
+  relu_in_place(new_mat);
   return new_mat;
 }
 
@@ -15,14 +78,218 @@ Matrix activation::relu(const Matrix& mat)
 
 Matrix activation::softmax(const Matrix& mat)
 {
+  //a fresh Matrix, a copy may share read-only mapped storage
   Matrix new_mat = Matrix(mat.get_rows(), mat.get_cols());
-  float sum = 0;
-  for(int index=0; index<ALL_COORDS; index++)
+  memcpy(new_mat.data(), mat.data(), ALL_COORDS*CELL_SIZE);
+  softmax_in_place(new_mat);
+  return new_mat;
+}
+
+//////////////////////////////// IN PLACE /////////////////////////////////////
+
+void activation::relu_in_place(Matrix& mat)
+{
+  relu_span(mat.data(), ALL_COORDS);
+}
+
+
+void activation::softmax_in_place(Matrix& mat)
+{
+  softmax_span(mat.data(), ALL_COORDS);
+}
+
+
+void activation::softmax_cols_in_place(Matrix& mat)
+{
+  const int rows = mat.get_rows(), cols = mat.get_cols();
+  float* coords = mat.data();
+  if(cols == ONE_COL)
   {
-    sum += exp (mat[index]);
-    new_mat[index] = exp (mat[index]);
+    softmax_span(coords, rows);
+    return;
   }
-  sum = 1/sum;
-  new_mat = new_mat*sum;
-  return new_mat;
-}
\ No newline at end of file
+  //sweep whole rows, so every pass runs over contiguous floats
+  static thread_local std::vector<float> col_stats;
+  col_stats.assign(coords, coords + cols);
+  float* maxes = col_stats.data();
+  for(int row=1; row<rows; row++)
+  {
+    const float* coords_row = coords + ((long) row)*cols;
+    for(int col=0; col<cols; col++)
+    {
+      maxes[col] = (coords_row[col] > maxes[col]) ? coords_row[col]
+                                                  : maxes[col];
+    }
+  }
+  col_stats.resize(2*cols, 0.0F);
+  maxes = col_stats.data();
+  float* sums = maxes + cols;
+  for(int row=0; row<rows; row++)
+  {
+    float* coords_row = coords + ((long) row)*cols;
+    for(int col=0; col<cols; col++)
+    {
+      coords_row[col] -= maxes[col];
+    }
+    exp_span(coords_row, cols);
+    for(int col=0; col<cols; col++)
+    {
+      sums[col] += coords_row[col];
+    }
+  }
+  for(int col=0; col<cols; col++)
+  {
+    sums[col] = 1/sums[col];
+  }
+  for(int row=0; row<rows; row++)
+  {
+    float* coords_row = coords + ((long) row)*cols;
+    for(int col=0; col<cols; col++)
+    {
+      coords_row[col] *= sums[col];
+    }
+  }
+}
+
+
+activation_in_place_t activation::in_place(activation_t activation_func)
+{
+  if(activation_func == relu)
+  {
+    return relu_in_place;
+  }
+  if(activation_func == softmax)
+  {
+    return softmax_in_place;
+  }
+  return nullptr;
+}
+
+///////////////////////////////// KERNELS /////////////////////////////////////
+
+void activation::relu_span(float* x, int n)
+{
+  const vec_t zero = {};
+  int index = 0;
+  for(; index + VEC_WIDTH <= n; index += VEC_WIDTH)
+  {
+    vec_t v;
+    memcpy(&v, x + index, sizeof(v));
+    v = (v <= zero) ? zero : v;
+    memcpy(x + index, &v, sizeof(v));
+  }
+  for(; index<n; index++)
+  {
+    x[index] = (x[index]<=0) ? 0 : x[index];
+  }
+}
+
+
+void activation::softmax_span(float* x, int n)
+{
+  if(n <= 0)
+  {
+    return;
+  }
+  float max = x[0];
+  for(int index=1; index<n; index++)
+  {
+    max = (x[index] > max) ? x[index] : max;
+  }
+
+  //exp(x - max) <= 1, the padding lanes of the tail are exp(-inf) = 0
+  const int n_main = n - (n % VEC_WIDTH);
+  vec_t sums = {};
+  for(int index=0; index<n_main; index+=VEC_WIDTH)
+  {
+    vec_t v;
+    memcpy(&v, x + index, sizeof(v));
+    v = exp_vec(v - max);
+    memcpy(x + index, &v, sizeof(v));
+    sums += v;
+  }
+  if(n_main < n)
+  {
+    const vec_t v = exp_vec(load_tail(x + n_main, n - n_main, -INFINITY) -
+                            max);
+    memcpy(x + n_main, &v, (n - n_main)*sizeof(float));
+    sums += v;
+  }
+  float sum = 0.0F;
+  for(int l=0; l<VEC_WIDTH; l++)
+  {
+    sum += sums[l];
+  }
+  const float inv_sum = 1/sum;
+  for(int index=0; index<n; index++)
+  {
+    x[index] *= inv_sum;
+  }
+}
+
+
+void activation::exp_span(float* x, int n)
+{
+  int index = 0;
+  for(; index + VEC_WIDTH <= n; index += VEC_WIDTH)
+  {
+    vec_t v;
+    memcpy(&v, x + index, sizeof(v));
+    v = exp_vec(v);
+    memcpy(x + index, &v, sizeof(v));
+  }
+  if(index < n)
+  {
+    const vec_t v = exp_vec(load_tail(x + index, n - index, 0.0F));
+    memcpy(x + index, &v, (n - index)*sizeof(float));
+  }
+}
+
+//////////////////////////////// BACKWARD /////////////////////////////////////
+
+void activation::relu_backward(const Matrix& output, Matrix& grad)
+{
+  if(grad.get_rows() != output.get_rows() ||
+     grad.get_cols() != output.get_cols())
+  {
+    throw length_error(DIFFER_SIZE_ERR_MSG);
+  }
+  const float* out = output.data();
+  float* g = grad.data();
+  const int n = output.get_rows()*output.get_cols();
+  const vec_t zero = {};
+  int index = 0;
+  for(; index + VEC_WIDTH <= n; index += VEC_WIDTH)
+  {
+    vec_t out_vec, g_vec;
+    memcpy(&out_vec, out + index, sizeof(out_vec));
+    memcpy(&g_vec, g + index, sizeof(g_vec));
+    g_vec = (out_vec > zero) ? g_vec : zero;
+    memcpy(g + index, &g_vec, sizeof(g_vec));
+  }
+  for(; index<n; index++)
+  {
+    g[index] = (out[index] > 0) ? g[index] : 0;
+  }
+}
+
+
+float activation::cross_entropy_backward(Matrix& probs, const uint8_t* labels)
+{
+  const int classes = probs.get_rows(), cols = probs.get_cols();
+  float* coords = probs.data();
+  const float inv_cols = 1.0F/cols;
+  double loss = 0;
+  for(int col=0; col<cols; col++)
+  {
+    if(labels[col] >= classes)
+    {
+      throw out_of_range(LABEL_ERR_MSG);
+    }
+    float& target = coords[labels[col]*cols + col];
+    loss -= std::log((target > LOSS_MIN_PROB) ? target : LOSS_MIN_PROB);
+    target -= 1;
+  }
+  probs *= inv_cols;
+  return (float) (loss/cols);
+}
@@ -1,8 +1,55 @@
 #include "Dense.h"
+#include "Gemm.h"
+#include <vector>
+
+#define TRANSPOSE_BLOCK 32 // rows and columns of a transposed tile
+
+namespace
+{
+  /**
+   * dst = src^T, tile by tile so both sides stay in cache
+   * @param src rows x cols, row-major
+   * @param dst cols x rows, row-major
+   */
+  void transpose_into(const float* src, int rows, int cols, float* dst)
+  {
+    for(int row=0; row<rows; row+=TRANSPOSE_BLOCK)
+    {
+      const int row_end = (rows - row < TRANSPOSE_BLOCK)
+                          ? rows : row + TRANSPOSE_BLOCK;
+      for(int col=0; col<cols; col+=TRANSPOSE_BLOCK)
+      {
+        const int col_end = (cols - col < TRANSPOSE_BLOCK)
+                            ? cols : col + TRANSPOSE_BLOCK;
+        for(int r=row; r<row_end; r++)
+        {
+          for(int c=col; c<col_end; c++)
+          {
+            dst[((long) c)*rows + r] = src[((long) r)*cols + c];
+          }
+        }
+      }
+    }
+  }
+}
 
 Dense::Dense(const Matrix& weight, const Matrix& bias, const activation_t
 activation_func):
-_activation_func(activation_func), _weights(weight), _bias(bias)
+_activation_func(activation_func), _weights(weight), _bias(bias),
+_precision(PRECISION_FP32)
+{
+  if(bias.get_cols() != ONE_COL || weight.get_rows() != bias.get_rows())
+  {
+    throw length_error (LEN_ERR_MSG);
+  }
+}
+
+
+Dense::Dense(const SparseMatrix& weight, const Matrix& bias, const
+activation_t activation_func):
+_activation_func(activation_func), _weights(weight.to_dense()), _bias(bias),
+_precision(PRECISION_FP32),
+_sparse(std::make_shared<const SparseMatrix>(weight))
 {
   if(bias.get_cols() != ONE_COL || weight.get_rows() != bias.get_rows())
   {
@@ -29,9 +76,360 @@ activation_t Dense::get_activation () const
 }
 
 
-Matrix Dense::operator()(const Matrix& input)
+weight_precision Dense::get_precision () const
+{
+  return _precision;
+}
+
+
+bool Dense::is_sparse () const
 {
-  Matrix result = _weights*input;
-  result += _bias;
-  return _activation_func(result);
-}
\ No newline at end of file
+  return (bool) _sparse;
+}
+
+
+const Matrix &Dense::get_weights_grad () const
+{
+  return _weights_grad;
+}
+
+
+const Matrix &Dense::get_bias_grad () const
+{
+  return _bias_grad;
+}
+
+
+void Dense::set_sparse (bool sparse)
+{
+  if(!sparse)
+  {
+    _sparse.reset();
+  }
+  else if(!_sparse)
+  {
+    _sparse = std::make_shared<const SparseMatrix>(_weights);
+  }
+}
+
+
+void Dense::set_precision (weight_precision precision)
+{
+  const size_t size = ((size_t) _weights.get_rows())*_weights.get_cols();
+  //read only, the non const data() would copy mapped weights
+  const float* weights = static_cast<const Matrix&>(_weights).data();
+  _fp16_weights.clear();
+  _fp16_weights.shrink_to_fit();
+  _bf16_weights.clear();
+  _bf16_weights.shrink_to_fit();
+  if(precision == PRECISION_FP16)
+  {
+    _fp16_weights.resize(size);
+    half::narrow(weights, _fp16_weights.data(), size);
+  }
+  else if(precision == PRECISION_BF16)
+  {
+    _bf16_weights.resize(size);
+    half::narrow(weights, _bf16_weights.data(), size);
+  }
+  _precision = precision;
+}
+
+
+Matrix Dense::operator()(const MatrixView& input)
+{
+  Matrix result(_weights.get_rows(), input.get_cols());
+  (*this)(input, result);
+  return result;
+}
+
+
+void Dense::operator()(const MatrixView& input, Matrix& output) const
+{
+  run(input, output, true);
+}
+
+
+void Dense::operator()(const uint8_t* pixels, int count, float scale,
+                       const Matrix& bias, Matrix& output) const
+{
+  run(pixels, count, scale, bias, output, true);
+}
+
+
+void Dense::pre_activation(const MatrixView& input, Matrix& output) const
+{
+  run(input, output, false);
+}
+
+
+void Dense::pre_activation(const uint8_t* pixels, int count, float scale,
+                           const Matrix& bias, Matrix& output) const
+{
+  run(pixels, count, scale, bias, output, false);
+}
+
+
+void Dense::backward(const MatrixView& input, const Matrix& grad)
+{
+  const int rows = _weights.get_rows(), cols = _weights.get_cols();
+  const int count = input.get_cols();
+  if(input.get_rows() != cols || grad.get_rows() != rows ||
+     grad.get_cols() != count)
+  {
+    throw length_error(MAT_MULT_ERR_MSG);
+  }
+  //weights grad = grad*input^T, bias grad = the sum of the grad columns
+  static thread_local std::vector<float> scratch;
+  const MatrixView x = input.with_contiguous_rows(scratch);
+  _weights_grad.resize(rows, cols);
+  linalg::gemm_nt(rows, cols, count, grad.data(), count, x.data(),
+                  x.get_row_stride(), _weights_grad.data(), cols);
+  _bias_grad.resize(rows, ONE_COL);
+  const float* g = grad.data();
+  float* bias_grad = _bias_grad.data();
+  for(int row=0; row<rows; row++)
+  {
+    float sum = 0.0F;
+    for(int col=0; col<count; col++)
+    {
+      sum += g[((long) row)*count + col];
+    }
+    bias_grad[row] = sum;
+  }
+}
+
+
+void Dense::backward(const MatrixView& input, const Matrix& grad,
+                     Matrix& input_grad)
+{
+  backward(input, grad);
+
+  //input grad^T = grad^T*weights, so the product runs on gemm as it is
+  const int rows = _weights.get_rows(), cols = _weights.get_cols();
+  const int count = input.get_cols();
+  static thread_local std::vector<float> grad_t, input_grad_t;
+  grad_t.resize(((size_t) count)*rows);
+  input_grad_t.resize(((size_t) count)*cols);
+  transpose_into(grad.data(), rows, count, grad_t.data());
+  linalg::gemm(count, cols, rows, grad_t.data(), rows,
+               static_cast<const Matrix&>(_weights).data(), cols,
+               input_grad_t.data(), cols);
+  input_grad.resize(cols, count);
+  transpose_into(input_grad_t.data(), count, cols, input_grad.data());
+}
+
+
+void Dense::apply_step(const Matrix& weights_step, const Matrix& bias_step)
+{
+  if(weights_step.get_rows() != _weights.get_rows() ||
+     weights_step.get_cols() != _weights.get_cols() ||
+     bias_step.get_rows() != _bias.get_rows() ||
+     bias_step.get_cols() != ONE_COL)
+  {
+    throw length_error(DIFFER_SIZE_ERR_MSG);
+  }
+  const long size = ((long) _weights.get_rows())*_weights.get_cols();
+  float* weights = _weights.data();
+  const float* step = weights_step.data();
+  if(_sparse)
+  {
+    for(long index=0; index<size; index++)
+    {
+      weights[index] = (weights[index] != 0) ? weights[index] - step[index]
+                                             : 0.0F;
+    }
+    _sparse = std::make_shared<const SparseMatrix>(_weights);
+  }
+  else
+  {
+    for(long index=0; index<size; index++)
+    {
+      weights[index] -= step[index];
+    }
+  }
+  float* bias = _bias.data();
+  for(int row=0; row<_bias.get_rows(); row++)
+  {
+    bias[row] -= bias_step[row];
+  }
+  if(_precision != PRECISION_FP32)
+  {
+    set_precision(_precision);
+  }
+}
+
+
+bool Dense::runs_sparse(int count) const
+{
+  return _sparse && (count != ONE_COL ||
+                     _sparse->sparsity() >= DENSE_SPARSE_GEMV_THRESHOLD);
+}
+
+
+void Dense::run(const MatrixView& input, Matrix& output, bool activate)
+const
+{
+  if(runs_sparse(input.get_cols()))
+  {
+    _sparse->multiply(input, output);
+    output.broadcast_add(_bias);
+    if(activate)
+    {
+      activate_cols(output);
+    }
+    return;
+  }
+  switch(_precision)
+  {
+    case PRECISION_FP16:
+      apply(_fp16_weights.data(), input, output, activate);
+      break;
+    case PRECISION_BF16:
+      apply(_bf16_weights.data(), input, output, activate);
+      break;
+    default:
+      apply(static_cast<const Matrix&>(_weights).data(), input, output,
+            activate);
+  }
+}
+
+
+void Dense::run(const uint8_t* pixels, int count, float scale,
+                const Matrix& bias, Matrix& output, bool activate) const
+{
+  if(bias.get_rows() != _weights.get_rows() || bias.get_cols() != ONE_COL)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  if(runs_sparse(count))
+  {
+    _sparse->multiply_u8t(pixels, count, output);
+    output *= scale;
+    output.broadcast_add(bias);
+    if(activate)
+    {
+      activate_cols(output);
+    }
+    return;
+  }
+  switch(_precision)
+  {
+    case PRECISION_FP16:
+      apply(_fp16_weights.data(), pixels, count, scale, bias, output,
+            activate);
+      break;
+    case PRECISION_BF16:
+      apply(_bf16_weights.data(), pixels, count, scale, bias, output,
+            activate);
+      break;
+    default:
+      apply(static_cast<const Matrix&>(_weights).data(), pixels, count,
+            scale, bias, output, activate);
+  }
+}
+
+
+template <typename W>
+void Dense::apply(const W* weights, const MatrixView& input, Matrix& output,
+                  bool activate) const
+{
+  const int rows = _weights.get_rows();
+  const int cols = _weights.get_cols();
+  if(input.get_rows() != cols)
+  {
+    throw length_error(MAT_MULT_ERR_MSG);
+  }
+  const int count = input.get_cols();
+  output.resize(rows, count);
+  //gemm reads strided rows in place, the vector sweeps need one contiguous
+  static thread_local std::vector<float> scratch;
+  const MatrixView x = (count == ONE_COL) ? input.contiguous(scratch)
+                                          : input.with_contiguous_rows(scratch);
+
+  //single vector through a built-in activation: one fused sweep
+  if(activate && count == ONE_COL && _activation_func == activation::relu)
+  {
+    linalg::dense_relu(rows, cols, weights, cols, x.data(), _bias.data(),
+                       output.data());
+    return;
+  }
+  if(activate && count == ONE_COL &&
+     _activation_func == activation::softmax)
+  {
+    linalg::dense_softmax(rows, cols, weights, cols, x.data(),
+                          _bias.data(), output.data());
+    return;
+  }
+  if(count == ONE_COL)
+  {
+    linalg::gemv(rows, cols, weights, cols, x.data(), output.data());
+  }
+  else
+  {
+    linalg::gemm(rows, count, cols, weights, cols, x.data(),
+                 x.get_row_stride(), output.data(), count);
+  }
+  output.broadcast_add(_bias);
+  if(activate)
+  {
+    activate_cols(output);
+  }
+}
+
+
+template <typename W>
+void Dense::apply(const W* weights, const uint8_t* pixels, int count,
+                  float scale, const Matrix& bias, Matrix& output,
+                  bool activate) const
+{
+  const int rows = _weights.get_rows();
+  const int img_size = _weights.get_cols();
+  output.resize(rows, count);
+  if(activate && count == ONE_COL && _activation_func == activation::relu)
+  {
+    linalg::dense_relu_u8(rows, img_size, weights, img_size, pixels, scale,
+                          bias.data(), output.data());
+    return;
+  }
+  if(count == ONE_COL)
+  {
+    linalg::gemv_u8(rows, img_size, weights, img_size, pixels,
+                    output.data());
+  }
+  else
+  {
+    linalg::gemm_u8t(rows, count, img_size, weights, img_size, pixels,
+                     img_size, output.data(), count);
+  }
+  output *= scale;
+  output.broadcast_add(bias);
+  if(activate)
+  {
+    activate_cols(output);
+  }
+}
+
+
+void Dense::activate_cols(Matrix& batch) const
+{
+  if(_activation_func == activation::relu)
+  {
+    activation::relu_in_place(batch);
+    return;
+  }
+  if(_activation_func == activation::softmax)
+  {
+    activation::softmax_cols_in_place(batch);
+    return;
+  }
+  if(batch.get_cols() == ONE_COL)
+  {
+    batch = _activation_func(batch);
+    return;
+  }
+  for(int col=0; col<batch.get_cols(); col++)
+  {
+    batch.set_col(col, _activation_func(batch.get_col(col)));
+  }
+}
@@ -2,6 +2,19 @@
 #define DENSE_H
 
 #include "Activation.h"
+#include "Half.h"
+#include "SparseMatrix.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// fraction of zero weights from which bundle::write stores a layer in CSR
+// form, so it loads running on the CSR kernels
+#define DENSE_SPARSE_THRESHOLD 0.8F
+// fraction of zero weights from which a sparse layer runs single vectors on
+// the CSR kernels too. below it the dense GEMV is faster, the CSR kernels
+// only win on batches
+#define DENSE_SPARSE_GEMV_THRESHOLD 0.95F
 
 
 class Dense
@@ -10,6 +23,7 @@ class Dense
 
   /**
    * constructor - represents a layer in neural network
+   * the layer runs on the dense kernels, see set_sparse
    * @param weight a Matrix represents the weights
    * @param bias a Vector (one col Matrix)
    * @param activation_func A function that acts on a Matrix object
@@ -17,6 +31,16 @@ class Dense
   Dense(const Matrix& weight, const Matrix& bias, activation_t
   activation_func);
 
+  /**
+   * constructor - a layer running on the CSR kernels, e.g a pruned layer
+   * read from a bundle. get_weights() returns them expanded
+   * @param weight the weights in CSR form
+   * @param bias a Vector (one col Matrix)
+   * @param activation_func A function that acts on a Matrix object
+   */
+  Dense(const SparseMatrix& weight, const Matrix& bias, activation_t
+  activation_func);
+
   // getters
   /**
    * @returns the weight Matrix object
@@ -33,14 +57,173 @@ class Dense
    */
   activation_t get_activation() const;
 
+  /**
+   * @returns the precision the products read the weights in
+   */
+  weight_precision get_precision() const;
+
+  /**
+   * @returns true if the products run on the CSR form of the weights, single
+   * vectors only past DENSE_SPARSE_GEMV_THRESHOLD
+   */
+  bool is_sparse() const;
+
+  /**
+   * @returns the gradient of the weights from the last backward call
+   */
+  const Matrix& get_weights_grad() const;
+
+  /**
+   * @returns the gradient of the bias from the last backward call
+   */
+  const Matrix& get_bias_grad() const;
+
+  // setters
+  /**
+   * sets the precision the products read the weights in. fp16 and bf16
+   * keep a narrowed copy of the weights, half the bytes each product
+   * streams; get_weights() still returns the full precision weights,
+   * which products no longer touch
+   * @param precision the storage precision
+   */
+  void set_precision(weight_precision precision);
+
+  /**
+   * switches between the dense and CSR kernels, compressing the weights
+   * when switched on. a sparse layer reads its weights in float, whatever
+   * the precision. single vectors stay on the dense kernels below
+   * DENSE_SPARSE_GEMV_THRESHOLD
+   * @param sparse true to run on the CSR form of the weights
+   */
+  void set_sparse(bool sparse);
+
   // methods
-  Matrix operator()(const Matrix& input);
+  /**
+   * activate the layer
+   * @param input a vector, or a batch where every column is one input, e.g
+   * a Matrix or a view of some columns of a larger batch
+   * @return A new allocated Matrix object, one output column per input column
+   */
+  Matrix operator()(const MatrixView& input);
+
+  /**
+   * activate the layer into a preallocated buffer
+   * no allocation is made when output already has the result size and the
+   * activation is relu or softmax
+   * @param input a vector, or a batch where every column is one input, read
+   * in place when its rows are contiguous, see MatrixView
+   * @param output a Matrix object to hold the result, resized if needed, not
+   * viewed by input
+   */
+  void operator()(const MatrixView& input, Matrix& output) const;
+
+  /**
+   * activate the layer on 8 bit inputs read as scale*pixels, without ever
+   * converting them to floats: the scale is applied to the layer outputs
+   * @param pixels count inputs of get_weights().get_cols() bytes each,
+   * back to back
+   * @param count number of inputs
+   * @param scale the value of one pixel step
+   * @param bias used in place of the layer bias, so an input offset can be
+   * folded into it, see MlpNetwork::set_pixel_normalization
+   * @param output a Matrix object to hold the result, one column per input
+   */
+  void operator()(const uint8_t* pixels, int count, float scale,
+                  const Matrix& bias, Matrix& output) const;
+
+  /**
+   * the layer before its activation, output = weights*input + bias.
+   * e.g. the logits of a softmax layer, whose argmax is the same
+   * @param input a vector, or a batch where every column is one input
+   * @param output a Matrix object to hold the result, resized if needed
+   */
+  void pre_activation(const MatrixView& input, Matrix& output) const;
+
+  /**
+   * the layer on 8 bit inputs before its activation, see pre_activation
+   * and the 8 bit operator()
+   */
+  void pre_activation(const uint8_t* pixels, int count, float scale,
+                      const Matrix& bias, Matrix& output) const;
+
+  /**
+   * backward pass of the layer, fills the weights and bias gradients
+   * @param input the layer input of the forward pass, one column per input
+   * @param grad the gradient of the loss by the layer pre-activation, one
+   * column per input, e.g. from activation::relu_backward
+   */
+  void backward(const MatrixView& input, const Matrix& grad);
+
+  /**
+   * backward pass of the layer that also returns the gradient by its input,
+   * the gradient of the previous layer output
+   * @param input_grad resized to input size, weights^T*grad
+   * see backward for the other parameters
+   */
+  void backward(const MatrixView& input, const Matrix& grad,
+                Matrix& input_grad);
+
+  /**
+   * weights -= weights_step and bias -= bias_step, then the narrowed and
+   * CSR copies are refreshed. the zero weights of a sparse layer stay zero,
+   * so a pruned layer keeps its sparsity while it trains
+   * @param weights_step a Matrix of the weights size
+   * @param bias_step a Matrix of the bias size
+   */
+  void apply_step(const Matrix& weights_step, const Matrix& bias_step);
 
   // operators
  private:
+  /**
+   * applies the activation function in place, every column of a batch
+   * separately
+   * @param batch a Matrix object, every column is one layer output
+   */
+  void activate_cols(Matrix& batch) const;
+
+  /**
+   * @return true if a product of count inputs runs on the CSR kernels
+   */
+  bool runs_sparse(int count) const;
+
+  /**
+   * the float input layer, see operator()
+   * @param activate false stops before the activation, see pre_activation
+   */
+  void run(const MatrixView& input, Matrix& output, bool activate) const;
+
+  /**
+   * the 8 bit input layer, see operator()
+   * @param activate false stops before the activation, see pre_activation
+   */
+  void run(const uint8_t* pixels, int count, float scale, const Matrix& bias,
+           Matrix& output, bool activate) const;
+
+  /**
+   * the float input products, see operator()
+   * @param weights the weights in the storage precision
+   */
+  template <typename W>
+  void apply(const W* weights, const MatrixView& input, Matrix& output,
+             bool activate) const;
+
+  /**
+   * the 8 bit input products, see operator()
+   * @param weights the weights in the storage precision
+   */
+  template <typename W>
+  void apply(const W* weights, const uint8_t* pixels, int count, float scale,
+             const Matrix& bias, Matrix& output, bool activate) const;
+
   activation_t _activation_func;
   Matrix _weights;
   Matrix _bias;
+  weight_precision _precision;
+  std::vector<fp16_t> _fp16_weights; // filled when _precision is fp16
+  std::vector<bf16_t> _bf16_weights; // filled when _precision is bf16
+  std::shared_ptr<const SparseMatrix> _sparse; // set when running sparse
+  Matrix _weights_grad; // sized by the first backward call
+  Matrix _bias_grad;
 };
 
 
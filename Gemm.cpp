@@ -0,0 +1,541 @@
+#include "Gemm.h"
+#include "Activation.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+//////////////////////////////// PACKING //////////////////////////////////////
+namespace
+{
+  using linalg::vec_t;
+
+  //8, 16 and 32 bit lanes that widen into exactly one vec_t
+  typedef uint8_t u8vec_t __attribute__((vector_size(VEC_WIDTH)));
+  typedef uint16_t u16vec_t __attribute__((vector_size(2*VEC_WIDTH)));
+  typedef uint32_t u32vec_t __attribute__((vector_size(4*VEC_WIDTH)));
+
+  std::atomic<long> parallel_flops(GEMM_PARALLEL_FLOPS);
+
+  /**
+   * packs an mc x kc block of a into GEMM_MR row panels,
+   * every panel is stored k-major and zero padded to GEMM_MR rows
+   */
+  template <typename W>
+  void pack_a(int mc, int kc, const W* a, int lda, float* buf)
+  {
+    for(int panel=0; panel<mc; panel+=GEMM_MR)
+    {
+      const int rows = (mc - panel < GEMM_MR) ? mc - panel : GEMM_MR;
+      for(int p=0; p<kc; p++)
+      {
+        for(int i=0; i<GEMM_MR; i++)
+        {
+          *buf++ = (i < rows) ? half::to_float(a[(panel + i)*lda + p])
+                              : 0.0F;
+        }
+      }
+    }
+  }
+
+
+  /**
+   * packs a kc x nc block of b into GEMM_NR column panels,
+   * every panel is stored k-major and zero padded to GEMM_NR columns
+   */
+  void pack_b(int kc, int nc, const float* b, int ldb, float* buf)
+  {
+    for(int panel=0; panel<nc; panel+=GEMM_NR)
+    {
+      const int cols = (nc - panel < GEMM_NR) ? nc - panel : GEMM_NR;
+      for(int p=0; p<kc; p++)
+      {
+        const float* b_row = b + p*ldb + panel;
+        for(int j=0; j<GEMM_NR; j++)
+        {
+          *buf++ = (j < cols) ? b_row[j] : 0.0F;
+        }
+      }
+    }
+  }
+
+
+  /**
+   * same as pack_b for a block of b = bt^T, 8 bit bt is widened to float
+   * here so the micro kernel is shared
+   */
+  template <typename T>
+  void pack_bt(int kc, int nc, const T* bt, int ldbt, float* buf)
+  {
+    for(int panel=0; panel<nc; panel+=GEMM_NR)
+    {
+      const int cols = (nc - panel < GEMM_NR) ? nc - panel : GEMM_NR;
+      for(int p=0; p<kc; p++)
+      {
+        for(int j=0; j<GEMM_NR; j++)
+        {
+          *buf++ = (j < cols) ? bt[(panel + j)*ldbt + p] : 0.0F;
+        }
+      }
+    }
+  }
+
+
+  /**
+   * rhs of a gemm, packs blocks of a row-major float matrix
+   */
+  struct float_rhs
+  {
+    const float* b;
+    int ldb;
+
+    void operator()(int pc, int jc, int kc, int nc, float* buf) const
+    {
+      pack_b(kc, nc, b + pc*ldb + jc, ldb, buf);
+    }
+  };
+
+
+  /**
+   * rhs of a gemm, packs blocks of the transpose of a row-major float or
+   * 8 bit matrix
+   */
+  template <typename T>
+  struct transposed_rhs
+  {
+    const T* bt;
+    int ldbt;
+
+    void operator()(int pc, int jc, int kc, int nc, float* buf) const
+    {
+      pack_bt(kc, nc, bt + jc*ldbt + pc, ldbt, buf);
+    }
+  };
+
+/////////////////////////////// MICRO KERNEL //////////////////////////////////
+
+  /**
+   * computes a GEMM_MR x GEMM_NR tile of c from packed panels, keeping the
+   * whole tile in registers for the length of the kc loop
+   * @param accumulate false on the first kc block, c is overwritten
+   */
+  void micro_kernel(int kc, const float* __restrict a,
+                    const float* __restrict b, float* c, int ldc,
+                    int rows, int cols, bool accumulate)
+  {
+    vec_t acc[GEMM_MR][GEMM_NR/VEC_WIDTH] = {};
+    for(int p=0; p<kc; p++)
+    {
+      vec_t b_vec[GEMM_NR/VEC_WIDTH];
+      memcpy(b_vec, b, sizeof(b_vec));
+      for(int i=0; i<GEMM_MR; i++)
+      {
+        for(int j=0; j<GEMM_NR/VEC_WIDTH; j++)
+        {
+          acc[i][j] += a[i]*b_vec[j];
+        }
+      }
+      a += GEMM_MR;
+      b += GEMM_NR;
+    }
+
+    float tile[GEMM_MR][GEMM_NR];
+    memcpy(tile, acc, sizeof(tile));
+    for(int i=0; i<rows; i++)
+    {
+      float* c_row = c + i*ldc;
+      if(accumulate)
+      {
+        for(int j=0; j<cols; j++)
+        {
+          c_row[j] += tile[i][j];
+        }
+      }
+      else
+      {
+        for(int j=0; j<cols; j++)
+        {
+          c_row[j] = tile[i][j];
+        }
+      }
+    }
+  }
+
+
+  /**
+   * @return the sum of all lanes of v
+   */
+  inline float reduce(const vec_t& v)
+  {
+    float sum = 0.0F;
+    for(int l=0; l<VEC_WIDTH; l++)
+    {
+      sum += v[l];
+    }
+    return sum;
+  }
+
+
+  /**
+   * loads VEC_WIDTH consecutive values of x as floats
+   */
+  inline vec_t load(const float* x)
+  {
+    vec_t v;
+    memcpy(&v, x, sizeof(v));
+    return v;
+  }
+
+
+  inline vec_t load(const uint8_t* x)
+  {
+    u8vec_t bytes;
+    memcpy(&bytes, x, sizeof(bytes));
+    return __builtin_convertvector(bytes, vec_t);
+  }
+
+
+  inline vec_t load(const bf16_t* x)
+  {
+    //a bf16 is the top half of a float. one widening move where there is
+    //one, gcc splits the generic conversion into halves. the masked forms
+    //avoid -Wmaybe-uninitialized in some gcc headers
+    vec_t v;
+#if defined(__AVX512F__)
+    const __m512i bits = _mm512_maskz_slli_epi32(
+        (__mmask16) 0xFFFF,
+        _mm512_maskz_cvtepu16_epi32((__mmask16) 0xFFFF,
+                                    _mm256_loadu_si256((const __m256i*) x)),
+        16);
+    memcpy(&v, &bits, sizeof(v));
+#elif defined(__AVX2__)
+    const __m256i bits = _mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) x)), 16);
+    memcpy(&v, &bits, sizeof(v));
+#else
+    u16vec_t halves;
+    memcpy(&halves, x, sizeof(halves));
+    const u32vec_t bits = __builtin_convertvector(halves, u32vec_t) << 16;
+    memcpy(&v, &bits, sizeof(v));
+#endif
+    return v;
+  }
+
+
+  inline vec_t load(const fp16_t* x)
+  {
+    vec_t v;
+#if defined(__AVX512F__)
+    //masked, see load(const bf16_t*)
+    const __m512 wide = _mm512_maskz_cvtph_ps(
+        (__mmask16) 0xFFFF, _mm256_loadu_si256((const __m256i*) x));
+    memcpy(&v, &wide, sizeof(v));
+#elif defined(__F16C__) && defined(__AVX__)
+    const __m256 wide = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) x));
+    memcpy(&v, &wide, sizeof(v));
+#elif defined(__F16C__)
+    const __m128 wide = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*) x));
+    memcpy(&v, &wide, sizeof(v));
+#else
+    for(int l=0; l<VEC_WIDTH; l++)
+    {
+      v[l] = half::to_float(x[l]);
+    }
+#endif
+    return v;
+  }
+
+
+  /**
+   * @return sum(a[p]*x[p]) for from <= p < to
+   */
+  template <typename W, typename T>
+  inline float dot_tail(const W* a, const T* x, int from, int to)
+  {
+    float sum = 0.0F;
+    for(int p=from; p<to; p++)
+    {
+      sum += half::to_float(a[p])*x[p];
+    }
+    return sum;
+  }
+
+
+  /**
+   * computes the dot product of every row of a with x and hands it to
+   * store(row, dot) as soon as the row is done, so callers can fuse their
+   * epilogue into the sweep. four rows at a time so every load of x feeds
+   * four rows, each row keeps VEC_WIDTH partial sums. a may be 16 bit and x
+   * 8 bit, they are then widened to float as they are loaded
+   */
+  template <typename W, typename T, typename Store>
+  void gemv_rows(int m, int k, const W* a, int lda, const T* x, Store store)
+  {
+    const int k_main = k - (k % VEC_WIDTH);
+    int row = 0;
+    for(; row + 4 <= m; row += 4)
+    {
+      const W* a_rows[4] = {a + row*lda, a + (row + 1)*lda,
+                            a + (row + 2)*lda, a + (row + 3)*lda};
+      vec_t acc[4] = {};
+      for(int p=0; p<k_main; p+=VEC_WIDTH)
+      {
+        const vec_t x_vec = load(x + p);
+        for(int i=0; i<4; i++)
+        {
+          acc[i] += load(a_rows[i] + p)*x_vec;
+        }
+      }
+      for(int i=0; i<4; i++)
+      {
+        store(row + i, reduce(acc[i]) + dot_tail(a_rows[i], x, k_main, k));
+      }
+    }
+    for(; row<m; row++)
+    {
+      const W* a_row = a + row*lda;
+      vec_t acc = {};
+      for(int p=0; p<k_main; p+=VEC_WIDTH)
+      {
+        acc += load(a_row + p)*load(x + p);
+      }
+      store(row, reduce(acc) + dot_tail(a_row, x, k_main, k));
+    }
+  }
+
+
+  /**
+   * single threaded gemm of the m x n block of c starting at column col,
+   * see linalg::gemm
+   * @param rhs packs kc x nc blocks of b, given absolute coordinates
+   */
+  template <typename W, typename Rhs>
+  void gemm_serial(int m, int n, int k, const W* a, int lda,
+                   const Rhs& rhs, int col, float* c, int ldc)
+  {
+    //packing buffers are kept per thread, so repeated calls don't allocate
+    static thread_local std::vector<float> a_buf;
+    static thread_local std::vector<float> b_buf;
+    a_buf.resize((GEMM_MC + GEMM_MR)*GEMM_KC);
+    b_buf.resize((GEMM_NC + GEMM_NR)*GEMM_KC);
+
+    for(int jc=0; jc<n; jc+=GEMM_NC)
+    {
+      const int nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+      for(int pc=0; pc<k; pc+=GEMM_KC)
+      {
+        const int kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+        rhs(pc, col + jc, kc, nc, b_buf.data());
+        for(int ic=0; ic<m; ic+=GEMM_MC)
+        {
+          const int mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+          pack_a(mc, kc, a + ic*lda + pc, lda, a_buf.data());
+          for(int jr=0; jr<nc; jr+=GEMM_NR)
+          {
+            const int cols = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+            for(int ir=0; ir<mc; ir+=GEMM_MR)
+            {
+              const int rows = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+              micro_kernel(kc, a_buf.data() + ir*kc, b_buf.data() + jr*kc,
+                           c + (ic + ir)*ldc + jc + jr, ldc, rows, cols,
+                           pc != 0);
+            }
+          }
+        }
+      }
+    }
+  }
+
+
+  /**
+   * plain i-k-j loop for products too small to amortize packing,
+   * the inner loop walks b and c along rows
+   */
+  template <typename W>
+  void gemm_small(int m, int n, int k, const W* a, int lda,
+                  const float* b, int ldb, float* c, int ldc)
+  {
+    for(int i=0; i<m; i++)
+    {
+      float* c_row = c + i*ldc;
+      for(int j=0; j<n; j++)
+      {
+        c_row[j] = 0.0F;
+      }
+      for(int p=0; p<k; p++)
+      {
+        const float a_val = half::to_float(a[i*lda + p]);
+        const float* b_row = b + p*ldb;
+        for(int j=0; j<n; j++)
+        {
+          c_row[j] += a_val*b_row[j];
+        }
+      }
+    }
+  }
+
+
+  /**
+   * blocked gemm, split by output tile across ThreadPool::shared() when
+   * the product is large enough, see linalg::gemm
+   */
+  template <typename W, typename Rhs>
+  void gemm_blocked(int m, int n, int k, const W* a, int lda,
+                    const Rhs& rhs, float* c, int ldc)
+  {
+    const long flops = ((long) m)*n*k;
+    ThreadPool& pool = ThreadPool::shared();
+    if(flops < linalg::parallel_threshold() || pool.size() == 1 ||
+       ThreadPool::in_parallel())
+    {
+      gemm_serial(m, n, k, a, lda, rhs, 0, c, ldc);
+      return;
+    }
+
+    //every task owns a GEMM_TILE_ROWS x GEMM_TILE_COLS tile of c
+    const int row_tiles = (m + GEMM_TILE_ROWS - 1)/GEMM_TILE_ROWS;
+    const int col_tiles = (n + GEMM_TILE_COLS - 1)/GEMM_TILE_COLS;
+    pool.parallel_for(row_tiles*col_tiles, 1, [&](int begin, int end, int)
+    {
+      for(int tile=begin; tile<end; tile++)
+      {
+        const int row = (tile/col_tiles)*GEMM_TILE_ROWS;
+        const int col = (tile%col_tiles)*GEMM_TILE_COLS;
+        const int rows = (m - row < GEMM_TILE_ROWS) ? m - row : GEMM_TILE_ROWS;
+        const int cols = (n - col < GEMM_TILE_COLS) ? n - col : GEMM_TILE_COLS;
+        gemm_serial(rows, cols, k, a + row*lda, lda, rhs, col,
+                    c + row*ldc + col, ldc);
+      }
+    });
+  }
+}
+
+/////////////////////////////////// GEMM //////////////////////////////////////
+
+template <typename W>
+void linalg::gemm(int m, int n, int k, const W* a, int lda,
+                  const float* b, int ldb, float* c, int ldc)
+{
+  if(((long) m)*n*k < GEMM_SMALL_FLOPS)
+  {
+    gemm_small(m, n, k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+  gemm_blocked(m, n, k, a, lda, float_rhs{b, ldb}, c, ldc);
+}
+
+
+template <typename W>
+void linalg::gemm_u8t(int m, int n, int k, const W* a, int lda,
+                      const uint8_t* bt, int ldbt, float* c, int ldc)
+{
+  gemm_blocked(m, n, k, a, lda, transposed_rhs<uint8_t>{bt, ldbt}, c, ldc);
+}
+
+
+void linalg::gemm_nt(int m, int n, int k, const float* a, int lda,
+                     const float* bt, int ldbt, float* c, int ldc)
+{
+  gemm_blocked(m, n, k, a, lda, transposed_rhs<float>{bt, ldbt}, c, ldc);
+}
+
+
+long linalg::parallel_threshold()
+{
+  return parallel_flops.load(std::memory_order_relaxed);
+}
+
+
+void linalg::set_parallel_threshold(long flops)
+{
+  parallel_flops.store(flops, std::memory_order_relaxed);
+}
+
+/////////////////////////////////// GEMV //////////////////////////////////////
+
+template <typename W>
+void linalg::gemv(int m, int k, const W* a, int lda, const float* x,
+                  float* y)
+{
+  gemv_rows(m, k, a, lda, x, [y](int row, float dot)
+  {
+    y[row] = dot;
+  });
+}
+
+
+template <typename W>
+void linalg::gemv_u8(int m, int k, const W* a, int lda, const uint8_t* x,
+                     float* y)
+{
+  gemv_rows(m, k, a, lda, x, [y](int row, float dot)
+  {
+    y[row] = dot;
+  });
+}
+
+///////////////////////////////// FUSED DENSE /////////////////////////////////
+
+template <typename W>
+void linalg::dense_relu(int m, int k, const W* a, int lda,
+                        const float* x, const float* bias, float* y)
+{
+  gemv_rows(m, k, a, lda, x, [y, bias](int row, float dot)
+  {
+    const float val = dot + bias[row];
+    y[row] = (val <= 0) ? 0 : val;
+  });
+}
+
+
+template <typename W>
+void linalg::dense_relu_u8(int m, int k, const W* a, int lda,
+                           const uint8_t* x, float scale, const float* bias,
+                           float* y)
+{
+  gemv_rows(m, k, a, lda, x, [y, scale, bias](int row, float dot)
+  {
+    const float val = scale*dot + bias[row];
+    y[row] = (val <= 0) ? 0 : val;
+  });
+}
+
+
+template <typename W>
+void linalg::dense_softmax(int m, int k, const W* a, int lda,
+                           const float* x, const float* bias, float* y)
+{
+  gemv_rows(m, k, a, lda, x, [y, bias](int row, float dot)
+  {
+    y[row] = dot + bias[row];
+  });
+  //the sweep over a is done, what's left touches only the m outputs
+  activation::softmax_span(y, m);
+}
+
+//////////////////////////////// INSTANCES ////////////////////////////////////
+
+#define LINALG_INSTANTIATE(W) \
+  template void linalg::gemm(int, int, int, const W*, int, const float*, \
+                             int, float*, int); \
+  template void linalg::gemm_u8t(int, int, int, const W*, int, \
+                                 const uint8_t*, int, float*, int); \
+  template void linalg::gemv(int, int, const W*, int, const float*, float*); \
+  template void linalg::gemv_u8(int, int, const W*, int, const uint8_t*, \
+                                float*); \
+  template void linalg::dense_relu(int, int, const W*, int, const float*, \
+                                   const float*, float*); \
+  template void linalg::dense_relu_u8(int, int, const W*, int, \
+                                      const uint8_t*, float, const float*, \
+                                      float*); \
+  template void linalg::dense_softmax(int, int, const W*, int, const float*, \
+                                      const float*, float*);
+
+LINALG_INSTANTIATE(float)
+LINALG_INSTANTIATE(fp16_t)
+LINALG_INSTANTIATE(bf16_t)
@@ -0,0 +1,158 @@
+// Gemm.h
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "Half.h"
+#include <cstdint>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define GEMM_MR 4       // micro tile rows
+#define GEMM_NR 16      // micro tile columns
+#define GEMM_KC 256     // depth of a packed block (L1)
+#define GEMM_MC 128     // rows of a packed lhs block (L2)
+#define GEMM_NC 2048    // columns of a packed rhs block (L3)
+#define GEMM_SMALL_FLOPS 4096L // below this, skip packing altogether
+#define GEMM_PARALLEL_FLOPS (1L << 22) // default size to split a product at
+#define GEMM_TILE_ROWS GEMM_MC // output rows of one parallel task
+#define GEMM_TILE_COLS 128  // output columns of one parallel task
+
+//floats in one vec_t, the widest registers the target was compiled for
+#if defined(__AVX512F__)
+#define VEC_WIDTH 16
+#elif defined(__AVX__)
+#define VEC_WIDTH 8
+#else
+#define VEC_WIDTH 4
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Row-major single precision matrix kernels used by Matrix::operator*.
+ * All pointers address row-major storage, ld* are the row strides.
+ * The lhs (weights) may be stored as W = float, fp16_t or bf16_t, it is
+ * widened to float as it is loaded and all arithmetic is float.
+ */
+namespace linalg
+{
+    //generic vector type, lowered by the compiler to native registers
+    typedef float vec_t __attribute__((vector_size(VEC_WIDTH*sizeof(float))));
+
+
+    /**
+    * general matrix multiplication, c = a*b
+    * blocked for L1/L2, packs a and b into contiguous panels and computes
+    * GEMM_MR x GEMM_NR register tiles. products of at least
+    * parallel_threshold() multiply-adds are split by output tile across
+    * ThreadPool::shared(), unless already called from a parallel loop
+    * @param m rows of a and c
+    * @param n columns of b and c
+    * @param k columns of a, rows of b
+    * @param a lhs data, m x k
+    * @param lda row stride of a
+    * @param b rhs data, k x n
+    * @param ldb row stride of b
+    * @param c output data, m x n, overwritten
+    * @param ldc row stride of c
+    */
+    template <typename W>
+    void gemm(int m, int n, int k, const W* a, int lda,
+              const float* b, int ldb, float* c, int ldc);
+
+
+    /**
+    * gemm against the transpose of an 8 bit matrix, c = a*bt^T
+    * bt is widened to float while it is packed, so the product costs the
+    * same as gemm and bt is read at a quarter of the bandwidth
+    * @param bt rhs data transposed, n x k, e.g. n images back to back
+    * @param ldbt row stride of bt
+    * see gemm for the other parameters
+    */
+    template <typename W>
+    void gemm_u8t(int m, int n, int k, const W* a, int lda,
+                  const uint8_t* bt, int ldbt, float* c, int ldc);
+
+
+    /**
+    * gemm against the transpose of a float matrix, c = a*bt^T, e.g. the
+    * weight gradient of a layer: its output gradients times its inputs
+    * transposed. bt is transposed while it is packed, see gemm_u8t
+    * @param bt rhs data transposed, n x k
+    * @param ldbt row stride of bt
+    * see gemm for the other parameters
+    */
+    void gemm_nt(int m, int n, int k, const float* a, int lda,
+                 const float* bt, int ldbt, float* c, int ldc);
+
+
+    /**
+    * matrix-vector multiplication, y = a*x
+    * @param m rows of a, length of y
+    * @param k columns of a, length of x
+    * @param a matrix data, m x k
+    * @param lda row stride of a
+    * @param x contiguous vector of length k
+    * @param y contiguous output vector of length m, overwritten
+    */
+    template <typename W>
+    void gemv(int m, int k, const W* a, int lda, const float* x, float* y);
+
+
+    /**
+    * matrix-vector multiplication against an 8 bit vector, y = a*x
+    * x is widened to float in registers, see gemv
+    */
+    template <typename W>
+    void gemv_u8(int m, int k, const W* a, int lda, const uint8_t* x,
+                 float* y);
+
+
+    /**
+    * @return the m*n*k size from which gemm runs on multiple threads
+    */
+    long parallel_threshold();
+
+
+    /**
+    * @param flops the m*n*k size from which gemm runs on multiple threads,
+    * default GEMM_PARALLEL_FLOPS
+    */
+    void set_parallel_threshold(long flops);
+
+
+    /**
+    * fused dense layer with relu, y = relu(a*x + bias), in one sweep over a
+    * @param bias contiguous vector of length m
+    * see gemv for the other parameters
+    */
+    template <typename W>
+    void dense_relu(int m, int k, const W* a, int lda, const float* x,
+                    const float* bias, float* y);
+
+
+    /**
+    * fused dense layer with relu on an 8 bit vector,
+    * y = relu(scale*(a*x) + bias). scaling the m dot products instead of the
+    * k inputs folds an input normalization x*scale + offset into the sweep,
+    * given bias + offset*rowsum(a) as bias
+    * see dense_relu for the other parameters
+    */
+    template <typename W>
+    void dense_relu_u8(int m, int k, const W* a, int lda,
+                       const uint8_t* x, float scale, const float* bias,
+                       float* y);
+
+
+    /**
+    * fused dense layer with softmax, y = softmax(a*x + bias)
+    * the bias add is done in the sweep over a, then activation::softmax_span
+    * makes its max, exp and normalization passes over the m outputs
+    * @param bias contiguous vector of length m
+    * see gemv for the other parameters
+    */
+    template <typename W>
+    void dense_softmax(int m, int k, const W* a, int lda,
+                       const float* x, const float* bias, float* y);
+}
+
+#endif //GEMM_H
@@ -0,0 +1,40 @@
+#include "Half.h"
+
+#if defined(__F16C__) || defined(__AVX512BF16__)
+#include <immintrin.h>
+#endif
+
+void half::narrow(const float* src, fp16_t* dst, size_t n)
+{
+  size_t i = 0;
+#ifdef __F16C__
+  for(; i + 8 <= n; i += 8)
+  {
+    const __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                           _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*) (dst + i), packed);
+  }
+#endif
+  for(; i<n; i++)
+  {
+    dst[i] = to_fp16(src[i]);
+  }
+}
+
+
+void half::narrow(const float* src, bf16_t* dst, size_t n)
+{
+  size_t i = 0;
+#ifdef __AVX512BF16__
+  //same rounding as to_bf16, except that float subnormals become zeros
+  for(; i + 16 <= n; i += 16)
+  {
+    const __m256bh packed = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+    memcpy(dst + i, &packed, sizeof(packed));
+  }
+#endif
+  for(; i<n; i++)
+  {
+    dst[i] = to_bf16(src[i]);
+  }
+}
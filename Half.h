@@ -0,0 +1,179 @@
+// Half.h
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+
+/**
+ * storage precision of layer weights, products always run in float
+ */
+enum weight_precision
+{
+  PRECISION_FP32,
+  PRECISION_FP16, // IEEE half: 5 exponent bits, 10 mantissa bits
+  PRECISION_BF16  // bfloat16: the top 16 bits of a float
+};
+
+/**
+ * @struct fp16_t
+ * @brief The bits of an IEEE half precision float.
+ */
+typedef struct fp16_t
+{
+  uint16_t bits;
+} fp16_t;
+
+/**
+ * @struct bf16_t
+ * @brief The bits of a bfloat16, a float with the low 16 bits dropped.
+ */
+typedef struct bf16_t
+{
+  uint16_t bits;
+} bf16_t;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Scalar conversions between float and the 16 bit formats, used on loop
+ * tails and when the target has no conversion instructions. Narrowing
+ * rounds to nearest even, like the hardware conversions.
+ */
+namespace half
+{
+    /**
+    * @return v, so kernels templated on the weights type read floats too
+    */
+    inline float to_float(float v)
+    {
+      return v;
+    }
+
+
+    /**
+    * @return the float value of h, exact
+    */
+    inline float to_float(bf16_t h)
+    {
+      const uint32_t bits = ((uint32_t) h.bits) << 16;
+      float v;
+      memcpy(&v, &bits, sizeof(v));
+      return v;
+    }
+
+
+    /**
+    * @return the float value of h, exact
+    */
+    inline float to_float(fp16_t h)
+    {
+      const uint32_t sign = ((uint32_t) (h.bits & 0x8000U)) << 16;
+      const uint32_t exponent = (h.bits >> 10) & 0x1FU;
+      const uint32_t mantissa = h.bits & 0x3FFU;
+      uint32_t bits;
+      if(exponent == 0x1FU)
+      {
+        bits = sign | 0x7F800000U | (mantissa << 13); //inf, nan
+      }
+      else if(exponent != 0)
+      {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+      }
+      else if(mantissa == 0)
+      {
+        bits = sign;
+      }
+      else
+      {
+        //subnormal half, a normal float: shift the leading 1 into place
+        uint32_t shifted = mantissa;
+        uint32_t float_exponent = 113;
+        while(!(shifted & 0x400U))
+        {
+          shifted <<= 1;
+          float_exponent--;
+        }
+        bits = sign | (float_exponent << 23) | ((shifted & 0x3FFU) << 13);
+      }
+      float v;
+      memcpy(&v, &bits, sizeof(v));
+      return v;
+    }
+
+
+    /**
+    * @return v rounded to the nearest bfloat16, nan stays nan
+    */
+    inline bf16_t to_bf16(float v)
+    {
+      uint32_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      if((bits & 0x7FFFFFFFU) > 0x7F800000U)
+      {
+        return bf16_t{(uint16_t) ((bits >> 16) | 0x40U)};
+      }
+      bits += 0x7FFFU + ((bits >> 16) & 1U);
+      return bf16_t{(uint16_t) (bits >> 16)};
+    }
+
+
+    /**
+    * @return v rounded to the nearest half, too large values become inf
+    */
+    inline fp16_t to_fp16(float v)
+    {
+      uint32_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      const uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000U);
+      const uint32_t abs = bits & 0x7FFFFFFFU;
+      if(abs > 0x7F800000U)
+      {
+        return fp16_t{(uint16_t) (sign | 0x7E00U)};
+      }
+      if(abs >= 0x477FF000U) //rounds past the largest half, 65504
+      {
+        return fp16_t{(uint16_t) (sign | 0x7C00U)};
+      }
+      if(abs < 0x38800000U) //below the smallest normal half
+      {
+        if(abs < 0x33000000U) //below half the smallest subnormal
+        {
+          return fp16_t{sign};
+        }
+        //align the mantissa, with its leading 1, to the subnormal step
+        const uint32_t exponent = abs >> 23;
+        const uint32_t mantissa = (abs & 0x7FFFFFU) | 0x800000U;
+        const uint32_t shift = 126 - exponent;
+        const uint32_t half_step = 1U << (shift - 1);
+        const uint32_t rest = mantissa & ((1U << shift) - 1);
+        uint32_t result = mantissa >> shift;
+        if(rest > half_step || (rest == half_step && (result & 1U)))
+        {
+          result++;
+        }
+        return fp16_t{(uint16_t) (sign | result)};
+      }
+      //normal: rebias the exponent, round the 13 dropped mantissa bits
+      uint32_t result = abs - 0x38000000U;
+      result += 0xFFFU + ((result >> 13) & 1U);
+      return fp16_t{(uint16_t) (sign | (result >> 13))};
+    }
+
+
+    /**
+    * narrows n floats, with F16C when the target has it
+    */
+    void narrow(const float* src, fp16_t* dst, size_t n);
+
+
+    /**
+    * narrows n floats, with AVX-512 BF16 when the target has it
+    */
+    void narrow(const float* src, bf16_t* dst, size_t n);
+}
+
+#endif //HALF_H
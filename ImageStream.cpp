@@ -0,0 +1,263 @@
+#include "ImageStream.h"
+#include <cstring>
+#include <future>
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  /**
+   * @return a big endian 32 bit value
+   */
+  uint32_t big_endian_u32(const unsigned char* bytes)
+  {
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+           ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+  }
+
+
+  /**
+   * @return true if the stream ended before the first byte of an image
+   */
+  bool clean_end(istream& is, std::streamsize read)
+  {
+    return read == 0 && is.eof();
+  }
+}
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+ImageStream::ImageStream(istream& is, image_format format, int img_size):
+    _is(is), _format(format), _img_size(img_size), _big_endian_floats(false),
+    _pixel_bytes((format == IMAGE_RAW_UBYTE) ? 1 : (int) CELL_SIZE),
+    _remaining(-1)
+{
+  if(format == IMAGE_IDX)
+  {
+    read_idx_header();
+  }
+  if(_img_size <= 0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+int ImageStream::image_size() const
+{
+  return _img_size;
+}
+
+
+bool ImageStream::is_ubyte() const
+{
+  return _pixel_bytes == 1;
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+void ImageStream::read_idx_header()
+{
+  //magic: 0, 0, type, number of dims, then one big endian size per dim
+  unsigned char magic[4];
+  unsigned char sizes[4*IDX_IMAGES_DIMS];
+  _is.read((char*) magic, sizeof(magic));
+  if(!_is || magic[0] != 0 || magic[1] != 0 ||
+     magic[3] != IDX_IMAGES_DIMS ||
+     (magic[2] != IDX_UBYTE_TYPE && magic[2] != IDX_FLOAT_TYPE))
+  {
+    throw runtime_error(IDX_ERR_MSG);
+  }
+  _is.read((char*) sizes, sizeof(sizes));
+  if(!_is)
+  {
+    throw runtime_error(IDX_ERR_MSG);
+  }
+  _remaining = big_endian_u32(sizes);
+  const uint32_t rows = big_endian_u32(sizes + 4);
+  const uint32_t cols = big_endian_u32(sizes + 8);
+  if(rows == 0 || cols == 0 || ((uint64_t) rows)*cols > INT32_MAX)
+  {
+    throw runtime_error(IDX_ERR_MSG);
+  }
+  _img_size = (int) (rows*cols);
+  _pixel_bytes = (magic[2] == IDX_UBYTE_TYPE) ? 1 : (int) CELL_SIZE;
+  _big_endian_floats = (magic[2] == IDX_FLOAT_TYPE);
+}
+
+
+int ImageStream::read_raw(std::vector<unsigned char>& raw, int max_images)
+{
+  int count = max_images;
+  if(_remaining >= 0 && _remaining < count)
+  {
+    count = (int) _remaining;
+  }
+  if(count <= 0)
+  {
+    return 0;
+  }
+
+  //read whole images only, as many as the stream has up to count
+  const size_t img_bytes = ((size_t) _img_size)*_pixel_bytes;
+  raw.resize(img_bytes*count);
+  _is.read((char*) raw.data(), (std::streamsize) raw.size());
+  const std::streamsize read = _is.gcount();
+  if(clean_end(_is, read))
+  {
+    if(_remaining > 0)
+    {
+      throw runtime_error(TRUNCATED_ERR_MSG);
+    }
+    return 0;
+  }
+  if(read % img_bytes != 0 || (_remaining >= 0 && read != (long) raw.size()))
+  {
+    throw runtime_error(TRUNCATED_ERR_MSG);
+  }
+  count = (int) (read/img_bytes);
+  _remaining = (_remaining >= 0) ? _remaining - count : _remaining;
+  raw.resize(count*img_bytes);
+  return count;
+}
+
+
+int ImageStream::read_pixels(std::vector<uint8_t>& pixels, int max_images)
+{
+  if(!is_ubyte())
+  {
+    throw runtime_error(PIXELS_ERR_MSG);
+  }
+  return read_raw(pixels, max_images);
+}
+
+
+int ImageStream::read_batch(Matrix& batch, int max_images)
+{
+  const int count = read_raw(_raw, max_images);
+  if(count == 0)
+  {
+    return 0;
+  }
+  const size_t img_bytes = ((size_t) _img_size)*_pixel_bytes;
+
+  //images arrive one after the other, the batch holds one per column
+  batch.resize(_img_size, count);
+  float* coords = batch.data();
+  for(int img=0; img<count; img++)
+  {
+    const unsigned char* src = _raw.data() + img*img_bytes;
+    for(int pixel=0; pixel<_img_size; pixel++)
+    {
+      float value;
+      if(_pixel_bytes == 1)
+      {
+        value = src[pixel]*PIXEL_SCALE;
+      }
+      else if(_big_endian_floats)
+      {
+        const uint32_t bits = big_endian_u32(src + pixel*CELL_SIZE);
+        memcpy(&value, &bits, sizeof(value));
+      }
+      else
+      {
+        memcpy(&value, src + pixel*CELL_SIZE, sizeof(value));
+      }
+      coords[pixel*count + img] = value;
+    }
+  }
+  return count;
+}
+
+//////////////////////////////// LABELS ///////////////////////////////////////
+
+std::vector<uint8_t> read_idx_labels(istream& is)
+{
+  //magic: 0, 0, ubyte type, 1 dim, then the big endian number of labels
+  unsigned char header[8];
+  is.read((char*) header, sizeof(header));
+  if(!is || header[0] != 0 || header[1] != 0 ||
+     header[2] != IDX_UBYTE_TYPE || header[3] != IDX_LABELS_DIMS)
+  {
+    throw runtime_error(LABELS_ERR_MSG);
+  }
+  const uint32_t count = big_endian_u32(header + 4);
+  if(count > INT32_MAX)
+  {
+    throw runtime_error(LABELS_ERR_MSG);
+  }
+  std::vector<uint8_t> labels(count);
+  is.read((char*) labels.data(), (std::streamsize) count);
+  if(is.gcount() != (std::streamsize) count)
+  {
+    throw runtime_error(LABELS_ERR_MSG);
+  }
+  return labels;
+}
+
+/////////////////////////////// CLASSIFY //////////////////////////////////////
+
+namespace
+{
+  /**
+   * classify_stream over 8 bit images, no float copy of them is ever made
+   */
+  long classify_pixels(MlpNetwork& network, ImageStream& images,
+                       const std::function<void(long, const digit&)>& emit,
+                       int chunk)
+  {
+    std::vector<uint8_t> batches[2];
+    int current = 0;
+    long index = 0;
+    int count = images.read_pixels(batches[current], chunk);
+    while(count > 0)
+    {
+      const int next = 1 - current;
+      std::future<int> next_count = std::async(std::launch::async, [&]()
+      {
+        return images.read_pixels(batches[next], chunk);
+      });
+      const std::vector<digit> digits =
+          network.classify_batch(batches[current].data(), count);
+      for(const digit& result : digits)
+      {
+        emit(index++, result);
+      }
+      count = next_count.get();
+      current = next;
+    }
+    return index;
+  }
+}
+
+
+long classify_stream(MlpNetwork& network, ImageStream& images,
+                     const std::function<void(long, const digit&)>& emit,
+                     int chunk)
+{
+  if(images.is_ubyte())
+  {
+    return classify_pixels(network, images, emit, chunk);
+  }
+  Matrix batches[2];
+  int current = 0;
+  long index = 0;
+  int count = images.read_batch(batches[current], chunk);
+  while(count > 0)
+  {
+    //read the next chunk into the other buffer while this one runs
+    const int next = 1 - current;
+    std::future<int> next_count = std::async(std::launch::async, [&]()
+    {
+      return images.read_batch(batches[next], chunk);
+    });
+    const std::vector<digit> digits = network.classify_batch(batches[current]);
+    for(const digit& result : digits)
+    {
+      emit(index++, result);
+    }
+    count = next_count.get();
+    current = next;
+  }
+  return index;
+}
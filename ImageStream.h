@@ -0,0 +1,125 @@
+// ImageStream.h
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include "MlpNetwork.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define IDX_UBYTE_TYPE 0x08
+#define IDX_FLOAT_TYPE 0x0D
+#define IDX_IMAGES_DIMS 3
+#define IDX_LABELS_DIMS 1
+#define STREAM_CHUNK 1024
+#define IDX_ERR_MSG "Not an IDX images file"
+#define TRUNCATED_ERR_MSG "Images stream ended in the middle of an image"
+#define PIXELS_ERR_MSG "Images stream pixels are not 8 bit"
+#define LABELS_ERR_MSG "Not an IDX labels file"
+
+/**
+ * layouts an ImageStream can read
+ */
+enum image_format
+{
+  IMAGE_IDX,       // MNIST IDX images file, ubyte or float pixels
+  IMAGE_RAW_FLOAT, // headerless images of native floats, back to back
+  IMAGE_RAW_UBYTE  // headerless images of 8 bit pixels, back to back
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads images from a stream in fixed size chunks, front to back, so any
+ * stream works (files, pipes, stdin) and only one chunk is held in memory.
+ * 8 bit pixels are scaled by PIXEL_SCALE into [0, 1].
+ */
+class ImageStream
+{
+ public:
+  //constructor
+  /**
+   * @param is the stream to read, must outlive this object
+   * @param format the stream layout
+   * @param img_size pixels per image of the raw formats, IDX files give
+   * their own
+   * @throws runtime_error if an IDX header is invalid
+   */
+  ImageStream(istream& is, image_format format,
+              int img_size = img_dims.rows*img_dims.cols);
+
+  //getters
+  /**
+   * @return pixels per image
+   */
+  int image_size() const;
+
+  /**
+   * @return true if the stream pixels are 8 bit, so read_pixels works
+   */
+  bool is_ubyte() const;
+
+  //methods
+  /**
+   * reads the next images, one per column
+   * @param batch resized to image_size() X (images read)
+   * @param max_images most images to read
+   * @return number of images read, 0 at the end of the stream
+   * @throws runtime_error if the stream ends in the middle of an image
+   */
+  int read_batch(Matrix& batch, int max_images);
+
+  /**
+   * reads the next images as they are stored, 8 bit pixels back to back
+   * @param pixels resized to image_size() * (images read)
+   * @param max_images most images to read
+   * @return number of images read, 0 at the end of the stream
+   * @throws runtime_error if the pixels are not 8 bit, or if the stream ends
+   * in the middle of an image
+   */
+  int read_pixels(std::vector<uint8_t>& pixels, int max_images);
+
+ private:
+  istream& _is;
+  image_format _format;
+  int _img_size;
+  bool _big_endian_floats;
+  int _pixel_bytes;
+  long _remaining; // images left in an IDX file, -1 if unknown
+  std::vector<unsigned char> _raw;
+
+  void read_idx_header();
+
+  /**
+   * reads whole images into raw, see read_batch
+   * @return number of images read
+   */
+  int read_raw(std::vector<unsigned char>& raw, int max_images);
+};
+
+
+/**
+ * classifies a whole images stream in chunks. the next chunk is read on a
+ * second thread while the current one is classified. 8 bit images are
+ * handed to the network as they are, normalized by its pixel normalization
+ * @param network the network to activate
+ * @param images the stream to classify
+ * @param emit called with the index and digit of every image, in order
+ * @param chunk images per chunk
+ * @return number of images classified
+ */
+long classify_stream(MlpNetwork& network, ImageStream& images,
+                     const std::function<void(long, const digit&)>& emit,
+                     int chunk = STREAM_CHUNK);
+
+
+/**
+ * reads a whole MNIST IDX labels file, one 8 bit class per image
+ * @param is the stream to read
+ * @return the labels, in order
+ * @throws runtime_error if the header is invalid or the stream is short
+ */
+std::vector<uint8_t> read_idx_labels(istream& is);
+
+#endif //IMAGESTREAM_H
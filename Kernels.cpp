@@ -0,0 +1,915 @@
+#include "Kernels.h"
+#include <atomic>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+//////////////////////////////// SCALAR ///////////////////////////////////////
+namespace
+{
+  void add_scalar(const float* a, const float* b, float* out, int n)
+  {
+    for(int i=0; i<n; i++)
+    {
+      out[i] = a[i] + b[i];
+    }
+  }
+
+
+  void mul_scalar(const float* a, const float* b, float* out, int n)
+  {
+    for(int i=0; i<n; i++)
+    {
+      out[i] = a[i] * b[i];
+    }
+  }
+
+
+  void scale_scalar(const float* a, float c, float* out, int n)
+  {
+    for(int i=0; i<n; i++)
+    {
+      out[i] = a[i] * c;
+    }
+  }
+
+
+  float sum_scalar(const float* a, int n)
+  {
+    float sum = 0.0F;
+    for(int i=0; i<n; i++)
+    {
+      sum += a[i];
+    }
+    return sum;
+  }
+
+
+  float sum_sq_scalar(const float* a, int n)
+  {
+    float sum = 0.0F;
+    for(int i=0; i<n; i++)
+    {
+      sum += a[i]*a[i];
+    }
+    return sum;
+  }
+
+
+  int argmax_scalar(const float* a, int n)
+  {
+    int max_index = 0;
+    for(int i=1; i<n; i++)
+    {
+      if(a[i] > a[max_index])
+      {
+        max_index = i;
+      }
+    }
+    return max_index;
+  }
+
+
+  int32_t dot_u8s8_scalar(const uint8_t* a, const int8_t* b, int n)
+  {
+    int32_t sum = 0;
+    for(int i=0; i<n; i++)
+    {
+      sum += a[i]*b[i];
+    }
+    return sum;
+  }
+
+
+  typedef int32_t (*dot_u8s8_t)(const uint8_t*, const int8_t*, int);
+  typedef void (*tile_u8s8_t)(int, const int8_t*, int, const uint8_t*, int,
+                              int32_t*, int);
+
+
+  /**
+   * gemm_u8s8 as one dot product per output, the reference and the
+   * fallback of tables without a register tile
+   */
+  template <dot_u8s8_t Dot>
+  void gemm_u8s8_dots(int m, int n, int k, const int8_t* w, int ldw,
+                      const uint8_t* x, int ldx, int32_t* c, int ldc)
+  {
+    for(int i=0; i<m; i++)
+    {
+      for(int j=0; j<n; j++)
+      {
+        c[((long) i)*ldc + j] = Dot(x + ((long) j)*ldx, w + ((long) i)*ldw,
+                                    k);
+      }
+    }
+  }
+
+
+  /**
+   * c[r*ldc + s] = the sum of the width lanes of tile element [r][s]
+   * @param lanes rows X cols X width accumulator lanes
+   */
+  void sum_lanes(const int32_t* lanes, int rows, int cols, int width,
+                 int32_t* c, int ldc)
+  {
+    for(int r=0; r<rows; r++)
+    {
+      for(int s=0; s<cols; s++)
+      {
+        int32_t sum = 0;
+        for(int l=0; l<width; l++)
+        {
+          sum += lanes[(r*cols + s)*width + l];
+        }
+        c[r*ldc + s] = sum;
+      }
+    }
+  }
+
+
+  /**
+   * gemm_u8s8 in MR x NR register tiles, and MR x 1 Column tiles for the
+   * last inputs, e.g the only one of a single image. a block of
+   * KERNEL_U8S8_MC weight rows stays in cache while every NR inputs stream
+   * by, each tile reads its inputs once for MR rows instead of once per
+   * row. tiles compute the first k rounded down to STEP bytes, Dot the rest
+   * and the rows left
+   */
+  template <int MR, int NR, int STEP, tile_u8s8_t Tile, tile_u8s8_t Column,
+            dot_u8s8_t Dot>
+  void gemm_u8s8_tiled(int m, int n, int k, const int8_t* w, int ldw,
+                       const uint8_t* x, int ldx, int32_t* c, int ldc)
+  {
+    const int kt = k/STEP*STEP;
+    for(int i0=0; i0<m; i0+=KERNEL_U8S8_MC)
+    {
+      const int i_end = (i0 + KERNEL_U8S8_MC < m) ? i0 + KERNEL_U8S8_MC : m;
+      for(int j=0; j<n; )
+      {
+        const int cols = (j + NR <= n) ? NR : 1;
+        const uint8_t* x_tile = x + ((long) j)*ldx;
+        int i = i0;
+        for(; i + MR <= i_end; i += MR)
+        {
+          const int8_t* w_tile = w + ((long) i)*ldw;
+          int32_t* c_tile = c + ((long) i)*ldc + j;
+          if(cols == NR)
+          {
+            Tile(kt, w_tile, ldw, x_tile, ldx, c_tile, ldc);
+          }
+          else
+          {
+            Column(kt, w_tile, ldw, x_tile, ldx, c_tile, ldc);
+          }
+          for(int r=0; kt<k && r<MR; r++)
+          {
+            for(int s=0; s<cols; s++)
+            {
+              c_tile[r*ldc + s] += Dot(x_tile + s*ldx + kt,
+                                       w_tile + r*ldw + kt, k - kt);
+            }
+          }
+        }
+        gemm_u8s8_dots<Dot>(i_end - i, cols, k, w + ((long) i)*ldw, ldw,
+                            x_tile, ldx, c + ((long) i)*ldc + j, ldc);
+        j += cols;
+      }
+    }
+  }
+
+
+
+  /**
+   * @return the first index of max, the value found by a vectorized pass
+   */
+  int first_index_of(const float* a, int n, float max)
+  {
+    for(int i=0; i<n; i++)
+    {
+      if(a[i] == max)
+      {
+        return i;
+      }
+    }
+    return 0;
+  }
+
+  const kernel_table SCALAR_TABLE = {"scalar", add_scalar, mul_scalar,
+                                     scale_scalar, sum_scalar, sum_sq_scalar,
+                                     argmax_scalar, dot_u8s8_scalar,
+                                     gemm_u8s8_dots<dot_u8s8_scalar>};
+
+//////////////////////////////// SSE2 /////////////////////////////////////////
+#ifdef KERNELS_X86
+  __attribute__((target("sse2")))
+  void add_sse2(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+      _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i),
+                                        _mm_loadu_ps(b + i)));
+    }
+    add_scalar(a + i, b + i, out + i, n - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  void mul_sse2(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+      _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                        _mm_loadu_ps(b + i)));
+    }
+    mul_scalar(a + i, b + i, out + i, n - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  void scale_sse2(const float* a, float c, float* out, int n)
+  {
+    const __m128 c_vec = _mm_set1_ps(c);
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+      _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), c_vec));
+    }
+    scale_scalar(a + i, c, out + i, n - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  float hsum_sse2(__m128 v)
+  {
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+
+
+  __attribute__((target("sse2")))
+  float sum_sse2(const float* a, int n)
+  {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      acc0 = _mm_add_ps(acc0, _mm_loadu_ps(a + i));
+      acc1 = _mm_add_ps(acc1, _mm_loadu_ps(a + i + 4));
+    }
+    return hsum_sse2(_mm_add_ps(acc0, acc1)) + sum_scalar(a + i, n - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  float sum_sq_sse2(const float* a, int n)
+  {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      const __m128 v0 = _mm_loadu_ps(a + i), v1 = _mm_loadu_ps(a + i + 4);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(v0, v0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(v1, v1));
+    }
+    return hsum_sse2(_mm_add_ps(acc0, acc1)) + sum_sq_scalar(a + i, n - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  int argmax_sse2(const float* a, int n)
+  {
+    if(n < 8 || a[0] != a[0])
+    {
+      return argmax_scalar(a, n);
+    }
+    //seeded with a[0], max(new, old) keeps old on NaN like the scalar loop
+    __m128 max_vec = _mm_set1_ps(a[0]);
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+      max_vec = _mm_max_ps(_mm_loadu_ps(a + i), max_vec);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, max_vec);
+    float max = lanes[0];
+    for(int l=1; l<4; l++)
+    {
+      max = (lanes[l] > max) ? lanes[l] : max;
+    }
+    for(; i<n; i++)
+    {
+      max = (a[i] > max) ? a[i] : max;
+    }
+    return first_index_of(a, n, max);
+  }
+
+  __attribute__((target("sse2")))
+  int32_t dot_u8s8_sse2(const uint8_t* a, const int8_t* b, int n)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      //no byte multiply before ssse3, widen both sides to 16 bits
+      const __m128i a_vec = _mm_loadu_si128((const __m128i*) (a + i));
+      const __m128i b_vec = _mm_loadu_si128((const __m128i*) (b + i));
+      const __m128i b_sign = _mm_cmpgt_epi8(zero, b_vec);
+      acc = _mm_add_epi32(acc,
+                          _mm_madd_epi16(_mm_unpacklo_epi8(a_vec, zero),
+                                         _mm_unpacklo_epi8(b_vec, b_sign)));
+      acc = _mm_add_epi32(acc,
+                          _mm_madd_epi16(_mm_unpackhi_epi8(a_vec, zero),
+                                         _mm_unpackhi_epi8(b_vec, b_sign)));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           dot_u8s8_scalar(a + i, b + i, n - i);
+  }
+
+  const kernel_table SSE2_TABLE = {"sse2", add_sse2, mul_sse2, scale_sse2,
+                                   sum_sse2, sum_sq_sse2, argmax_sse2,
+                                   dot_u8s8_sse2,
+                                   gemm_u8s8_dots<dot_u8s8_sse2>};
+
+//////////////////////////////// AVX2 /////////////////////////////////////////
+  __attribute__((target("avx2")))
+  void add_avx2(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i),
+                                              _mm256_loadu_ps(b + i)));
+    }
+    add_scalar(a + i, b + i, out + i, n - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  void mul_avx2(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                              _mm256_loadu_ps(b + i)));
+    }
+    mul_scalar(a + i, b + i, out + i, n - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  void scale_avx2(const float* a, float c, float* out, int n)
+  {
+    const __m256 c_vec = _mm256_set1_ps(c);
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), c_vec));
+    }
+    scale_scalar(a + i, c, out + i, n - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  float hsum_avx2(__m256 v)
+  {
+    const __m128 half = _mm_add_ps(_mm256_castps256_ps128(v),
+                                   _mm256_extractf128_ps(v, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+
+
+  __attribute__((target("avx2")))
+  float sum_avx2(const float* a, int n)
+  {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(a + i));
+      acc1 = _mm256_add_ps(acc1, _mm256_loadu_ps(a + i + 8));
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1)) + sum_scalar(a + i, n - i);
+  }
+
+
+  __attribute__((target("avx2,fma")))
+  float sum_sq_avx2(const float* a, int n)
+  {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      const __m256 v0 = _mm256_loadu_ps(a + i);
+      const __m256 v1 = _mm256_loadu_ps(a + i + 8);
+      acc0 = _mm256_fmadd_ps(v0, v0, acc0);
+      acc1 = _mm256_fmadd_ps(v1, v1, acc1);
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1)) + sum_sq_scalar(a + i, n - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  int argmax_avx2(const float* a, int n)
+  {
+    if(n < 16 || a[0] != a[0])
+    {
+      return argmax_scalar(a, n);
+    }
+    //seeded with a[0], max(new, old) keeps old on NaN like the scalar loop
+    __m256 max_vec = _mm256_set1_ps(a[0]);
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      max_vec = _mm256_max_ps(_mm256_loadu_ps(a + i), max_vec);
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max_vec);
+    float max = lanes[0];
+    for(int l=1; l<8; l++)
+    {
+      max = (lanes[l] > max) ? lanes[l] : max;
+    }
+    for(; i<n; i++)
+    {
+      max = (a[i] > max) ? a[i] : max;
+    }
+    return first_index_of(a, n, max);
+  }
+
+  __attribute__((target("avx2")))
+  int32_t dot_u8s8_avx2(const uint8_t* a, const int8_t* b, int n)
+  {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for(; i + 32 <= n; i += 32)
+    {
+      //pmaddubsw: u8*s8 pairs summed to 16 bits, then pairs of those to 32
+      const __m256i pairs = _mm256_maddubs_epi16(
+          _mm256_loadu_si256((const __m256i*) (a + i)),
+          _mm256_loadu_si256((const __m256i*) (b + i)));
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+    int32_t sum = 0;
+    for(int l=0; l<8; l++)
+    {
+      sum += lanes[l];
+    }
+    return sum + dot_u8s8_scalar(a + i, b + i, n - i);
+  }
+
+  /**
+   * a 2 x 4 tile of gemm_u8s8, k a multiple of 32. 8 accumulators and the
+   * 6 rows of one step fit the 16 ymm registers
+   */
+  __attribute__((target("avx2")))
+  void tile_u8s8_avx2(int k, const int8_t* w, int ldw, const uint8_t* x,
+                      int ldx, int32_t* c, int ldc)
+  {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[2][4];
+    #pragma GCC unroll 2
+    for(int r=0; r<2; r++)
+    {
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        acc[r][s] = _mm256_setzero_si256();
+      }
+    }
+    for(int p=0; p<k; p+=32)
+    {
+      __m256i x_vec[4];
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        x_vec[s] = _mm256_loadu_si256((const __m256i*) (x + s*ldx + p));
+      }
+      #pragma GCC unroll 2
+      for(int r=0; r<2; r++)
+      {
+        const __m256i w_vec = _mm256_loadu_si256((const __m256i*)
+                                                 (w + r*ldw + p));
+        #pragma GCC unroll 4
+        for(int s=0; s<4; s++)
+        {
+          const __m256i pairs = _mm256_maddubs_epi16(x_vec[s], w_vec);
+          acc[r][s] = _mm256_add_epi32(acc[r][s],
+                                       _mm256_madd_epi16(pairs, ones));
+        }
+      }
+    }
+    //stored before they're summed, see tile_u8s8_avx512vnni
+    int32_t lanes[2][4][8];
+    #pragma GCC unroll 2
+    for(int r=0; r<2; r++)
+    {
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        _mm256_storeu_si256((__m256i*) lanes[r][s], acc[r][s]);
+      }
+    }
+    sum_lanes(&lanes[0][0][0], 2, 4, 8, c, ldc);
+  }
+
+  /**
+   * a 2 x 1 tile of gemm_u8s8, k a multiple of 32
+   */
+  __attribute__((target("avx2")))
+  void column_u8s8_avx2(int k, const int8_t* w, int ldw, const uint8_t* x,
+                        int, int32_t* c, int ldc)
+  {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    for(int p=0; p<k; p+=32)
+    {
+      const __m256i x_vec = _mm256_loadu_si256((const __m256i*) (x + p));
+      const __m256i w0 = _mm256_loadu_si256((const __m256i*) (w + p));
+      const __m256i w1 = _mm256_loadu_si256((const __m256i*) (w + ldw + p));
+      acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(
+                                        _mm256_maddubs_epi16(x_vec, w0), ones));
+      acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(
+                                        _mm256_maddubs_epi16(x_vec, w1), ones));
+    }
+    //pairwise sums, every 128 bit lane ends as [row 0, row 1, row 0, row 1]
+    __m256i sums = _mm256_hadd_epi32(acc0, acc1);
+    sums = _mm256_hadd_epi32(sums, sums);
+    const __m128i rows = _mm_add_epi32(_mm256_castsi256_si128(sums),
+                                       _mm256_extracti128_si256(sums, 1));
+    c[0] = _mm_cvtsi128_si32(rows);
+    c[ldc] = _mm_extract_epi32(rows, 1);
+  }
+
+  const kernel_table AVX2_TABLE = {"avx2", add_avx2, mul_avx2, scale_avx2,
+                                   sum_avx2, sum_sq_avx2, argmax_avx2,
+                                   dot_u8s8_avx2,
+                                   gemm_u8s8_tiled<2, 4, 32, tile_u8s8_avx2,
+                                                   column_u8s8_avx2,
+                                                   dot_u8s8_avx2>};
+
+/////////////////////////////// AVX-512 ///////////////////////////////////////
+#define ALL_LANES_512 ((__mmask16) 0xFFFF)
+
+  //the _mm512_reduce_* helpers trip -Wuninitialized in some gcc headers
+  __attribute__((target("avx512f")))
+  float hsum_avx512(__m512 v)
+  {
+    float lanes[16];
+    _mm512_storeu_ps(lanes, v);
+    float sum = 0.0F;
+    for(int l=0; l<16; l++)
+    {
+      sum += lanes[l];
+    }
+    return sum;
+  }
+
+
+  __attribute__((target("avx512f")))
+  void add_avx512(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i),
+                                              _mm512_loadu_ps(b + i)));
+    }
+    const __mmask16 tail = (__mmask16) ((1U << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, tail,
+                          _mm512_add_ps(_mm512_maskz_loadu_ps(tail, a + i),
+                                        _mm512_maskz_loadu_ps(tail, b + i)));
+  }
+
+
+  __attribute__((target("avx512f")))
+  void mul_avx512(const float* a, const float* b, float* out, int n)
+  {
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i),
+                                              _mm512_loadu_ps(b + i)));
+    }
+    const __mmask16 tail = (__mmask16) ((1U << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, tail,
+                          _mm512_mul_ps(_mm512_maskz_loadu_ps(tail, a + i),
+                                        _mm512_maskz_loadu_ps(tail, b + i)));
+  }
+
+
+  __attribute__((target("avx512f")))
+  void scale_avx512(const float* a, float c, float* out, int n)
+  {
+    const __m512 c_vec = _mm512_set1_ps(c);
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), c_vec));
+    }
+    const __mmask16 tail = (__mmask16) ((1U << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, tail,
+                          _mm512_mul_ps(_mm512_maskz_loadu_ps(tail, a + i),
+                                        c_vec));
+  }
+
+
+  __attribute__((target("avx512f")))
+  float sum_avx512(const float* a, int n)
+  {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for(; i + 32 <= n; i += 32)
+    {
+      acc0 = _mm512_add_ps(acc0, _mm512_loadu_ps(a + i));
+      acc1 = _mm512_add_ps(acc1, _mm512_loadu_ps(a + i + 16));
+    }
+    for(; i + 16 <= n; i += 16)
+    {
+      acc0 = _mm512_add_ps(acc0, _mm512_loadu_ps(a + i));
+    }
+    const __mmask16 tail = (__mmask16) ((1U << (n - i)) - 1);
+    acc1 = _mm512_add_ps(acc1, _mm512_maskz_loadu_ps(tail, a + i));
+    return hsum_avx512(_mm512_add_ps(acc0, acc1));
+  }
+
+
+  __attribute__((target("avx512f")))
+  float sum_sq_avx512(const float* a, int n)
+  {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for(; i + 32 <= n; i += 32)
+    {
+      const __m512 v0 = _mm512_loadu_ps(a + i);
+      const __m512 v1 = _mm512_loadu_ps(a + i + 16);
+      acc0 = _mm512_fmadd_ps(v0, v0, acc0);
+      acc1 = _mm512_fmadd_ps(v1, v1, acc1);
+    }
+    for(; i + 16 <= n; i += 16)
+    {
+      const __m512 v0 = _mm512_loadu_ps(a + i);
+      acc0 = _mm512_fmadd_ps(v0, v0, acc0);
+    }
+    const __mmask16 tail = (__mmask16) ((1U << (n - i)) - 1);
+    const __m512 v1 = _mm512_maskz_loadu_ps(tail, a + i);
+    acc1 = _mm512_fmadd_ps(v1, v1, acc1);
+    return hsum_avx512(_mm512_add_ps(acc0, acc1));
+  }
+
+
+  __attribute__((target("avx512f")))
+  int argmax_avx512(const float* a, int n)
+  {
+    if(n < 32 || a[0] != a[0])
+    {
+      return argmax_scalar(a, n);
+    }
+    //seeded with a[0], max(new, old) keeps old on NaN like the scalar loop
+    __m512 max_vec = _mm512_set1_ps(a[0]);
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      max_vec = _mm512_mask_max_ps(max_vec, ALL_LANES_512,
+                                   _mm512_loadu_ps(a + i), max_vec);
+    }
+    float lanes[16];
+    _mm512_storeu_ps(lanes, max_vec);
+    float max = lanes[0];
+    for(int l=1; l<16; l++)
+    {
+      max = (lanes[l] > max) ? lanes[l] : max;
+    }
+    for(; i<n; i++)
+    {
+      max = (a[i] > max) ? a[i] : max;
+    }
+    return first_index_of(a, n, max);
+  }
+
+  __attribute__((target("avx512f,avx512bw,avx512vnni")))
+  int32_t dot_u8s8_avx512vnni(const uint8_t* a, const int8_t* b, int n)
+  {
+    //vpdpbusd: four u8*s8 products summed straight into 32 bits
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for(; i + 64 <= n; i += 64)
+    {
+      acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + i),
+                                _mm512_loadu_si512(b + i));
+    }
+    int32_t lanes[16];
+    _mm512_storeu_si512(lanes, acc);
+    int32_t sum = 0;
+    for(int l=0; l<16; l++)
+    {
+      sum += lanes[l];
+    }
+    return sum + dot_u8s8_scalar(a + i, b + i, n - i);
+  }
+
+
+  /**
+   * a 4 x 4 tile of gemm_u8s8, k a multiple of 64. every step loads 4
+   * weight rows and 4 inputs once for 16 vpdpbusd
+   */
+  __attribute__((target("avx512f,avx512bw,avx512vnni")))
+  void tile_u8s8_avx512vnni(int k, const int8_t* w, int ldw,
+                            const uint8_t* x, int ldx, int32_t* c, int ldc)
+  {
+    __m512i acc[4][4];
+    #pragma GCC unroll 4
+    for(int r=0; r<4; r++)
+    {
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        acc[r][s] = _mm512_setzero_si512();
+      }
+    }
+    for(int p=0; p<k; p+=64)
+    {
+      __m512i x_vec[4];
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        x_vec[s] = _mm512_loadu_si512(x + s*ldx + p);
+      }
+      #pragma GCC unroll 4
+      for(int r=0; r<4; r++)
+      {
+        const __m512i w_vec = _mm512_loadu_si512(w + r*ldw + p);
+        #pragma GCC unroll 4
+        for(int s=0; s<4; s++)
+        {
+          acc[r][s] = _mm512_dpbusd_epi32(acc[r][s], x_vec[s], w_vec);
+        }
+      }
+    }
+    //stored before they're summed, summing them in registers makes gcc -O3
+    //shuffle the accumulators through copies in the loop above
+    int32_t lanes[4][4][16];
+    #pragma GCC unroll 4
+    for(int r=0; r<4; r++)
+    {
+      #pragma GCC unroll 4
+      for(int s=0; s<4; s++)
+      {
+        _mm512_storeu_si512(lanes[r][s], acc[r][s]);
+      }
+    }
+    sum_lanes(&lanes[0][0][0], 4, 4, 16, c, ldc);
+  }
+
+
+  /**
+   * a 4 x 1 tile of gemm_u8s8, k a multiple of 64
+   */
+  __attribute__((target("avx512f,avx512bw,avx512vnni")))
+  void column_u8s8_avx512vnni(int k, const int8_t* w, int ldw,
+                              const uint8_t* x, int, int32_t* c, int ldc)
+  {
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+    for(int p=0; p<k; p+=64)
+    {
+      const __m512i x_vec = _mm512_loadu_si512(x + p);
+      acc0 = _mm512_dpbusd_epi32(acc0, x_vec, _mm512_loadu_si512(w + p));
+      acc1 = _mm512_dpbusd_epi32(acc1, x_vec,
+                                 _mm512_loadu_si512(w + ldw + p));
+      acc2 = _mm512_dpbusd_epi32(acc2, x_vec,
+                                 _mm512_loadu_si512(w + 2*ldw + p));
+      acc3 = _mm512_dpbusd_epi32(acc3, x_vec,
+                                 _mm512_loadu_si512(w + 3*ldw + p));
+    }
+    //stored and summed by halves, gcc 12 warns about the undefined lanes of
+    //the 512 bit extracts. pairwise sums then leave every 128 bit lane as
+    //[row 0, 1, 2, 3]
+    int32_t accs[4][16];
+    _mm512_storeu_si512(accs[0], acc0);
+    _mm512_storeu_si512(accs[1], acc1);
+    _mm512_storeu_si512(accs[2], acc2);
+    _mm512_storeu_si512(accs[3], acc3);
+    __m256i halves[4];
+    #pragma GCC unroll 4
+    for(int r=0; r<4; r++)
+    {
+      halves[r] = _mm256_add_epi32(
+          _mm256_loadu_si256((const __m256i*) accs[r]),
+          _mm256_loadu_si256((const __m256i*) (accs[r] + 8)));
+    }
+    const __m256i sums = _mm256_hadd_epi32(
+        _mm256_hadd_epi32(halves[0], halves[1]),
+        _mm256_hadd_epi32(halves[2], halves[3]));
+    const __m128i rows = _mm_add_epi32(_mm256_castsi256_si128(sums),
+                                       _mm256_extracti128_si256(sums, 1));
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, rows);
+    for(int r=0; r<4; r++)
+    {
+      c[r*ldc] = lanes[r];
+    }
+  }
+
+  //every avx-512 cpu has avx2, byte products need avx512bw or vnni
+  const kernel_table AVX512_TABLE = {"avx512", add_avx512, mul_avx512,
+                                     scale_avx512, sum_avx512, sum_sq_avx512,
+                                     argmax_avx512, dot_u8s8_avx2,
+                                     gemm_u8s8_tiled<2, 4, 32, tile_u8s8_avx2,
+                                                     column_u8s8_avx2,
+                                                     dot_u8s8_avx2>};
+
+  const kernel_table AVX512_VNNI_TABLE = {"avx512vnni", add_avx512,
+                                          mul_avx512, scale_avx512,
+                                          sum_avx512, sum_sq_avx512,
+                                          argmax_avx512, dot_u8s8_avx512vnni,
+                                          gemm_u8s8_tiled<4, 4, 64,
+                                              tile_u8s8_avx512vnni,
+                                              column_u8s8_avx512vnni,
+                                              dot_u8s8_avx512vnni>};
+#endif //KERNELS_X86
+
+/////////////////////////////// DISPATCH //////////////////////////////////////
+
+  /**
+   * @return the widest table the cpu and os support
+   */
+  const kernel_table* detect()
+  {
+    const std::vector<const kernel_table*> tables = kernels::supported();
+    return tables.back();
+  }
+
+
+  std::atomic<const kernel_table*>& active_table()
+  {
+    static std::atomic<const kernel_table*> table(detect());
+    return table;
+  }
+}
+
+
+const kernel_table& kernels::active()
+{
+  return *active_table().load(std::memory_order_relaxed);
+}
+
+
+const kernel_table& kernels::scalar()
+{
+  return SCALAR_TABLE;
+}
+
+
+std::vector<const kernel_table*> kernels::supported()
+{
+  std::vector<const kernel_table*> tables = {&SCALAR_TABLE};
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2"))
+  {
+    tables.push_back(&SSE2_TABLE);
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+  {
+    tables.push_back(&AVX2_TABLE);
+  }
+  if(__builtin_cpu_supports("avx512f"))
+  {
+    tables.push_back(&AVX512_TABLE);
+  }
+  if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+     __builtin_cpu_supports("avx512vnni"))
+  {
+    tables.push_back(&AVX512_VNNI_TABLE);
+  }
+#endif
+  return tables;
+}
+
+
+bool kernels::set_active(const std::string& name)
+{
+  for(const kernel_table* table : supported())
+  {
+    if(name == table->name)
+    {
+      active_table().store(table, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
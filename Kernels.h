@@ -0,0 +1,81 @@
+// Kernels.h
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+// vectorized reductions (sum, sum_sq) reorder the additions, so they may
+// differ from the scalar reference by up to this many ULPs of sum(|a[i]|)
+// per 1024 elements. element-wise kernels, argmax, dot_u8s8 and gemm_u8s8
+// match it exactly. check/KernelCheck.cpp checks both on every supported
+// table.
+#define KERNEL_REDUCE_ULP 64
+#define KERNEL_U8S8_MC 64 // weight rows gemm_u8s8 keeps in cache at once
+
+/**
+ * @struct kernel_table
+ * @brief Element-wise and reduction kernels over contiguous float arrays,
+ *        and the 8 bit dot product and product of quantized layers.
+ *        One table per instruction set, the best one is picked at startup.
+ */
+typedef struct kernel_table
+{
+  const char* name;
+  // out[i] = a[i] + b[i], out may alias a or b
+  void (*add)(const float* a, const float* b, float* out, int n);
+  // out[i] = a[i] * b[i], out may alias a or b
+  void (*mul)(const float* a, const float* b, float* out, int n);
+  // out[i] = a[i] * c, out may alias a
+  void (*scale)(const float* a, float c, float* out, int n);
+  // sum(a[i])
+  float (*sum)(const float* a, int n);
+  // sum(a[i]*a[i])
+  float (*sum_sq)(const float* a, int n);
+  // index of the first largest element
+  int (*argmax)(const float* a, int n);
+  // sum(a[i]*b[i]) in 32 bits. a[i] <= 127, so pairs of products fit the
+  // 16 bit lanes of pmaddubsw without saturating
+  int32_t (*dot_u8s8)(const uint8_t* a, const int8_t* b, int n);
+  // c[i*ldc + j] = dot_u8s8(x + j*ldx, w + i*ldw, k) for i < m, j < n:
+  // int8 weights rows times 7 bit inputs, k contiguous bytes each, computed
+  // in register tiles so every input is loaded once for several rows
+  void (*gemm_u8s8)(int m, int n, int k, const int8_t* w, int ldw,
+                    const uint8_t* x, int ldx, int32_t* c, int ldc);
+} kernel_table;
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace kernels
+{
+    /**
+    * @return the kernel table in use. picked once, by CPUID, as the widest
+    * instruction set supported by both the cpu and the os
+    */
+    const kernel_table& active();
+
+
+    /**
+    * @return the portable scalar kernels, the reference for all others
+    */
+    const kernel_table& scalar();
+
+
+    /**
+    * @return all kernel tables this cpu can run, narrowest first
+    */
+    std::vector<const kernel_table*> supported();
+
+
+    /**
+    * forces the kernel table in use (e.g "scalar", "sse2", "avx2", "avx512",
+    * "avx512vnni")
+    * @param name the name of a supported kernel table
+    * @return false if there is no such supported table, nothing changes
+    */
+    bool set_active(const std::string& name);
+}
+
+#endif //KERNELS_H
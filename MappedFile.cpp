@@ -0,0 +1,88 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+MappedFile::MappedFile(const void* addr, size_t size):
+    _addr(addr), _size(size)
+{}
+
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    throw runtime_error(MAP_ERR_MSG);
+  }
+  struct stat info;
+  if(fstat(fd, &info) != 0 || info.st_size <= 0)
+  {
+    close(fd);
+    throw runtime_error(MAP_ERR_MSG);
+  }
+  const size_t size = (size_t) info.st_size;
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); //the mapping keeps its own reference to the file
+  if(addr == MAP_FAILED)
+  {
+    throw runtime_error(MAP_ERR_MSG);
+  }
+  return std::shared_ptr<const MappedFile>(new MappedFile(addr, size));
+}
+
+//////////////////////////////////// DESTRUCTOR ///////////////////////////////
+
+MappedFile::~MappedFile()
+{
+  munmap(const_cast<void*>(_addr), _size);
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+const char* MappedFile::data() const
+{
+  return static_cast<const char*>(_addr);
+}
+
+
+size_t MappedFile::size() const
+{
+  return _size;
+}
+
+//////////////////////////////// MATRICES /////////////////////////////////////
+
+Matrix map_matrix(const std::shared_ptr<const MappedFile>& file,
+                  size_t offset, int rows, int cols)
+{
+  if(rows<=0 || cols<=0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  const size_t bytes = ((size_t) rows)*((size_t) cols)*CELL_SIZE;
+  if(offset % alignof(float) != 0 || offset > file->size() ||
+     bytes > file->size() - offset)
+  {
+    throw out_of_range(MAP_RANGE_ERR_MSG);
+  }
+  const float* coords = reinterpret_cast<const float*>(file->data() +
+                                                       offset);
+  return Matrix::from_external(rows, cols, coords, file);
+}
+
+
+Matrix map_matrix(const std::string& path, int rows, int cols)
+{
+  const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+  //same size check as operator>>
+  if(((long int) rows)*((long int) cols)*((long int) CELL_SIZE) !=
+     (long int) file->size())
+  {
+    throw runtime_error(VAL_ERR_MSG);
+  }
+  return map_matrix(file, 0, rows, cols);
+}
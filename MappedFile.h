@@ -0,0 +1,81 @@
+// MappedFile.h
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "Matrix.h"
+#include <memory>
+#include <string>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define MAP_ERR_MSG "Could not map the file"
+#define MAP_RANGE_ERR_MSG "Mapped matrix is out of the file range"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A whole file mapped read-only into memory. The pages come straight from
+ * the page cache, so all processes mapping the same file share one copy.
+ * The mapping lives for as long as a shared pointer to it, including the
+ * ones held by matrices built over it.
+ */
+class MappedFile
+{
+ public:
+  /**
+   * maps a file
+   * @param path the file path
+   * @return the mapped file
+   * @throws runtime_error if the file can't be opened, is empty or can't
+   * be mapped
+   */
+  static std::shared_ptr<const MappedFile> open(const std::string& path);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /**
+   * unmaps the file
+   */
+  ~MappedFile();
+
+  /**
+   * @return the first byte of the file
+   */
+  const char* data() const;
+
+  /**
+   * @return the file size in bytes
+   */
+  size_t size() const;
+
+ private:
+  MappedFile(const void* addr, size_t size);
+
+  const void* _addr;
+  size_t _size;
+};
+
+
+/**
+ * builds a Matrix over part of a mapped file, no coordinate is copied
+ * @param file the mapped file, kept alive by the matrix
+ * @param offset byte offset of the first coordinate, float aligned
+ * @param rows num of rows
+ * @param cols num of cols
+ * @return a matrix object reading the file floats row after row
+ */
+Matrix map_matrix(const std::shared_ptr<const MappedFile>& file,
+                  size_t offset, int rows, int cols);
+
+
+/**
+ * zero-copy counterpart of operator>>, maps a headerless file of exactly
+ * rows*cols floats
+ * @param path the file path
+ * @param rows num of rows
+ * @param cols num of cols
+ * @return a matrix object reading the file floats row after row
+ */
+Matrix map_matrix(const std::string& path, int rows, int cols);
+
+#endif //MAPPEDFILE_H
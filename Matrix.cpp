@@ -1,4 +1,10 @@
 #include "Matrix.h"
+#include "Gemm.h"
+#include "Kernels.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 /////////////////////////////////// CONSTRUCTORS //////////////////////////////
 
@@ -6,13 +12,17 @@ Matrix::Matrix(): Matrix (ONE_ROW, ONE_COL){}
 
 
 Matrix::Matrix(int rows, int cols):
-    dims{rows, cols}
+    Matrix(rows, cols, matrix_alloc::get_default()){}
+
+
+Matrix::Matrix(int rows, int cols, MatrixAllocator& allocator):
+    dims{rows, cols}, _matrix(nullptr), _allocator(&allocator)
 {
   if(rows<=0 || cols<=0)
   {
     throw length_error(LEN_ERR_MSG);
   }
-  _matrix = new float[rows*cols];
+  _matrix = allocate(rows*cols);
   for(int index=0; index<TOTAL_COORDS; index++)
   {
     _matrix[index] = 0.0F;
@@ -22,9 +32,16 @@ Matrix::Matrix(int rows, int cols):
 
 /// cpy constructor
 Matrix::Matrix(const Matrix& other):
-dims{other.dims.rows, other.dims.cols}
+dims{other.dims.rows, other.dims.cols}, _external(other._external),
+_allocator(other._allocator)
 {
-  _matrix = new float[TOTAL_COORDS];
+  if(_external)
+  {
+    //external storage is read-only, so it is shared instead of copied
+    _matrix = other._matrix;
+    return;
+  }
+  _matrix = allocate(TOTAL_COORDS);
   for(int index=0; index<TOTAL_COORDS; index++)
   {
     _matrix[index] = other._matrix[index];
@@ -32,11 +49,43 @@ dims{other.dims.rows, other.dims.cols}
 }
 
 
+/// move constructor
+Matrix::Matrix(Matrix&& other) noexcept:
+dims{other.dims.rows, other.dims.cols}, _matrix(other._matrix),
+_external(std::move(other._external)), _allocator(other._allocator)
+{
+  other.dims.rows = 0;
+  other.dims.cols = 0;
+  other._matrix = nullptr;
+}
+
+
 //////////////////////////////////// DESTRUCTOR ///////////////////////////////
 
+Matrix Matrix::from_external(int rows, int cols, const float* data,
+                             std::shared_ptr<const void> owner)
+{
+  if(rows<=0 || cols<=0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  if(!data || !owner)
+  {
+    throw out_of_range(RANGE_ERR_MSG);
+  }
+  Matrix mat(ONE_ROW, ONE_COL);
+  mat.release();
+  mat.dims = matrix_dims{rows, cols};
+  //never written through, make_writable copies before any change
+  mat._matrix = const_cast<float*>(data);
+  mat._external = std::move(owner);
+  return mat;
+}
+
+
 Matrix::~Matrix()
 {
-  delete[] _matrix;
+  release();
 }
 
 //////////////////////////////// GETTERS //////////////////////////////////////
@@ -52,12 +101,77 @@ int Matrix::get_cols() const
   return dims.cols;
 }
 
+
+MatrixAllocator& Matrix::get_allocator() const
+{
+  return *_allocator;
+}
+
+
+float* Matrix::data()
+{
+  make_writable();
+  return _matrix;
+}
+
+
+const float* Matrix::data() const
+{
+  return _matrix;
+}
+
 ////////////////////////////// OTHER METHODS //////////////////////////////////
 
+Matrix& Matrix::resize(int rows, int cols)
+{
+  if(rows<=0 || cols<=0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  if(_external || TOTAL_COORDS != rows*cols)
+  {
+    reallocate(rows*cols);
+  }
+  dims.rows = rows;
+  dims.cols = cols;
+  return *this;
+}
+
+
+Matrix& Matrix::assign_product(const MatrixView& lhs, const MatrixView& rhs)
+{
+  if(lhs.get_cols() != rhs.get_rows())
+  {
+    throw length_error(MAT_MULT_ERR_MSG);
+  }
+  const int m = lhs.get_rows(), k = lhs.get_cols(), n = rhs.get_cols();
+  static thread_local std::vector<float> lhs_scratch, rhs_scratch;
+  const MatrixView a = lhs.with_contiguous_rows(lhs_scratch);
+  resize(m, n);
+  if(n == ONE_COL && (k == ONE_ROW || rhs.get_row_stride() == 1))
+  {
+    linalg::gemv(m, k, a.data(), a.get_row_stride(), rhs.data(), _matrix);
+  }
+  else if(!rhs.has_contiguous_rows() && rhs.get_row_stride() == 1)
+  {
+    //a transpose of row-major storage, its rows are the columns of rhs
+    linalg::gemm_nt(m, n, k, a.data(), a.get_row_stride(), rhs.data(),
+                    rhs.get_col_stride(), _matrix, n);
+  }
+  else
+  {
+    const MatrixView b = rhs.with_contiguous_rows(rhs_scratch);
+    linalg::gemm(m, n, k, a.data(), a.get_row_stride(), b.data(),
+                 b.get_row_stride(), _matrix, n);
+  }
+  return *this;
+}
+
+
 Matrix& Matrix::transpose()
 {
   //initialize new matrix, columns and rows are opposite
-  float *t_mat = new float[TOTAL_COORDS];
+  float *t_mat = allocate(TOTAL_COORDS);
   for(int t_row=0; t_row < dims.cols; t_row++)
   {
     for(int t_col=0; t_col < dims.rows; t_col++)
@@ -68,7 +182,7 @@ Matrix& Matrix::transpose()
     }
   }
 
-  delete[] _matrix; // deallocate old matrix
+  reallocate(0); // deallocate old matrix
 
   // assign new matrix
   int new_rows = dims.cols;
@@ -101,71 +215,73 @@ void Matrix::plain_print() const
 }
 
 
-Matrix Matrix::dot(const Matrix& other) const
+float Matrix::norm() const
 {
-  if((dims.cols != other.dims.cols) || (dims.rows != other.dims.rows))
-  {
-    throw length_error(DIFFER_SIZE_ERR_MSG);
-  }
-  Matrix dotted_mat = Matrix(dims.rows, dims.cols);
-  for(int index=0; index<TOTAL_COORDS; index++)
-  {
-    dotted_mat._matrix[index] = _matrix[index] * other._matrix[index];
-  }
-  return dotted_mat;
+  return sqrt(kernels::active().sum_sq(_matrix, TOTAL_COORDS));
 }
 
 
-float Matrix::norm() const
+int Matrix::argmax() const
 {
-  float mat_norm = 0;
-  for(int index=0; index<TOTAL_COORDS; index++)
-  {
-    mat_norm += (_matrix[index]*_matrix[index]);
-  }
-  return sqrt(mat_norm);
+  return kernels::active().argmax(_matrix, TOTAL_COORDS);
 }
 
 
-int Matrix::argmax() const
+float Matrix::sum() const
 {
-  float max_coord = _matrix[0];
-  int max_index = 0;
-  for(int index=0; index<TOTAL_COORDS; index++)
+  return kernels::active().sum(_matrix, TOTAL_COORDS);
+}
+
+
+Matrix& Matrix::broadcast_add(const Matrix& col_vec)
+{
+  if((col_vec.dims.cols != ONE_COL) || (dims.rows != col_vec.dims.rows))
+  {
+    throw length_error(DIFFER_SIZE_ERR_MSG);
+  }
+  make_writable();
+  for(int row=0; row<dims.rows; row++)
+  {
+    const float val = col_vec._matrix[row];
+    for(int col=0; col<dims.cols; col++)
     {
-      if (_matrix[index] > max_coord)
-      {
-        max_coord = _matrix[index];
-        max_index = index;
-      }
+      _matrix[row*dims.cols + col] += val;
     }
-  return max_index;
+  }
+  return *this;
 }
 
 
-float Matrix::sum() const
+Matrix Matrix::get_col(int col) const
 {
-  float mat_sum = 0;
-  for(int index=0; index<TOTAL_COORDS; index++)
+  if(col<0 || col>=dims.cols)
   {
-    mat_sum += _matrix[index];
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
   }
-  return mat_sum;
+  Matrix col_vec = Matrix(dims.rows, ONE_COL);
+  for(int row=0; row<dims.rows; row++)
+  {
+    col_vec._matrix[row] = _matrix[row*dims.cols + col];
+  }
+  return col_vec;
 }
 
 
-Matrix Matrix::operator+(const Matrix& rhs) const
+void Matrix::set_col(int col, const Matrix& col_vec)
 {
-  if((dims.cols != rhs.dims.cols) || (dims.rows != rhs.dims.rows))
+  if(col<0 || col>=dims.cols)
+  {
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
+  }
+  if((col_vec.dims.cols != ONE_COL) || (dims.rows != col_vec.dims.rows))
   {
     throw length_error(DIFFER_SIZE_ERR_MSG);
   }
-  Matrix added_mat = Matrix(dims.rows, dims.cols);
-  for(int index=0; index<TOTAL_COORDS; index++)
+  make_writable();
+  for(int row=0; row<dims.rows; row++)
   {
-    added_mat._matrix[index] = _matrix[index] + rhs._matrix[index];
+    _matrix[row*dims.cols + col] = col_vec._matrix[row];
   }
-  return added_mat;
 }
 
 
@@ -175,10 +291,8 @@ Matrix& Matrix::operator+=(const Matrix& rhs)
   {
     throw length_error(DIFFER_SIZE_ERR_MSG);
   }
-  for(int index=0; index<TOTAL_COORDS; index++)
-  {
-    _matrix[index] += rhs._matrix[index];
-  }
+  make_writable();
+  kernels::active().add(_matrix, rhs._matrix, _matrix, TOTAL_COORDS);
   return *this;
 }
 
@@ -189,10 +303,20 @@ Matrix& Matrix::operator=(const Matrix& rhs)
   {
     return *this;
   }
+  if(rhs._external)
+  {
+    reallocate(0);
+    dims = rhs.dims;
+    _matrix = rhs._matrix;
+    _external = rhs._external;
+    return *this;
+  }
+  if(_external || TOTAL_COORDS != rhs.dims.rows*rhs.dims.cols)
+  {
+    reallocate(rhs.dims.rows*rhs.dims.cols);
+  }
   dims.cols = rhs.dims.cols;
   dims.rows = rhs.dims.rows;
-  delete[] _matrix;
-  _matrix = new float[TOTAL_COORDS];
   for(int index=0; index<TOTAL_COORDS; index++)
   {
     _matrix[index] = rhs._matrix[index];
@@ -201,6 +325,16 @@ Matrix& Matrix::operator=(const Matrix& rhs)
 }
 
 
+Matrix& Matrix::operator=(Matrix&& rhs) noexcept
+{
+  std::swap(dims, rhs.dims);
+  std::swap(_matrix, rhs._matrix);
+  std::swap(_external, rhs._external);
+  std::swap(_allocator, rhs._allocator);
+  return *this;
+}
+
+
 Matrix Matrix::operator*(const Matrix& rhs) const
 {
   if(dims.cols != rhs.dims.rows)
@@ -208,31 +342,16 @@ Matrix Matrix::operator*(const Matrix& rhs) const
     throw length_error(MAT_MULT_ERR_MSG);
   }
   Matrix mult_mat = Matrix(dims.rows, rhs.dims.cols);
-  for(int row=0; row<dims.rows; row++)
-  {
-    for(int col=0; col<rhs.dims.cols; col++)
-    {
-      mult_mat._matrix[row*rhs.dims.cols + col] = mult(*this, rhs, row, col);
-    }
-  }
+  mult_mat.assign_product(*this, rhs);
   return mult_mat;
 }
 
 
-Matrix Matrix::operator*(float c) const
-{
-  Matrix new_mat = Matrix(dims.rows, dims.cols);
-  for(int index=0; index<TOTAL_COORDS; index++)
-  {
-    new_mat._matrix[index] = _matrix[index]*c;
-  }
-  return new_mat;
-}
-
-
-Matrix operator*(const float c, const Matrix& rhs)
+Matrix& Matrix::operator*=(float c)
 {
-  return rhs*c;
+  make_writable();
+  kernels::active().scale(_matrix, c, _matrix, TOTAL_COORDS);
+  return *this;
 }
 
 
@@ -252,6 +371,7 @@ float& Matrix::operator()(int i, int j)
   {
     throw out_of_range(OUT_OF_RNG_ERR_MSG);
   }
+  make_writable();
   return _matrix[i*dims.cols + j];
 }
 
@@ -272,6 +392,7 @@ float& Matrix::operator[](int index)
   {
     throw out_of_range(OUT_OF_RNG_ERR_MSG);
   }
+  make_writable();
   return _matrix[index];
 }
 
@@ -321,6 +442,7 @@ istream& operator>>(istream& is, Matrix& mat)
   }
 
   //fill matrix
+  mat.make_writable();
   for(int index=0; index<mat.dims.rows*mat.dims.cols; index++)
   {
     if(!is.good())
@@ -339,22 +461,56 @@ istream& operator>>(istream& is, Matrix& mat)
 
 
 /////////////////////////////////////// HELPER ////////////////////////////////
-float mult(const Matrix& lhs, const Matrix& rhs, int r, int c)
+void Matrix::make_writable()
+{
+  if(!_external)
+  {
+    return;
+  }
+  float* own = allocate(TOTAL_COORDS);
+  std::copy(_matrix, _matrix + TOTAL_COORDS, own);
+  _matrix = own;
+  _external.reset();
+}
+
+
+float* Matrix::allocate(int coords)
 {
-  float cell_value = 0.0F;
-  //calculate one cell in AB
-  for(int k=0; k<lhs.dims.cols; k++)
+  //allocators take positive sizes only
+  if(coords <= 0)
+  {
+    return nullptr;
+  }
+  profile::record_alloc(((size_t) coords)*CELL_SIZE);
+  return _allocator->allocate((size_t) coords);
+}
+
+
+void Matrix::release()
+{
+  if(_external)
+  {
+    _external.reset();
+  }
+  else if(_matrix)
   {
-    cell_value += lhs._matrix[r*lhs.dims.cols+k]*rhs._matrix[k*rhs.dims
-                                                             .cols+c];
+    _allocator->deallocate(_matrix, (size_t) TOTAL_COORDS);
   }
-  return cell_value;
+  _matrix = nullptr;
+}
+
+
+void Matrix::reallocate(int coords)
+{
+  release();
+  _matrix = allocate(coords);
 }
 
 //////////////////////////////// BONUS ////////////////////////////////////////
 Matrix Matrix::rref() const
 {
   Matrix rref_mat (*this);
+  rref_mat.make_writable();
   if(rref_mat.is_zero_matrix())
   {
     return rref_mat;
@@ -484,17 +640,8 @@ void Matrix::swap_rows(int r1, int r2)
   {
     return;
   }
-  float* temp_r2 = new float[dims.cols];
-  for(int index=0; index<dims.cols; index++)
-  {
-    temp_r2[index] = _matrix[r1*dims.cols + index];
-    _matrix[r1*dims.cols + index] = _matrix[r2*dims.cols + index];
-  }
-  for(int index=0; index<dims.cols; index++)
-  {
-   _matrix[r2*dims.cols + index] =  temp_r2[index];
-  }
-  delete[] temp_r2;
+  std::swap_ranges(_matrix + r1*dims.cols, _matrix + (r1 + 1)*dims.cols,
+                   _matrix + r2*dims.cols);
 }
 
 
@@ -7,6 +7,8 @@
 #include <cmath>
 #include <fstream>
 #include <cmath>
+#include <memory>
+#include "MatrixAllocator.h"
 
 using std::cout;
 using std::endl;
@@ -45,6 +47,19 @@ typedef struct matrix_dims
 	int rows, cols;
 } matrix_dims;
 
+class Matrix;
+class MatrixView;
+
+//lazy element-wise arithmetic, in MatrixExpr.h
+namespace matrix_expr
+{
+    template <typename E> struct expr;
+    template <typename L, typename R> struct mul;
+    template <typename T, typename = void> struct operand;
+    struct leaf;
+    struct owned;
+}
+
 // Insert Matrix class here...
 class Matrix
 {
@@ -61,6 +76,16 @@ class Matrix
  */
   Matrix(int rows, int cols);
 
+  /**
+ * constructor
+ * @param rows - num of rows the matrix will have
+ * @param cols - num of cols
+ * @param allocator where the matrix storage comes from, must outlive it
+ * builds a matrix of rows X cols
+ * @return a matrix object
+ */
+  Matrix(int rows, int cols, MatrixAllocator& allocator);
+
   /**
   * default constructor
   * builds a matrix of 1X1
@@ -78,6 +103,38 @@ class Matrix
  */
   Matrix(const Matrix& other);
 
+  /**
+ * move constructor
+ * @param other - a Matrix object, its buffer is taken without copying
+ * other is left empty (0X0, no buffer), it may only be assigned or destroyed
+ */
+  Matrix(Matrix&& other) noexcept;
+
+  /**
+ * evaluates a lazy expression of +, dot and scalar *, see MatrixExpr.h
+ * @param value the expression, a temporary operand of it is reused as the
+ * buffer when it is a temporary itself
+ * @return a matrix object
+ */
+  template <typename E>
+  Matrix(const matrix_expr::expr<E>& value);
+
+  template <typename E>
+  Matrix(matrix_expr::expr<E>&& value);
+
+  /**
+ * builds a matrix over read-only storage owned by someone else,
+ * no coordinate is copied. copies of the matrix share the storage,
+ * the first change made through a matrix copies it to a buffer of its own
+ * @param rows - num of rows the matrix will have
+ * @param cols - num of cols
+ * @param data rows*cols coordinates, row after row
+ * @param owner keeps data alive for as long as a matrix refers to it
+ * @return a matrix object
+ */
+  static Matrix from_external(int rows, int cols, const float* data,
+                              std::shared_ptr<const void> owner);
+
   //destructor
 
   /**
@@ -99,8 +156,45 @@ class Matrix
  */
   int get_cols() const;
 
+  /**
+ * @return the allocator the matrix storage comes from
+ */
+  MatrixAllocator& get_allocator() const;
+
+  /**
+ * @return pointer to the coordinates, row after row
+ * copies external storage to a buffer of its own first
+ */
+  float* data();
+
+  /**
+ * @return pointer to the coordinates, row after row, read only
+ */
+  const float* data() const;
+
   //methods
 
+  /**
+ * changes the matrix dimensions, the buffer is reallocated only if the
+ * number of coordinates changes, values are not kept in that case
+ * @param rows new rows number
+ * @param cols new columns number
+ * @return this reference after the change
+ */
+  Matrix& resize(int rows, int cols);
+
+
+  /**
+ * does Matrix multiplication into this matrix, reusing its buffer. the
+ * operands are Matrix objects, lazy expressions or views, e.g a slice of a
+ * batch or a transpose, read in place when gemm can, see MatrixView
+ * @param lhs the left view
+ * @param rhs the right view, neither may address this matrix
+ * @return this reference, holding lhs*rhs
+ */
+  Matrix& assign_product(const MatrixView& lhs, const MatrixView& rhs);
+
+
   /**
  * build the transpose form of the matrix
  * @returns the new allocated transpose matrix
@@ -125,11 +219,20 @@ class Matrix
 
   /**
  * calculates dot matrix with other matrix
- * @param other - a matrix object
- * @return a new allocated matrix object,
- * each coordinate is this(i,j)*other(i,j)
+ * @param other - a matrix object or a lazy expression
+ * @return a lazy expression, each coordinate is this(i,j)*other(i,j),
+ * evaluated when it's assigned to a Matrix
+ * @throws length_error if the sizes differ
  */
-  Matrix dot(const Matrix& other) const;
+  template <typename R>
+  matrix_expr::mul<matrix_expr::leaf,
+                   typename matrix_expr::operand<R>::type>
+  dot(R&& other) const &;
+
+  template <typename R>
+  matrix_expr::mul<matrix_expr::owned,
+                   typename matrix_expr::operand<R>::type>
+  dot(R&& other) &&;
 
 
   /**
@@ -149,15 +252,31 @@ class Matrix
  */
   float sum() const;
 
-  //operators
+
+  /**
+ * adds a column vector to every column of the matrix (bias broadcast)
+ * @param col_vec a one column Matrix object with the same number of rows
+ * @return this reference after the change
+ */
+  Matrix& broadcast_add(const Matrix& col_vec);
 
 
   /**
- * @param rhs a Matrix object
- * @return a new allocated Matrix object reference after the change
- * chaining this operator is possible
+ * @param col column index
+ * @return a new allocated one column Matrix object, copy of column col
  */
-  Matrix operator+(const Matrix& rhs) const;
+  Matrix get_col(int col) const;
+
+
+  /**
+ * overwrites a column of the matrix
+ * @param col column index
+ * @param col_vec a one column Matrix object with the same number of rows
+ */
+  void set_col(int col, const Matrix& col_vec);
+
+  //operators
+  //+ and scalar * are lazy, free templates in MatrixExpr.h
 
 
   /**
@@ -168,12 +287,35 @@ class Matrix
  */
   Matrix& operator+=(const Matrix& rhs);
 
+  /**
+ * adds a lazy expression in the same pass that evaluates it
+ * @return this reference after the change
+ * @throws length_error if the sizes differ
+ */
+  template <typename E>
+  Matrix& operator+=(const matrix_expr::expr<E>& rhs);
+
 
   /**
  * change all matrix values to the rhs matrix values
+ * the current buffer is reused when it has the same number of coordinates
  */
   Matrix& operator=(const Matrix& rhs);
 
+
+  /**
+ * takes the rhs buffer without copying, rhs gets the old buffer of this
+ */
+  Matrix& operator=(Matrix&& rhs) noexcept;
+
+  /**
+ * evaluates a lazy expression into this matrix, in one pass. the buffer is
+ * reused when it has the same number of coordinates, this matrix may be an
+ * operand of the expression
+ */
+  template <typename E>
+  Matrix& operator=(const matrix_expr::expr<E>& value);
+
   /**
   * does Matrix multiplication
   * @param rhs - an Matrix object, the right matrix
@@ -183,11 +325,11 @@ class Matrix
 
 
   /**
- * multiplies the matrix by scalar from the right
+ * multiplies every coordinate by scalar, in place
  * @param c float
- * @return a new allocated Matrix object. with values after the multiplication
+ * @return this reference after the change
  */
-  Matrix operator*(float c) const;
+  Matrix& operator*=(float c);
 
   /**
  * @param i row index
@@ -224,13 +366,8 @@ class Matrix
 
   //friends
 
-/**
- * multiplies the matrix by scalar from the left
- * @param c float number
- * @param rhs a Matrix object
- * @return a new allocated Matrix object, values are multiplied by c
- */
-  friend Matrix operator*(float c, const Matrix& rhs);
+  //takes the buffer of a temporary operand
+  friend struct matrix_expr::owned;
 
 
   /**
@@ -264,6 +401,34 @@ class Matrix
   //Matrix itself
   float *_matrix;
 
+  //set when _matrix points into read-only storage this matrix doesn't own
+  std::shared_ptr<const void> _external;
+
+  //where _matrix came from and goes back to
+  MatrixAllocator* _allocator;
+
+  /**
+ * copies external storage to a buffer of its own, before any change
+ */
+  void make_writable();
+
+  /**
+ * gives the current storage back to its allocator or owner, before dims
+ * change
+ */
+  void release();
+
+  /**
+ * frees or releases the current storage and allocates coords floats
+ */
+  void reallocate(int coords);
+
+  /**
+ * @return new storage for coords floats from the matrix allocator,
+ * counted by the profiler, nullptr for no coords, e.g a moved-from matrix
+ */
+  float* allocate(int coords);
+
   Matrix& rref_helper(int ro);
   bool is_zero_matrix() const;
   int is_zero_col (int col, int r) const;
@@ -273,15 +438,9 @@ class Matrix
   void swap_rows(int r1, int r2);
   void reverse_reduce(int row);
 
-  /**
- * calculates one cell in matrix multiplication
- * @param lhs the Matrix object on the left side
- * @param rhs the Matrix object on the right size
- * @param r row number
- * @param c column number
- * @return the cell value
- */
-  friend float mult(const Matrix& lhs, const Matrix& rhs, int r, int c);
-
 };
+
+#include "MatrixExpr.h"
+#include "MatrixView.h"
+
 #endif //MATRIX_H
\ No newline at end of file
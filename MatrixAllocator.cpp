@@ -0,0 +1,523 @@
+#include "MatrixAllocator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  /**
+   * @return MATRIX_ALIGNMENT aligned storage of at least bytes, the
+   * pointer malloc returned is kept right before it
+   * @throws bad_alloc if malloc fails
+   */
+  float* aligned_block(size_t bytes)
+  {
+    void* raw = std::malloc(bytes + MATRIX_ALIGNMENT + sizeof(void*));
+    if(!raw)
+    {
+      throw std::bad_alloc();
+    }
+    const uintptr_t start = (uintptr_t) raw + sizeof(void*);
+    const uintptr_t aligned = (start + MATRIX_ALIGNMENT - 1) &
+                              ~((uintptr_t) MATRIX_ALIGNMENT - 1);
+    ((void**) aligned)[-1] = raw;
+    return (float*) aligned;
+  }
+
+
+  /**
+   * frees storage of aligned_block
+   */
+  void free_block(float* block)
+  {
+    if(block)
+    {
+      std::free(((void**) block)[-1]);
+    }
+  }
+
+
+  /**
+   * @return coords rounded up to its size class
+   */
+  size_t size_class(size_t coords)
+  {
+    return (coords + POOL_CLASS_COORDS - 1)/POOL_CLASS_COORDS*
+           POOL_CLASS_COORDS;
+  }
+
+
+  /**
+   * adds delta to a counter only its thread writes, other threads read it
+   */
+  void bump(std::atomic<unsigned long>& counter, long delta)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+
+  /**
+   * @struct cache_class
+   * @brief The free blocks of one size class in a thread cache, the most
+   *        recently freed last.
+   */
+  typedef struct cache_class
+  {
+    size_t coords;
+    std::vector<float*> blocks;
+  } cache_class;
+
+
+  std::atomic<MatrixAllocator*> default_allocator(nullptr);
+}
+
+/////////////////////////////// POOL STATE ////////////////////////////////////
+
+/**
+ * The free lists of a pool and the counters of its exited threads. The pool
+ * and its thread caches share it, so a cache outliving the pool can still
+ * spill. guarded by mutex
+ */
+struct PoolAllocator::shared_pool
+{
+  std::mutex mutex;
+  size_t max_cached_bytes;
+  std::atomic<bool> closed; // the pool is gone, spilled blocks are freed
+  allocator_stats stats;
+  std::unordered_map<size_t, std::vector<float*>> free; // by class coords
+  std::vector<const thread_cache*> caches;
+
+  explicit shared_pool(size_t max_bytes):
+      max_cached_bytes(max_bytes), closed(false), stats{}
+  {
+  }
+
+  ~shared_pool()
+  {
+    release();
+  }
+
+  /**
+   * keeps a freed block if it fits in max_cached_bytes, frees it otherwise
+   * @return true if kept
+   */
+  bool put(float* block, size_t class_coords)
+  {
+    const size_t bytes = class_coords*sizeof(float);
+    if(!closed && bytes <= (size_t) POOL_MAX_BLOCK_BYTES &&
+       stats.cached_bytes + bytes <= max_cached_bytes)
+    {
+      free[class_coords].push_back(block);
+      stats.cached_bytes += bytes;
+      return true;
+    }
+    free_block(block);
+    stats.released++;
+    return false;
+  }
+
+  /**
+   * moves up to count blocks of a class to the back of blocks
+   * @return the number of blocks moved
+   */
+  size_t take(size_t class_coords, size_t count, std::vector<float*>& blocks)
+  {
+    const auto found = free.find(class_coords);
+    if(found == free.end())
+    {
+      return 0;
+    }
+    std::vector<float*>& from = found->second;
+    count = std::min(count, from.size());
+    blocks.insert(blocks.end(), from.end() - count, from.end());
+    from.resize(from.size() - count);
+    stats.cached_bytes -= count*class_coords*sizeof(float);
+    return count;
+  }
+
+  /**
+   * gives every block of the free lists back to the system
+   */
+  void release()
+  {
+    for(auto& class_blocks : free)
+    {
+      for(float* block : class_blocks.second)
+      {
+        free_block(block);
+        stats.released++;
+      }
+    }
+    free.clear();
+    stats.cached_bytes = 0;
+  }
+};
+
+
+/**
+ * The free blocks one thread keeps of one pool, at most max_cached_bytes.
+ * only that thread touches them, stats() reads the counters
+ */
+struct PoolAllocator::thread_cache
+{
+  std::shared_ptr<shared_pool> shared;
+  size_t max_cached_bytes;
+  std::vector<cache_class> classes;
+  std::atomic<unsigned long> hits;
+  std::atomic<unsigned long> misses;
+  std::atomic<unsigned long> recycled;
+  std::atomic<unsigned long> cached_bytes;
+
+  explicit thread_cache(const std::shared_ptr<shared_pool>& pool):
+      shared(pool), hits(0), misses(0), recycled(0), cached_bytes(0)
+  {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    max_cached_bytes = std::min((size_t) POOL_THREAD_CACHED_BYTES,
+                                shared->max_cached_bytes);
+    shared->caches.push_back(this);
+  }
+
+  /**
+   * spills every block, the shared pool keeps the counters
+   */
+  ~thread_cache()
+  {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    for(cache_class& slot : classes)
+    {
+      spill(slot, slot.blocks.size());
+    }
+    shared->stats.hits += hits;
+    shared->stats.misses += misses;
+    shared->stats.recycled += recycled;
+    shared->caches.erase(std::find(shared->caches.begin(),
+                                   shared->caches.end(), this));
+  }
+
+  /**
+   * moves the count least recently freed blocks of a slot to the shared
+   * pool, its mutex held
+   */
+  void spill(cache_class& slot, size_t count)
+  {
+    for(size_t index=0; index<count; index++)
+    {
+      shared->put(slot.blocks[index], slot.coords);
+    }
+    slot.blocks.erase(slot.blocks.begin(), slot.blocks.begin() + count);
+    bump(cached_bytes, -(long) (count*slot.coords*sizeof(float)));
+  }
+
+  /**
+   * @return the slot of a size class. a new one while there are less than
+   * POOL_THREAD_CLASSES, else an empty one, else the one with the fewest
+   * blocks, spilled
+   */
+  cache_class& slot(size_t class_coords)
+  {
+    cache_class* fewest = nullptr;
+    for(cache_class& found : classes)
+    {
+      if(found.coords == class_coords)
+      {
+        return found;
+      }
+      if(!fewest || found.blocks.size() < fewest->blocks.size())
+      {
+        fewest = &found;
+      }
+    }
+    if(classes.size() < POOL_THREAD_CLASSES)
+    {
+      classes.push_back(cache_class{class_coords, {}});
+      return classes.back();
+    }
+    if(!fewest->blocks.empty())
+    {
+      std::lock_guard<std::mutex> lock(shared->mutex);
+      spill(*fewest, fewest->blocks.size());
+    }
+    fewest->coords = class_coords;
+    return *fewest;
+  }
+
+  /**
+   * see PoolAllocator::allocate, class_coords*sizeof(float) at most
+   * max_cached_bytes
+   */
+  float* allocate(size_t class_coords)
+  {
+    const size_t bytes = class_coords*sizeof(float);
+    cache_class& found = slot(class_coords);
+    if(found.blocks.empty())
+    {
+      //a batch of the class, as much as fits in max_cached_bytes
+      const size_t room = (max_cached_bytes -
+                           std::min(max_cached_bytes,
+                                    (size_t) cached_bytes))/bytes;
+      const size_t batch = std::max((size_t) 1,
+                                    std::min((size_t) POOL_THREAD_BATCH,
+                                             room));
+      size_t count;
+      {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        count = shared->take(class_coords, batch, found.blocks);
+      }
+      if(!count)
+      {
+        bump(misses, 1);
+        return aligned_block(bytes);
+      }
+      bump(cached_bytes, count*bytes);
+    }
+    float* block = found.blocks.back();
+    found.blocks.pop_back();
+    bump(hits, 1);
+    bump(cached_bytes, -(long) bytes);
+    return block;
+  }
+
+  /**
+   * see PoolAllocator::deallocate, class_coords*sizeof(float) at most
+   * max_cached_bytes
+   */
+  void deallocate(float* block, size_t class_coords)
+  {
+    cache_class& found = slot(class_coords);
+    found.blocks.push_back(block);
+    bump(recycled, 1);
+    bump(cached_bytes, class_coords*sizeof(float));
+    if(found.blocks.size() <= 2*POOL_THREAD_BATCH &&
+       cached_bytes <= max_cached_bytes)
+    {
+      return;
+    }
+    //the oldest batch of the class, then other classes while still over
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    spill(found, std::min(found.blocks.size(), (size_t) POOL_THREAD_BATCH));
+    for(size_t index=0; index<classes.size() &&
+                        cached_bytes > max_cached_bytes; index++)
+    {
+      spill(classes[index], classes[index].blocks.size());
+    }
+  }
+};
+
+
+/**
+ * The caches of a thread, destroyed when it exits
+ */
+struct PoolAllocator::cache_list
+{
+  std::vector<std::unique_ptr<thread_cache>> caches;
+
+  ~cache_list()
+  {
+    _local_caches_gone = true;
+    caches.clear();
+  }
+};
+
+
+thread_local PoolAllocator::cache_list PoolAllocator::_local_caches;
+thread_local bool PoolAllocator::_local_caches_gone = false;
+
+/////////////////////////////// ALLOCATORS ////////////////////////////////////
+
+allocator_stats MatrixAllocator::stats() const
+{
+  return allocator_stats{};
+}
+
+
+float* SystemAllocator::allocate(size_t coords)
+{
+  float* block = aligned_block(coords*sizeof(float));
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.misses++;
+  return block;
+}
+
+
+void SystemAllocator::deallocate(float* block, size_t)
+{
+  free_block(block);
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.released++;
+}
+
+
+allocator_stats SystemAllocator::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+
+PoolAllocator::PoolAllocator(size_t max_cached_bytes):
+    _shared(std::make_shared<shared_pool>(max_cached_bytes))
+{
+}
+
+
+PoolAllocator::~PoolAllocator()
+{
+  //the calling thread's cache goes now, other threads free theirs when
+  //they next use a pool or exit
+  if(!_local_caches_gone)
+  {
+    std::vector<std::unique_ptr<thread_cache>>& caches = _local_caches.caches;
+    caches.erase(std::remove_if(caches.begin(), caches.end(),
+                                [this](const std::unique_ptr<thread_cache>&
+                                       cache)
+                                {
+                                  return cache->shared == _shared;
+                                }), caches.end());
+  }
+  std::lock_guard<std::mutex> lock(_shared->mutex);
+  _shared->closed = true;
+  _shared->release();
+}
+
+
+PoolAllocator::thread_cache* PoolAllocator::local_cache()
+{
+  if(_local_caches_gone)
+  {
+    return nullptr;
+  }
+  std::vector<std::unique_ptr<thread_cache>>& caches = _local_caches.caches;
+  for(const std::unique_ptr<thread_cache>& cache : caches)
+  {
+    if(cache->shared == _shared)
+    {
+      return cache.get();
+    }
+  }
+  //the caches of destroyed pools only hold blocks to free
+  caches.erase(std::remove_if(caches.begin(), caches.end(),
+                              [](const std::unique_ptr<thread_cache>& cache)
+                              {
+                                return (bool) cache->shared->closed;
+                              }), caches.end());
+  caches.emplace_back(new thread_cache(_shared));
+  return caches.back().get();
+}
+
+
+float* PoolAllocator::allocate(size_t coords)
+{
+  const size_t class_coords = size_class(coords);
+  thread_cache* cache = local_cache();
+  if(cache && class_coords*sizeof(float) <= cache->max_cached_bytes)
+  {
+    return cache->allocate(class_coords);
+  }
+  //blocks too large for a thread cache, and exiting threads, lock
+  {
+    std::lock_guard<std::mutex> lock(_shared->mutex);
+    std::vector<float*> blocks;
+    if(_shared->take(class_coords, 1, blocks))
+    {
+      _shared->stats.hits++;
+      return blocks.back();
+    }
+    _shared->stats.misses++;
+  }
+  return aligned_block(class_coords*sizeof(float));
+}
+
+
+void PoolAllocator::deallocate(float* block, size_t coords)
+{
+  if(!block)
+  {
+    return;
+  }
+  const size_t class_coords = size_class(coords);
+  thread_cache* cache = local_cache();
+  if(cache && class_coords*sizeof(float) <= cache->max_cached_bytes)
+  {
+    cache->deallocate(block, class_coords);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_shared->mutex);
+  if(_shared->put(block, class_coords))
+  {
+    _shared->stats.recycled++;
+  }
+}
+
+
+allocator_stats PoolAllocator::stats() const
+{
+  std::lock_guard<std::mutex> lock(_shared->mutex);
+  allocator_stats total = _shared->stats;
+  for(const thread_cache* cache : _shared->caches)
+  {
+    total.hits += cache->hits;
+    total.misses += cache->misses;
+    total.recycled += cache->recycled;
+    total.cached_bytes += cache->cached_bytes;
+  }
+  return total;
+}
+
+
+double PoolAllocator::hit_rate() const
+{
+  const allocator_stats current = stats();
+  const unsigned long total = current.hits + current.misses;
+  return total ? ((double) current.hits)/total : 0;
+}
+
+
+void PoolAllocator::trim()
+{
+  thread_cache* cache = local_cache();
+  std::lock_guard<std::mutex> lock(_shared->mutex);
+  if(cache)
+  {
+    for(cache_class& slot : cache->classes)
+    {
+      cache->spill(slot, slot.blocks.size());
+    }
+  }
+  _shared->release();
+}
+
+//////////////////////////////// DEFAULT //////////////////////////////////////
+
+MatrixAllocator& matrix_alloc::get_default()
+{
+  MatrixAllocator* current = default_allocator.load(std::memory_order_acquire);
+  if(current)
+  {
+    return *current;
+  }
+  //never destroyed, so matrices freed during static destruction still
+  //have their allocator
+  static MatrixAllocator* const pool = new PoolAllocator();
+  MatrixAllocator* expected = nullptr;
+  default_allocator.compare_exchange_strong(expected, pool,
+                                            std::memory_order_acq_rel);
+  return *default_allocator.load(std::memory_order_acquire);
+}
+
+
+void matrix_alloc::set_default(const std::shared_ptr<MatrixAllocator>&
+                               allocator)
+{
+  static std::mutex mutex;
+  static std::vector<std::shared_ptr<MatrixAllocator>>* const kept =
+      new std::vector<std::shared_ptr<MatrixAllocator>>();
+  std::lock_guard<std::mutex> lock(mutex);
+  kept->push_back(allocator);
+  default_allocator.store(allocator.get(), std::memory_order_release);
+}
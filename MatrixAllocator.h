@@ -0,0 +1,162 @@
+// MatrixAllocator.h
+#ifndef MATRIXALLOCATOR_H
+#define MATRIXALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define MATRIX_ALIGNMENT 64 // bytes, a cache line and an AVX-512 register
+#define POOL_CLASS_COORDS (MATRIX_ALIGNMENT/sizeof(float)) // size class step
+#define POOL_MAX_BLOCK_BYTES (16L << 20) // larger blocks bypass the pool
+#define POOL_MAX_CACHED_BYTES (64L << 20) // most free bytes a pool keeps
+#define POOL_THREAD_BATCH 8 // blocks a thread cache refills or spills at once
+#define POOL_THREAD_CLASSES 16 // size classes a thread cache keeps
+#define POOL_THREAD_CACHED_BYTES (4L << 20) // most free bytes one thread keeps
+
+/**
+ * @struct allocator_stats
+ * @brief What an allocator did since it was created.
+ * @var hits - allocations served from freed blocks
+ * @var misses - allocations that went to the system allocator
+ * @var recycled - freed blocks kept for reuse
+ * @var released - freed blocks given back to the system allocator
+ * @var cached_bytes - bytes of the blocks kept for reuse now
+ */
+typedef struct allocator_stats
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long recycled;
+  unsigned long released;
+  unsigned long cached_bytes;
+} allocator_stats;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Where Matrix storage comes from. A matrix returns its storage to the
+ * allocator it got it from, so an allocator must outlive its matrices.
+ */
+class MatrixAllocator
+{
+ public:
+  virtual ~MatrixAllocator() = default;
+
+  /**
+   * @param coords number of floats, positive
+   * @return storage for coords floats, MATRIX_ALIGNMENT aligned
+   * @throws bad_alloc if there is no memory left
+   */
+  virtual float* allocate(size_t coords) = 0;
+
+  /**
+   * gives back storage of allocate
+   * @param block the storage
+   * @param coords the coords it was allocated with
+   */
+  virtual void deallocate(float* block, size_t coords) = 0;
+
+  /**
+   * @return what the allocator did so far, all zeros by default
+   */
+  virtual allocator_stats stats() const;
+};
+
+
+/**
+ * Every allocate and deallocate call goes to the system allocator.
+ */
+class SystemAllocator: public MatrixAllocator
+{
+ public:
+  float* allocate(size_t coords) override;
+  void deallocate(float* block, size_t coords) override;
+  allocator_stats stats() const override;
+
+ private:
+  mutable std::mutex _mutex;
+  allocator_stats _stats = {};
+};
+
+
+/**
+ * Keeps freed blocks by size class, multiples of POOL_CLASS_COORDS floats,
+ * and hands them out again, so a loop building matrices of the same shapes
+ * stops calling the system allocator after its first pass. Blocks over
+ * POOL_MAX_BLOCK_BYTES, and freed blocks past max_cached_bytes, go back to
+ * the system. Safe to use from many threads at once: every thread keeps up
+ * to POOL_THREAD_CACHED_BYTES of free blocks of its own, and only locks the
+ * shared free lists to refill or spill POOL_THREAD_BATCH blocks of a class.
+ * A thread's blocks go back to the shared lists when it exits.
+ */
+class PoolAllocator: public MatrixAllocator
+{
+ public:
+  //constructor
+  /**
+   * @param max_cached_bytes most free bytes kept for reuse
+   */
+  explicit PoolAllocator(size_t max_cached_bytes = POOL_MAX_CACHED_BYTES);
+
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+  //destructor
+  /**
+   * frees the blocks kept for reuse
+   */
+  ~PoolAllocator() override;
+
+  //methods
+  float* allocate(size_t coords) override;
+  void deallocate(float* block, size_t coords) override;
+  allocator_stats stats() const override;
+
+  /**
+   * @return hits out of all allocations, 0 before the first one
+   */
+  double hit_rate() const;
+
+  /**
+   * gives the blocks kept for reuse back to the system, those of the shared
+   * lists and of the calling thread. other threads keep theirs until they
+   * spill them or exit
+   */
+  void trim();
+
+ private:
+  struct shared_pool; // the free lists the thread caches refill from
+  struct thread_cache; // the free blocks one thread keeps of one pool
+  struct cache_list; // the thread caches of one thread
+
+  std::shared_ptr<shared_pool> _shared;
+  static thread_local cache_list _local_caches;
+  static thread_local bool _local_caches_gone; // set when the thread exits
+
+  /**
+   * @return the cache of the calling thread, nullptr once it is exiting
+   */
+  thread_cache* local_cache();
+};
+
+
+namespace matrix_alloc
+{
+    /**
+     * @return the allocator new matrices use, a PoolAllocator unless
+     * set_default replaced it
+     */
+    MatrixAllocator& get_default();
+
+    /**
+     * replaces the allocator of the matrices built from now on. allocators
+     * set here are kept alive until the program exits, since matrices
+     * built with them may live as long
+     * @param allocator the new default
+     */
+    void set_default(const std::shared_ptr<MatrixAllocator>& allocator);
+}
+
+#endif //MATRIXALLOCATOR_H
@@ -0,0 +1,641 @@
+// MatrixExpr.h
+#ifndef MATRIXEXPR_H
+#define MATRIXEXPR_H
+
+#include "Matrix.h"
+#include "Kernels.h"
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define EXPR_BLOCK 256 // floats evaluated at a time, a block per node fits L1
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Lazy element-wise Matrix arithmetic. a + b, a.dot(b), a*c and c*a build
+ * nodes instead of matrices, and a tree of them is evaluated once it is
+ * assigned to, or converted to, a Matrix: one pass over the coordinates in
+ * EXPR_BLOCK blocks, every node of a block computed by the active kernels
+ * while the block is in L1, the last one straight into the destination.
+ * So W*x + b or (a + b)*0.5F make one matrix, not one per operator, and a
+ * temporary operand (W*x above) becomes the result buffer itself.
+ * Every node is still one kernel call, so results equal the eager ones bit
+ * for bit.
+ * A node reads as a Matrix: the Matrix members that don't change their
+ * object (transpose and the like return a new Matrix) evaluate it first,
+ * it converts to a Matrix or a MatrixView argument, e.g dense(a + b), and
+ * to a Matrix variable.
+ * Matrix lvalue operands are referenced, temporaries and nodes are moved
+ * into the tree, so an expression kept in an auto variable never dangles
+ * on a temporary, but sees later changes to its Matrix lvalue operands;
+ * assign it to a Matrix to keep its value.
+ */
+namespace matrix_expr
+{
+    /**
+     * a Matrix operand, by reference
+     */
+    struct leaf
+    {
+      const Matrix& mat;
+
+      explicit leaf(const Matrix& operand): mat(operand)
+      {
+      }
+
+      static constexpr int temps()
+      {
+        return 0;
+      }
+
+      int rows() const
+      {
+        return mat.get_rows();
+      }
+
+      int cols() const
+      {
+        return mat.get_cols();
+      }
+
+      float at(int index) const
+      {
+        return mat[index];
+      }
+
+      const float* block(int begin, int, float*, float*) const
+      {
+        return mat.data() + begin;
+      }
+
+      Matrix* spare()
+      {
+        return nullptr;
+      }
+    };
+
+
+    /**
+     * a temporary Matrix operand, moved into the tree. its buffer may be
+     * taken for the result
+     */
+    struct owned
+    {
+      Matrix mat;
+
+      explicit owned(Matrix&& operand): mat(std::move(operand))
+      {
+      }
+
+      explicit owned(const Matrix& operand): mat(operand)
+      {
+      }
+
+      static constexpr int temps()
+      {
+        return 0;
+      }
+
+      int rows() const
+      {
+        return mat.get_rows();
+      }
+
+      int cols() const
+      {
+        return mat.get_cols();
+      }
+
+      float at(int index) const
+      {
+        return mat[index];
+      }
+
+      const float* block(int begin, int, float*, float*) const
+      {
+        return mat.data() + begin;
+      }
+
+      Matrix* spare()
+      {
+        return mat._external ? nullptr : &mat;
+      }
+    };
+
+
+    /**
+     * base of every node E, the read-only Matrix interface of its value
+     */
+    template <typename E>
+    struct expr
+    {
+      const E& self() const
+      {
+        return static_cast<const E&>(*this);
+      }
+
+      /**
+       * @return the rows number of the value
+       */
+      int get_rows() const
+      {
+        return self().rows();
+      }
+
+      /**
+       * @return the columns number of the value
+       */
+      int get_cols() const
+      {
+        return self().cols();
+      }
+
+      /**
+       * @return the value, evaluated to a new allocated Matrix object
+       */
+      Matrix eval() const
+      {
+        return Matrix(*this);
+      }
+
+      /**
+       * @return one coordinate of the value, as if it is a vector,
+       * computed alone
+       */
+      float operator[](int index) const
+      {
+        return self().at(index);
+      }
+
+      /**
+       * @return the value [i][j], computed alone
+       */
+      float operator()(int i, int j) const
+      {
+        if(j>get_cols() || i>get_rows() || i<0 || j<0)
+        {
+          throw out_of_range(OUT_OF_RNG_ERR_MSG);
+        }
+        return self().at(i*get_cols() + j);
+      }
+
+      float sum() const
+      {
+        return eval().sum();
+      }
+
+      float norm() const
+      {
+        return eval().norm();
+      }
+
+      int argmax() const
+      {
+        return eval().argmax();
+      }
+
+      /**
+       * @return the transpose of the value, a new allocated Matrix object
+       */
+      Matrix transpose() const
+      {
+        Matrix value = eval();
+        value.transpose();
+        return value;
+      }
+
+      /**
+       * @return the value as a vector, a new allocated Matrix object
+       */
+      Matrix vectorize() const
+      {
+        Matrix value = eval();
+        value.vectorize();
+        return value;
+      }
+
+      /**
+       * @return the value plus col_vec in every column, a new allocated
+       * Matrix object
+       */
+      Matrix broadcast_add(const Matrix& col_vec) const
+      {
+        Matrix value = eval();
+        value.broadcast_add(col_vec);
+        return value;
+      }
+
+      Matrix get_col(int col) const
+      {
+        return eval().get_col(col);
+      }
+
+      Matrix rref() const
+      {
+        return eval().rref();
+      }
+
+      void plain_print() const
+      {
+        eval().plain_print();
+      }
+
+      /**
+       * @return a node of the element-wise product of the value and other
+       * @throws length_error if they differ in size
+       */
+      template <typename R>
+      mul<E, typename operand<R>::type> dot(R&& other) const &
+      {
+        return mul<E, typename operand<R>::type>(
+            self(), typename operand<R>::type(std::forward<R>(other)));
+      }
+
+      template <typename R>
+      mul<E, typename operand<R>::type> dot(R&& other) &&
+      {
+        return mul<E, typename operand<R>::type>(
+            std::move(static_cast<E&>(*this)),
+            typename operand<R>::type(std::forward<R>(other)));
+      }
+    };
+
+
+    /**
+     * lhs[i] + rhs[i]
+     */
+    template <typename L, typename R>
+    struct add: expr<add<L, R>>
+    {
+      L lhs;
+      R rhs;
+
+      /**
+       * @throws length_error if the operands differ in size
+       */
+      add(L left, R right): lhs(std::move(left)), rhs(std::move(right))
+      {
+        if(lhs.rows() != rhs.rows() || lhs.cols() != rhs.cols())
+        {
+          throw length_error(DIFFER_SIZE_ERR_MSG);
+        }
+      }
+
+      static constexpr int temps()
+      {
+        return (1 + L::temps() > 2 + R::temps()) ? 1 + L::temps()
+                                                 : 2 + R::temps();
+      }
+
+      int rows() const
+      {
+        return lhs.rows();
+      }
+
+      int cols() const
+      {
+        return lhs.cols();
+      }
+
+      float at(int index) const
+      {
+        return lhs.at(index) + rhs.at(index);
+      }
+
+      /**
+       * writes the coordinates [begin, begin + n) to out. the operands go
+       * through scratch, temps() EXPR_BLOCK blocks, so out may be a buffer
+       * the operands read
+       * @return out
+       */
+      const float* block(int begin, int n, float* out, float* scratch) const
+      {
+        const float* left = lhs.block(begin, n, scratch, scratch + EXPR_BLOCK);
+        const float* right = rhs.block(begin, n, scratch + EXPR_BLOCK,
+                                       scratch + 2*EXPR_BLOCK);
+        kernels::active().add(left, right, out, n);
+        return out;
+      }
+
+      /**
+       * @return a temporary operand the result may be written to, or
+       * nullptr
+       */
+      Matrix* spare()
+      {
+        Matrix* mat = lhs.spare();
+        return mat ? mat : rhs.spare();
+      }
+    };
+
+
+    /**
+     * lhs[i] * rhs[i]
+     */
+    template <typename L, typename R>
+    struct mul: expr<mul<L, R>>
+    {
+      L lhs;
+      R rhs;
+
+      /**
+       * @throws length_error if the operands differ in size
+       */
+      mul(L left, R right): lhs(std::move(left)), rhs(std::move(right))
+      {
+        if(lhs.rows() != rhs.rows() || lhs.cols() != rhs.cols())
+        {
+          throw length_error(DIFFER_SIZE_ERR_MSG);
+        }
+      }
+
+      static constexpr int temps()
+      {
+        return (1 + L::temps() > 2 + R::temps()) ? 1 + L::temps()
+                                                 : 2 + R::temps();
+      }
+
+      int rows() const
+      {
+        return lhs.rows();
+      }
+
+      int cols() const
+      {
+        return lhs.cols();
+      }
+
+      float at(int index) const
+      {
+        return lhs.at(index)*rhs.at(index);
+      }
+
+      const float* block(int begin, int n, float* out, float* scratch) const
+      {
+        const float* left = lhs.block(begin, n, scratch, scratch + EXPR_BLOCK);
+        const float* right = rhs.block(begin, n, scratch + EXPR_BLOCK,
+                                       scratch + 2*EXPR_BLOCK);
+        kernels::active().mul(left, right, out, n);
+        return out;
+      }
+
+      Matrix* spare()
+      {
+        Matrix* mat = lhs.spare();
+        return mat ? mat : rhs.spare();
+      }
+    };
+
+
+    /**
+     * inner[i] * c
+     */
+    template <typename E>
+    struct scale: expr<scale<E>>
+    {
+      E inner;
+      float c;
+
+      scale(E operand, float scalar): inner(std::move(operand)), c(scalar)
+      {
+      }
+
+      static constexpr int temps()
+      {
+        return 1 + E::temps();
+      }
+
+      int rows() const
+      {
+        return inner.rows();
+      }
+
+      int cols() const
+      {
+        return inner.cols();
+      }
+
+      float at(int index) const
+      {
+        return inner.at(index)*c;
+      }
+
+      const float* block(int begin, int n, float* out, float* scratch) const
+      {
+        const float* values = inner.block(begin, n, scratch,
+                                          scratch + EXPR_BLOCK);
+        kernels::active().scale(values, c, out, n);
+        return out;
+      }
+
+      Matrix* spare()
+      {
+        return inner.spare();
+      }
+    };
+
+
+    /**
+     * how an operand of type T is kept in a node: a Matrix lvalue by
+     * reference, a Matrix rvalue moved in, a node by value. nothing else is
+     * an operand
+     */
+    template <typename T, typename>
+    struct operand
+    {
+    };
+
+    template <>
+    struct operand<Matrix&, void>
+    {
+      typedef leaf type;
+    };
+
+    template <>
+    struct operand<const Matrix&, void>
+    {
+      typedef leaf type;
+    };
+
+    template <>
+    struct operand<Matrix, void>
+    {
+      typedef owned type;
+    };
+
+    template <>
+    struct operand<const Matrix, void>
+    {
+      typedef owned type;
+    };
+
+    template <typename T>
+    struct operand<T, typename std::enable_if<std::is_base_of<
+        expr<typename std::decay<T>::type>,
+        typename std::decay<T>::type>::value>::type>
+    {
+      typedef typename std::decay<T>::type type;
+    };
+}
+
+//////////////////////////////// OPERATORS ////////////////////////////////////
+
+/**
+ * @return a node of lhs + rhs, Matrix objects or nodes of the same size
+ * @throws length_error if they differ in size
+ */
+template <typename L, typename R>
+matrix_expr::add<typename matrix_expr::operand<L>::type,
+                 typename matrix_expr::operand<R>::type>
+operator+(L&& lhs, R&& rhs)
+{
+  return matrix_expr::add<typename matrix_expr::operand<L>::type,
+                          typename matrix_expr::operand<R>::type>(
+      typename matrix_expr::operand<L>::type(std::forward<L>(lhs)),
+      typename matrix_expr::operand<R>::type(std::forward<R>(rhs)));
+}
+
+
+/**
+ * @return a node of lhs multiplied by scalar from the right
+ */
+template <typename L>
+matrix_expr::scale<typename matrix_expr::operand<L>::type>
+operator*(L&& lhs, float c)
+{
+  return matrix_expr::scale<typename matrix_expr::operand<L>::type>(
+      typename matrix_expr::operand<L>::type(std::forward<L>(lhs)), c);
+}
+
+
+/**
+ * @return a node of rhs multiplied by scalar from the left
+ */
+template <typename R>
+matrix_expr::scale<typename matrix_expr::operand<R>::type>
+operator*(float c, R&& rhs)
+{
+  return std::forward<R>(rhs)*c;
+}
+
+
+/**
+ * Matrix multiplication of an evaluated node
+ * @return a new allocated multiplication result Matrix object
+ */
+template <typename E>
+Matrix operator*(const matrix_expr::expr<E>& lhs, const Matrix& rhs)
+{
+  return lhs.eval()*rhs;
+}
+
+
+template <typename E1, typename E2>
+Matrix operator*(const matrix_expr::expr<E1>& lhs,
+                 const matrix_expr::expr<E2>& rhs)
+{
+  return lhs.eval()*rhs.eval();
+}
+
+
+template <typename E>
+ostream& operator<<(ostream& os, const matrix_expr::expr<E>& value)
+{
+  return os << value.eval();
+}
+
+////////////////////////////// MATRIX MEMBERS /////////////////////////////////
+
+template <typename E>
+Matrix::Matrix(const matrix_expr::expr<E>& value):
+    dims{0, 0}, _matrix(nullptr), _allocator(&matrix_alloc::get_default())
+{
+  *this = value;
+}
+
+
+template <typename E>
+Matrix::Matrix(matrix_expr::expr<E>&& value):
+    dims{0, 0}, _matrix(nullptr), _allocator(&matrix_alloc::get_default())
+{
+  //a temporary operand is overwritten in place, then its buffer is taken
+  Matrix* spare = static_cast<E&>(value).spare();
+  if(spare)
+  {
+    *spare = value;
+    *this = std::move(*spare);
+    return;
+  }
+  *this = value;
+}
+
+
+template <typename E>
+Matrix& Matrix::operator=(const matrix_expr::expr<E>& value)
+{
+  const E& node = value.self();
+  const int rows = node.rows();
+  const int cols = node.cols();
+  if(TOTAL_COORDS != rows*cols)
+  {
+    reallocate(rows*cols);
+  }
+  else
+  {
+    make_writable(); // this may be an operand, its values are kept
+  }
+  dims = matrix_dims{rows, cols};
+  alignas(MATRIX_ALIGNMENT) float scratch[E::temps()*EXPR_BLOCK];
+  for(int begin=0; begin<TOTAL_COORDS; begin+=EXPR_BLOCK)
+  {
+    node.block(begin, std::min(EXPR_BLOCK, TOTAL_COORDS - begin),
+               _matrix + begin, scratch);
+  }
+  return *this;
+}
+
+
+template <typename E>
+Matrix& Matrix::operator+=(const matrix_expr::expr<E>& rhs)
+{
+  const E& node = rhs.self();
+  if(dims.rows != node.rows() || dims.cols != node.cols())
+  {
+    throw length_error(DIFFER_SIZE_ERR_MSG);
+  }
+  make_writable();
+  alignas(MATRIX_ALIGNMENT) float scratch[(1 + E::temps())*EXPR_BLOCK];
+  for(int begin=0; begin<TOTAL_COORDS; begin+=EXPR_BLOCK)
+  {
+    const int n = std::min(EXPR_BLOCK, TOTAL_COORDS - begin);
+    const float* values = node.block(begin, n, scratch, scratch + EXPR_BLOCK);
+    kernels::active().add(_matrix + begin, values, _matrix + begin, n);
+  }
+  return *this;
+}
+
+
+template <typename R>
+matrix_expr::mul<matrix_expr::leaf, typename matrix_expr::operand<R>::type>
+Matrix::dot(R&& other) const &
+{
+  return matrix_expr::mul<matrix_expr::leaf,
+                          typename matrix_expr::operand<R>::type>(
+      matrix_expr::leaf(*this),
+      typename matrix_expr::operand<R>::type(std::forward<R>(other)));
+}
+
+
+template <typename R>
+matrix_expr::mul<matrix_expr::owned, typename matrix_expr::operand<R>::type>
+Matrix::dot(R&& other) &&
+{
+  return matrix_expr::mul<matrix_expr::owned,
+                          typename matrix_expr::operand<R>::type>(
+      matrix_expr::owned(std::move(*this)),
+      typename matrix_expr::operand<R>::type(std::forward<R>(other)));
+}
+
+#endif //MATRIXEXPR_H
@@ -0,0 +1,190 @@
+#include "MatrixView.h"
+#include <algorithm>
+
+/////////////////////////////////// CONSTRUCTORS //////////////////////////////
+
+MatrixView::MatrixView(const float* data, int rows, int cols, int row_stride,
+                       int col_stride):
+    _data(data), _rows(rows), _cols(cols), _row_stride(row_stride),
+    _col_stride(col_stride)
+{
+  if(rows<=0 || cols<=0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  if(row_stride<0 || col_stride<0)
+  {
+    throw length_error(STRIDE_ERR_MSG);
+  }
+  if(!data)
+  {
+    throw out_of_range(RANGE_ERR_MSG);
+  }
+}
+
+
+MatrixView::MatrixView(const Matrix& mat):
+    MatrixView(mat.data(), mat.get_rows(), mat.get_cols(), mat.get_cols())
+{
+}
+
+
+MatrixView::MatrixView(std::shared_ptr<const Matrix> value):
+    MatrixView(*value)
+{
+  _value = std::move(value);
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+int MatrixView::get_rows() const
+{
+  return _rows;
+}
+
+
+int MatrixView::get_cols() const
+{
+  return _cols;
+}
+
+
+int MatrixView::get_row_stride() const
+{
+  return _row_stride;
+}
+
+
+int MatrixView::get_col_stride() const
+{
+  return _col_stride;
+}
+
+
+const float* MatrixView::data() const
+{
+  return _data;
+}
+
+
+bool MatrixView::has_contiguous_rows() const
+{
+  return _cols == ONE_COL || _col_stride == 1;
+}
+
+
+bool MatrixView::is_contiguous() const
+{
+  return has_contiguous_rows() && (_rows == ONE_ROW || _row_stride == _cols);
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+float MatrixView::operator()(int i, int j) const
+{
+  if(i<0 || j<0 || i>=_rows || j>=_cols)
+  {
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
+  }
+  return _data[((long) i)*_row_stride + ((long) j)*_col_stride];
+}
+
+
+MatrixView MatrixView::row(int row) const
+{
+  return block(row, 0, ONE_ROW, _cols);
+}
+
+
+MatrixView MatrixView::col(int col) const
+{
+  return block(0, col, _rows, ONE_COL);
+}
+
+
+MatrixView MatrixView::block(int row, int col, int rows, int cols) const
+{
+  if(row<0 || col<0 || rows<=0 || cols<=0 || row + rows > _rows ||
+     col + cols > _cols)
+  {
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
+  }
+  return sharing(MatrixView(_data + ((long) row)*_row_stride +
+                            ((long) col)*_col_stride, rows, cols,
+                            _row_stride, _col_stride));
+}
+
+
+MatrixView MatrixView::transposed() const
+{
+  return sharing(MatrixView(_data, _cols, _rows, _col_stride, _row_stride));
+}
+
+
+MatrixView MatrixView::reshaped(int rows, int cols) const
+{
+  if(!is_contiguous() || ((long) rows)*cols != ((long) _rows)*_cols)
+  {
+    throw length_error(RESHAPE_ERR_MSG);
+  }
+  return sharing(MatrixView(_data, rows, cols, cols));
+}
+
+
+MatrixView MatrixView::with_contiguous_rows(std::vector<float>& scratch)
+const
+{
+  if(has_contiguous_rows())
+  {
+    return *this;
+  }
+  scratch.resize(((size_t) _rows)*_cols);
+  copy_to(scratch.data());
+  return MatrixView(scratch.data(), _rows, _cols, _cols);
+}
+
+
+MatrixView MatrixView::contiguous(std::vector<float>& scratch) const
+{
+  if(is_contiguous())
+  {
+    return *this;
+  }
+  scratch.resize(((size_t) _rows)*_cols);
+  copy_to(scratch.data());
+  return MatrixView(scratch.data(), _rows, _cols, _cols);
+}
+
+
+MatrixView MatrixView::sharing(MatrixView view) const
+{
+  view._value = _value;
+  return view;
+}
+
+
+void MatrixView::copy_to(float* out) const
+{
+  for(int row=0; row<_rows; row++)
+  {
+    const float* src = _data + ((long) row)*_row_stride;
+    float* dst = out + ((long) row)*_cols;
+    if(has_contiguous_rows())
+    {
+      std::copy(src, src + _cols, dst);
+      continue;
+    }
+    for(int col=0; col<_cols; col++)
+    {
+      dst[col] = src[((long) col)*_col_stride];
+    }
+  }
+}
+
+
+Matrix MatrixView::to_matrix() const
+{
+  Matrix mat(_rows, _cols);
+  copy_to(mat.data());
+  return mat;
+}
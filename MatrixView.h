@@ -0,0 +1,185 @@
+// MatrixView.h
+#ifndef MATRIXVIEW_H
+#define MATRIXVIEW_H
+
+#include "Matrix.h"
+#include <memory>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define STRIDE_ERR_MSG "A view stride can't be negative"
+#define RESHAPE_ERR_MSG "Only a contiguous view of the same size can be " \
+                        "reshaped"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A read-only window on float coordinates owned by someone else: a Matrix,
+ * a batch, a mapped tensor. Coordinate [i][j] is at
+ * data()[i*get_row_stride() + j*get_col_stride()], so a row, a column, a
+ * sub-block, a batch of columns or a transpose of a matrix is a view of
+ * the same buffer, and nothing is copied to take one.
+ * A view doesn't keep its storage alive, and it is invalidated by anything
+ * that reallocates it (e.g resize or transpose of the viewed Matrix), except
+ * for the value of a lazy expression, see MatrixExpr.h, which its views
+ * own.
+ * Matrix products, Dense layers, SparseMatrix and MlpNetwork read their
+ * inputs through views; rows with col stride 1 go to the kernels as they
+ * are, row stride as the leading dimension, other layouts are packed first.
+ */
+class MatrixView
+{
+ public:
+  //constructors
+  /**
+   * @param data coordinate [0][0]
+   * @param rows num of rows the view has
+   * @param cols num of cols
+   * @param row_stride floats from one row to the next
+   * @param col_stride floats from one column to the next
+   * @throws length_error if rows or cols is not positive, or a stride is
+   * negative
+   * @throws out_of_range if data is nullptr
+   */
+  MatrixView(const float* data, int rows, int cols, int row_stride,
+             int col_stride = 1);
+
+  /**
+   * views a whole matrix, row after row. copy-on-write storage is viewed
+   * where it is, nothing is copied
+   */
+  MatrixView(const Matrix& mat);
+
+  /**
+   * views the value of a lazy expression, e.g dense(a + b). it is evaluated
+   * once, and kept alive by this view and every view taken of it
+   */
+  template <typename E>
+  MatrixView(const matrix_expr::expr<E>& value);
+
+  //getters
+  /**
+   * @returns the rows number of the view
+   */
+  int get_rows() const;
+
+  /**
+   * @returns the columns number of the view
+   */
+  int get_cols() const;
+
+  /**
+   * @returns floats from one row to the next
+   */
+  int get_row_stride() const;
+
+  /**
+   * @returns floats from one column to the next
+   */
+  int get_col_stride() const;
+
+  /**
+   * @returns pointer to coordinate [0][0]
+   */
+  const float* data() const;
+
+  /**
+   * @returns true if every row is contiguous, as gemm reads its operands
+   */
+  bool has_contiguous_rows() const;
+
+  /**
+   * @returns true if the coordinates are contiguous, row after row, as a
+   * Matrix stores them
+   */
+  bool is_contiguous() const;
+
+  //methods
+  /**
+   * @param i row index
+   * @param j column index
+   * @return coordinate [i][j]
+   * @throws out_of_range if it's outside the view
+   */
+  float operator()(int i, int j) const;
+
+  /**
+   * @return a 1 X cols view of row row
+   * @throws out_of_range if there's no such row
+   */
+  MatrixView row(int row) const;
+
+  /**
+   * @return a rows X 1 view of column col, e.g one image of a batch
+   * @throws out_of_range if there's no such column
+   */
+  MatrixView col(int col) const;
+
+  /**
+   * @return a rows X cols view starting at [row][col], e.g
+   * block(0, begin, get_rows(), count) is count images of a batch
+   * @throws out_of_range if it doesn't fit inside the view
+   */
+  MatrixView block(int row, int col, int rows, int cols) const;
+
+  /**
+   * @return the transpose, the same coordinates with the strides swapped
+   */
+  MatrixView transposed() const;
+
+  /**
+   * same as Matrix::resize that keeps the values, or vectorize
+   * @return a rows X cols view of the same coordinates
+   * @throws length_error if this view isn't contiguous or rows*cols isn't
+   * its size
+   */
+  MatrixView reshaped(int rows, int cols) const;
+
+  /**
+   * @return this view if its rows are contiguous, else a copy of it in
+   * scratch, row after row
+   */
+  MatrixView with_contiguous_rows(std::vector<float>& scratch) const;
+
+  /**
+   * @return this view if it's contiguous, else a copy of it in scratch,
+   * row after row
+   */
+  MatrixView contiguous(std::vector<float>& scratch) const;
+
+  /**
+   * copies the coordinates, row after row
+   * @param out get_rows()*get_cols() floats
+   */
+  void copy_to(float* out) const;
+
+  /**
+   * @return a new allocated Matrix copy of the view
+   */
+  Matrix to_matrix() const;
+
+ private:
+  const float* _data;
+  int _rows, _cols;
+  int _row_stride, _col_stride;
+  std::shared_ptr<const Matrix> _value; // set if this views an expression
+
+  /**
+   * views a whole evaluated expression, which the view keeps alive
+   */
+  explicit MatrixView(std::shared_ptr<const Matrix> value);
+
+  /**
+   * @return view, keeping the storage of this view alive too
+   */
+  MatrixView sharing(MatrixView view) const;
+};
+
+
+template <typename E>
+MatrixView::MatrixView(const matrix_expr::expr<E>& value):
+    MatrixView(std::make_shared<const Matrix>(value))
+{
+}
+
+#endif //MATRIXVIEW_H
@@ -1,30 +1,629 @@
 #include "MlpNetwork.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+  /**
+   * @return the activation label of a layer in the profiler histograms
+   * @param logits true if the layer stops before its activation
+   */
+  const char* activation_name(const Dense& layer, bool logits)
+  {
+    if(logits)
+    {
+      return "none";
+    }
+    if(layer.get_activation() == relu)
+    {
+      return "relu";
+    }
+    return (layer.get_activation() == softmax) ? "softmax" : "custom";
+  }
+
+
+  /**
+   * @return the workspace the calling thread runs batch chunks in. kept
+   * across calls, so the layer outputs are only allocated again when the
+   * chunk shape changes. a thread runs one chunk at a time, so the callers
+   * of a pool, which all get its last worker index, never share one
+   */
+  mlp_workspace& chunk_workspace()
+  {
+    static thread_local mlp_workspace workspace;
+    return workspace;
+  }
+
+
+  /**
+   * @return the layers of the default_spec network, not checked against
+   * its dims, only chained by the network constructor
+   */
+  std::vector<Dense> default_layers(const Matrix weights[],
+                                    const Matrix biases[])
+  {
+    std::vector<Dense> layers;
+    for(int i=0; i<MLP_SIZE; i++)
+    {
+      layers.emplace_back(weights[i], biases[i],
+                          (i == MLP_SIZE-1) ? softmax : relu);
+    }
+    return layers;
+  }
+
+
+  /**
+   * @return the layers of a spec, checked against it
+   */
+  std::vector<Dense> spec_layers(const std::vector<layer_spec>& spec,
+                                 const std::vector<Matrix>& weights,
+                                 const std::vector<Matrix>& biases)
+  {
+    if(weights.size() != spec.size())
+    {
+      throw length_error(WEIGHT_SIZE_ERR_MSG);
+    }
+    if(biases.size() != spec.size())
+    {
+      throw length_error(BIAS_SIZE_ERR_MSG);
+    }
+    std::vector<Dense> layers;
+    for(size_t i=0; i<spec.size(); i++)
+    {
+      if(weights[i].get_rows() != spec[i].dims.rows ||
+         weights[i].get_cols() != spec[i].dims.cols)
+      {
+        throw length_error(WEIGHT_SIZE_ERR_MSG);
+      }
+      if(biases[i].get_rows() != spec[i].dims.rows ||
+         biases[i].get_cols() != ONE_COL)
+      {
+        throw length_error(BIAS_SIZE_ERR_MSG);
+      }
+      layers.emplace_back(weights[i], biases[i], spec[i].activation);
+    }
+    return layers;
+  }
+}
 
 
 MlpNetwork::MlpNetwork (const Matrix weights[MLP_SIZE], const Matrix
 biases[MLP_SIZE]):
-    _layer_1(weights[0], biases[0], relu),
-    _layer_2(weights[1], biases[1], relu),
-    _layer_3(weights[2], biases[2], relu),
-    _layer_4(weights[3], biases[3], softmax)
+    MlpNetwork(default_layers(weights, biases))
+{
+}
+
+
+MlpNetwork::MlpNetwork (const std::vector<Dense>& layers):
+    _layers(layers),
+    _pixel_scale(PIXEL_SCALE),
+    _pixel_offset(PIXEL_OFFSET),
+    _output_mode(OUTPUT_DISTRIBUTION),
+    _top_k(MLP_TOP_K)
+{
+  if(_layers.empty())
+  {
+    throw length_error(LAYERS_ERR_MSG);
+  }
+  for(size_t i=0; i+1<_layers.size(); i++)
+  {
+    if(_layers[i].get_weights().get_rows() !=
+       _layers[i+1].get_weights().get_cols())
+    {
+      throw length_error(WEIGHT_SIZE_ERR_MSG);
+    }
+  }
+  fold_pixel_offset();
+  const int classes = _layers.back().get_weights().get_rows();
+  _top_k = (classes < _top_k) ? classes : _top_k;
+  _workspace.layers.resize(_layers.size());
+  for(size_t i=0; i<_layers.size(); i++)
+  {
+    _workspace.layers[i].resize(_layers[i].get_weights().get_rows(),
+                                ONE_COL);
+  }
+}
+
+
+MlpNetwork::MlpNetwork (const std::vector<layer_spec>& spec,
+                        const std::vector<Matrix>& weights,
+                        const std::vector<Matrix>& biases):
+    MlpNetwork(spec_layers(spec, weights, biases))
 {
-   for(int i=0; i<MLP_SIZE-1; i++)
-   {
-     if(weights[i].get_rows() != weights[i+1].get_cols())
-     {
-       throw length_error(WEIGHT_SIZE_ERR_MSG);
-     }
-   }
+}
+
+
+std::vector<layer_spec> MlpNetwork::default_spec()
+{
+  std::vector<layer_spec> spec;
+  for(int i=0; i<MLP_SIZE; i++)
+  {
+    spec.push_back(layer_spec{weights_dims[i],
+                              (i == MLP_SIZE-1) ? softmax : relu});
+  }
+  return spec;
+}
+
+
+int MlpNetwork::get_layer_count() const
+{
+  return (int) _layers.size();
+}
+
+
+const Dense& MlpNetwork::get_layer(int index) const
+{
+  if(index < 0 || index >= get_layer_count())
+  {
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
+  }
+  return _layers[index];
 }
 
 
 digit MlpNetwork::operator()(Matrix & mat)
 {
   mat.vectorize();
-  Matrix res1 (_layer_1(mat));
-  Matrix res2 (_layer_2(res1));
-  Matrix res3 (_layer_3(res2));
-  Matrix res4 (_layer_4(res3));
-  return digit{(unsigned int) res4.argmax(),
-               res4[res4.argmax()]};
-}
\ No newline at end of file
+  forward(mat, _workspace);
+  return to_digit(_workspace.layers.back(), 0);
+}
+
+
+std::vector<digit> MlpNetwork::classify_batch(const MatrixView& images)
+{
+  forward(images, _workspace);
+  return to_digits(_workspace.layers.back());
+}
+
+
+std::vector<digit> MlpNetwork::classify_batch(const std::vector<Matrix>&
+images)
+{
+  if(images.empty())
+  {
+    return std::vector<digit>();
+  }
+  const int img_size = images[0].get_rows()*images[0].get_cols();
+  Matrix batch(img_size, (int) images.size());
+  for(int col=0; col<batch.get_cols(); col++)
+  {
+    const Matrix& img = images[col];
+    if(img.get_rows()*img.get_cols() != img_size)
+    {
+      throw length_error(LEN_ERR_MSG);
+    }
+    for(int index=0; index<img_size; index++)
+    {
+      batch(index, col) = img[index];
+    }
+  }
+  return classify_batch(batch);
+}
+
+
+digit MlpNetwork::classify(const MatrixView& image,
+                           mlp_workspace& workspace) const
+{
+  const int img_size = image.get_rows()*image.get_cols();
+  if(image.get_cols() == ONE_COL)
+  {
+    forward(image, workspace);
+  }
+  else if(image.is_contiguous())
+  {
+    //same as vectorize, on the same coordinates
+    forward(image.reshaped(img_size, ONE_COL), workspace);
+  }
+  else
+  {
+    workspace.input.resize(img_size, ONE_COL);
+    image.copy_to(workspace.input.data());
+    forward(workspace.input, workspace);
+  }
+  return to_digit(workspace.layers.back(), 0);
+}
+
+
+std::vector<digit> MlpNetwork::classify_batch(const MatrixView& images,
+                                              ThreadPool& pool) const
+{
+  std::vector<digit> digits(images.get_cols());
+  run_batch(images, pool, [this, &digits](int index, const Matrix& output,
+                                          int col, mlp_workspace&)
+  {
+    digits[index] = to_digit(output, col);
+  });
+  return digits;
+}
+
+
+void MlpNetwork::set_precision(int index, weight_precision precision)
+{
+  if(index < 0 || index >= get_layer_count())
+  {
+    throw out_of_range(OUT_OF_RNG_ERR_MSG);
+  }
+  _layers[index].set_precision(precision);
+  if(index == 0)
+  {
+    fold_pixel_offset();
+  }
+}
+
+
+void MlpNetwork::set_pixel_normalization(float scale, float offset)
+{
+  _pixel_scale = scale;
+  _pixel_offset = offset;
+  fold_pixel_offset();
+}
+
+
+digit MlpNetwork::operator()(const uint8_t* image)
+{
+  forward(image, ONE_COL, _workspace);
+  return to_digit(_workspace.layers.back(), 0);
+}
+
+
+std::vector<digit> MlpNetwork::classify_batch(const uint8_t* images,
+                                              int count)
+{
+  if(count <= 0)
+  {
+    return std::vector<digit>();
+  }
+  forward(images, count, _workspace);
+  return to_digits(_workspace.layers.back());
+}
+
+
+digit MlpNetwork::classify(const uint8_t* image, mlp_workspace& workspace)
+const
+{
+  forward(image, ONE_COL, workspace);
+  return to_digit(workspace.layers.back(), 0);
+}
+
+
+std::vector<digit> MlpNetwork::classify_batch(const uint8_t* images,
+                                              int count,
+                                              ThreadPool& pool) const
+{
+  std::vector<digit> digits(count > 0 ? count : 0);
+  run_batch(images, count, pool, [this, &digits](int index,
+                                                 const Matrix& output,
+                                                 int col, mlp_workspace&)
+  {
+    digits[index] = to_digit(output, col);
+  });
+  return digits;
+}
+
+
+output_mode MlpNetwork::get_output_mode() const
+{
+  return _output_mode;
+}
+
+
+int MlpNetwork::get_top_k() const
+{
+  return _top_k;
+}
+
+
+void MlpNetwork::set_output_mode(output_mode mode, int k)
+{
+  if(k < 1 || k > _layers.back().get_weights().get_rows())
+  {
+    throw out_of_range(TOP_K_ERR_MSG);
+  }
+  _output_mode = mode;
+  _top_k = k;
+}
+
+
+std::vector<digit> MlpNetwork::predict(const MatrixView& image,
+                                       mlp_workspace& workspace) const
+{
+  classify(image, workspace);
+  return to_classes(workspace.layers.back(), 0, workspace.scores);
+}
+
+
+std::vector<digit> MlpNetwork::predict(const uint8_t* image,
+                                       mlp_workspace& workspace) const
+{
+  forward(image, ONE_COL, workspace);
+  return to_classes(workspace.layers.back(), 0, workspace.scores);
+}
+
+
+std::vector<std::vector<digit>> MlpNetwork::predict_batch(
+    const MatrixView& images, ThreadPool& pool) const
+{
+  std::vector<std::vector<digit>> results(images.get_cols());
+  run_batch(images, pool, [this, &results](int index, const Matrix& output,
+                                           int col, mlp_workspace& workspace)
+  {
+    results[index] = to_classes(output, col, workspace.scores);
+  });
+  return results;
+}
+
+
+std::vector<std::vector<digit>> MlpNetwork::predict_batch(
+    const uint8_t* images, int count, ThreadPool& pool) const
+{
+  std::vector<std::vector<digit>> results(count > 0 ? count : 0);
+  run_batch(images, count, pool, [this, &results](int index,
+                                                  const Matrix& output,
+                                                  int col,
+                                                  mlp_workspace& workspace)
+  {
+    results[index] = to_classes(output, col, workspace.scores);
+  });
+  return results;
+}
+
+
+template <typename Read>
+void MlpNetwork::run_batch(const MatrixView& images, ThreadPool& pool,
+                           Read read) const
+{
+  const int count = images.get_cols();
+  const int img_size = images.get_rows();
+
+  int grain = count/(pool.size()*MLP_CHUNKS_PER_THREAD);
+  grain = (grain < MLP_MIN_CHUNK) ? MLP_MIN_CHUNK : grain;
+  grain = (grain > MLP_MAX_CHUNK) ? MLP_MAX_CHUNK : grain;
+
+  pool.parallel_for(count, grain, [&](int begin, int end, int)
+  {
+    //a chunk is a view of its columns, the first layer reads it in place
+    mlp_workspace& workspace = chunk_workspace();
+    const int chunk = end - begin;
+    forward(images.block(0, begin, img_size, chunk), workspace);
+    for(int col=0; col<chunk; col++)
+    {
+      read(begin + col, workspace.layers.back(), col, workspace);
+    }
+  });
+}
+
+
+template <typename Read>
+void MlpNetwork::run_batch(const uint8_t* images, int count,
+                           ThreadPool& pool, Read read) const
+{
+  const int img_size = _layers[0].get_weights().get_cols();
+
+  int grain = count/(pool.size()*MLP_CHUNKS_PER_THREAD);
+  grain = (grain < MLP_MIN_CHUNK) ? MLP_MIN_CHUNK : grain;
+  grain = (grain > MLP_MAX_CHUNK) ? MLP_MAX_CHUNK : grain;
+
+  pool.parallel_for(count, grain, [&](int begin, int end, int)
+  {
+    //images are back to back, a chunk is already contiguous
+    mlp_workspace& workspace = chunk_workspace();
+    forward(images + ((long) begin)*img_size, end - begin, workspace);
+    for(int col=0; col<end - begin; col++)
+    {
+      read(begin + col, workspace.layers.back(), col, workspace);
+    }
+  });
+}
+
+
+void MlpNetwork::forward(const MatrixView& input, mlp_workspace& workspace)
+const
+{
+  const profile::call_scope call;
+  workspace.layers.resize(_layers.size());
+  const bool logits = (_layers.size() == 1 && reads_logits());
+  {
+    const Matrix& weights = _layers[0].get_weights();
+    const profile::layer_scope scope(0, weights.get_rows(),
+                                     weights.get_cols(), input.get_cols(),
+                                     activation_name(_layers[0], logits));
+    if(logits)
+    {
+      _layers[0].pre_activation(input, workspace.layers[0]);
+    }
+    else
+    {
+      _layers[0](input, workspace.layers[0]);
+    }
+  }
+  forward_hidden(workspace);
+}
+
+
+void MlpNetwork::forward(const uint8_t* images, int count,
+                         mlp_workspace& workspace) const
+{
+  const profile::call_scope call;
+  workspace.layers.resize(_layers.size());
+  const bool logits = (_layers.size() == 1 && reads_logits());
+  {
+    const Matrix& weights = _layers[0].get_weights();
+    const profile::layer_scope scope(0, weights.get_rows(),
+                                     weights.get_cols(), count,
+                                     activation_name(_layers[0], logits));
+    if(logits)
+    {
+      _layers[0].pre_activation(images, count, _pixel_scale, _pixel_bias,
+                                workspace.layers[0]);
+    }
+    else
+    {
+      _layers[0](images, count, _pixel_scale, _pixel_bias,
+                 workspace.layers[0]);
+    }
+  }
+  forward_hidden(workspace);
+}
+
+
+void MlpNetwork::forward_hidden(mlp_workspace& workspace) const
+{
+  const size_t last = _layers.size() - 1;
+  for(size_t i=1; i<=last; i++)
+  {
+    //the logits of a softmax last layer, softmax keeps their order
+    const bool logits = (i == last && reads_logits());
+    const Matrix& weights = _layers[i].get_weights();
+    const profile::layer_scope scope((int) i, weights.get_rows(),
+                                     weights.get_cols(),
+                                     workspace.layers[i-1].get_cols(),
+                                     activation_name(_layers[i], logits));
+    if(logits)
+    {
+      _layers[i].pre_activation(workspace.layers[i-1], workspace.layers[i]);
+    }
+    else
+    {
+      _layers[i](workspace.layers[i-1], workspace.layers[i]);
+    }
+  }
+}
+
+
+bool MlpNetwork::reads_logits() const
+{
+  return _output_mode != OUTPUT_DISTRIBUTION &&
+         _layers.back().get_activation() == activation::softmax;
+}
+
+
+void MlpNetwork::fold_pixel_offset()
+{
+  const Dense& first = _layers[0];
+  if(_pixel_offset == 0)
+  {
+    _pixel_bias = first.get_bias();
+    return;
+  }
+  //(pixel*scale + offset)*w = scale*(pixel*w) + offset*rowsum(w), rowsum
+  //through the layer itself, so it sums the weights in their precision
+  Matrix ones(first.get_weights().get_cols(), ONE_COL);
+  for(int index=0; index<ones.get_rows(); index++)
+  {
+    ones[index] = 1;
+  }
+  Matrix row_sums;
+  first.pre_activation(ones, row_sums);
+  row_sums += first.get_bias()*-1.0F;
+  _pixel_bias = first.get_bias() + row_sums*_pixel_offset;
+}
+
+
+digit MlpNetwork::to_digit(const Matrix& output, int col) const
+{
+  //argmax over one column of the output
+  const float* coords = output.data();
+  const int cols = output.get_cols();
+  const int rows = output.get_rows();
+  int max_row = 0;
+  for(int row=1; row<rows; row++)
+  {
+    if(coords[row*cols + col] > coords[max_row*cols + col])
+    {
+      max_row = row;
+    }
+  }
+  const float max = coords[max_row*cols + col];
+  if(_output_mode == OUTPUT_ARGMAX)
+  {
+    return digit{(unsigned int) max_row, NAN};
+  }
+  if(!reads_logits())
+  {
+    return digit{(unsigned int) max_row, max};
+  }
+  //the output holds logits, softmax of the max is 1/sum(exp(l - max))
+  float sum = 0;
+  for(int row=0; row<rows; row++)
+  {
+    sum += std::exp(coords[row*cols + col] - max);
+  }
+  return digit{(unsigned int) max_row, 1/sum};
+}
+
+
+std::vector<digit> MlpNetwork::to_digits(const Matrix& output) const
+{
+  std::vector<digit> digits;
+  digits.reserve(output.get_cols());
+  for(int col=0; col<output.get_cols(); col++)
+  {
+    digits.push_back(to_digit(output, col));
+  }
+  return digits;
+}
+
+
+std::vector<digit> MlpNetwork::to_classes(const Matrix& output, int col,
+                                          std::vector<float>& scores) const
+{
+  if(_output_mode == OUTPUT_ARGMAX)
+  {
+    return std::vector<digit>(1, to_digit(output, col));
+  }
+  const float* coords = output.data();
+  const int cols = output.get_cols();
+  const int rows = output.get_rows();
+  std::vector<digit> classes(rows);
+  for(int row=0; row<rows; row++)
+  {
+    classes[row] = digit{(unsigned int) row, coords[row*cols + col]};
+  }
+  const auto by_score = [](const digit& lhs, const digit& rhs)
+  {
+    return lhs.probability > rhs.probability;
+  };
+  if(_output_mode == OUTPUT_DISTRIBUTION)
+  {
+    return classes;
+  }
+  if(!reads_logits())
+  {
+    std::partial_sort(classes.begin(), classes.begin() + _top_k,
+                      classes.end(), by_score);
+    classes.resize(_top_k);
+    return classes;
+  }
+
+  //exp(l - max) of every logit is the denominator, but only the k
+  //selected classes are divided by it
+  scores.resize(rows);
+  float max = coords[col];
+  for(int row=0; row<rows; row++)
+  {
+    scores[row] = coords[row*cols + col];
+    max = (scores[row] > max) ? scores[row] : max;
+  }
+  for(int row=0; row<rows; row++)
+  {
+    scores[row] -= max;
+  }
+  activation::exp_span(scores.data(), rows);
+  float sum = 0;
+  for(int row=0; row<rows; row++)
+  {
+    classes[row].probability = scores[row];
+    sum += scores[row];
+  }
+  std::partial_sort(classes.begin(), classes.begin() + _top_k, classes.end(),
+                    by_score);
+  classes.resize(_top_k);
+  const float inv_sum = 1/sum;
+  for(digit& result : classes)
+  {
+    result.probability *= inv_sum;
+  }
+  return classes;
+}
@@ -4,10 +4,21 @@
 #define MLPNETWORK_H
 
 #include "Dense.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <vector>
 
-#define MLP_SIZE 4
+#define MLP_SIZE 4 // layers of the default_spec network
+#define MLP_MIN_CHUNK 8      // fewest images a parallel batch chunk holds
+#define MLP_MAX_CHUNK 256    // most images a parallel batch chunk holds
+#define MLP_CHUNKS_PER_THREAD 4
+#define PIXEL_SCALE (1.0F/255.0F) // default 8 bit pixel normalization,
+#define PIXEL_OFFSET 0.0F         // pixel*PIXEL_SCALE + PIXEL_OFFSET
+#define MLP_TOP_K 3 // default k of OUTPUT_TOP_K
 #define WEIGHT_SIZE_ERR_MSG "weight matrix size err"
 #define BIAS_SIZE_ERR_MSG "bias matrix size err"
+#define TOP_K_ERR_MSG "k must be from 1 to the number of classes"
+#define LAYERS_ERR_MSG "A network needs at least one layer"
 
 using activation::relu;
 using activation::softmax;
@@ -24,6 +35,28 @@ typedef struct digit {
 	float probability;
 } digit;
 
+/**
+ * what the network computes from the last layer
+ */
+enum output_mode
+{
+  OUTPUT_DISTRIBUTION, // the softmax probability of every class
+  OUTPUT_TOP_K,        // the k best classes, only those are normalized
+  OUTPUT_ARGMAX        // the best class only, no softmax at all
+};
+
+/**
+ * @struct layer_spec
+ * @brief The shape and activation of one layer, a network is a list of them.
+ * @var dims - the weights dims, rows outputs X cols inputs
+ * @var activation - the layer activation function
+ */
+typedef struct layer_spec
+{
+  matrix_dims dims;
+  activation_t activation;
+} layer_spec;
+
 const matrix_dims img_dims = {28, 28};
 const matrix_dims weights_dims[] = {{128, 784},
 									{64,  128},
@@ -34,32 +67,329 @@ const matrix_dims bias_dims[] = {{128, 1},
 								 {20,  1},
 								 {10,  1}};
 
+/**
+ * @struct mlp_workspace
+ * @brief Scratch buffers of one network activation: the input copied as a
+ *        vector when a view of it can't be read in place, and every layer
+ *        output. Each thread running a
+ *        const network needs its own workspace, it is sized on first use.
+ */
+typedef struct mlp_workspace
+{
+  Matrix input;
+  std::vector<Matrix> layers;
+  std::vector<float> scores; // one output column, read by OUTPUT_TOP_K
+} mlp_workspace;
+
 class MlpNetwork
 {
  public:
 
   //constructor
   /**
-   * constructor of MlpNetwork
-   * @param weights An array of Matrix objects - the weights matrices
-   * @param biases An array of biases vectors
+   * constructor of MlpNetwork, the default_spec network
+   * @param weights An array of MLP_SIZE Matrix objects - the weights matrices
+   * @param biases An array of MLP_SIZE biases vectors
    */
   MlpNetwork (const Matrix weights[], const Matrix biases[]);
 
+  /**
+   * a network of any depth, every layer feeds the next one
+   * @param layers the layers, the first one reads the input
+   * @throws length_error if there is no layer or a layer input size is not
+   * the previous layer output size
+   */
+  explicit MlpNetwork (const std::vector<Dense>& layers);
+
+  /**
+   * a network of any depth from its spec
+   * @param spec the shape and activation of every layer
+   * @param weights the weights of every layer, spec dims each
+   * @param biases the biases vector of every layer
+   * @throws length_error if the matrices don't match the spec or the spec
+   * layers don't chain
+   */
+  MlpNetwork (const std::vector<layer_spec>& spec,
+              const std::vector<Matrix>& weights,
+              const std::vector<Matrix>& biases);
+
+  /**
+   * @return the spec of the fixed network: weights_dims with relu, relu,
+   * relu and softmax
+   */
+  static std::vector<layer_spec> default_spec();
+
+  //getters
+  /**
+   * @return the number of layers
+   */
+  int get_layer_count() const;
+
+  /**
+   * @param index the layer index, 0 is the input layer
+   * @return the layer
+   * @throws out_of_range if there is no such layer
+   */
+  const Dense& get_layer(int index) const;
+
+  /**
+   * @returns the output mode, see set_output_mode
+   */
+  output_mode get_output_mode() const;
+
+  /**
+   * @returns the number of classes OUTPUT_TOP_K returns
+   */
+  int get_top_k() const;
+
   //operators
   /**
    * activate the network
+   * runs in the network workspace, no allocation is made
    * @param mat A Matrix object
    * @return A digit struct, with the result number and score
    */
   digit operator()(Matrix & mat);
 
+  //methods
+  /**
+   * activate the network on a batch of images in one pass
+   * every layer runs as a single matrix-matrix product
+   * @param images every column is one vectorized image, a Matrix or a view
+   * e.g of some columns of a larger batch, read in place
+   * @return A digit struct for every column, in the same order
+   */
+  std::vector<digit> classify_batch(const MatrixView& images);
+
+  /**
+   * activate the network on a batch of images in one pass
+   * @param images Matrix objects of the same size, each one is an image
+   * @return A digit struct for every image, in the same order
+   */
+  std::vector<digit> classify_batch(const std::vector<Matrix>& images);
+
+  /**
+   * activate the network without changing it or the image,
+   * safe to call from many threads at once
+   * @param image A Matrix object or view, read as a long vector, in place
+   * unless it's a view with gaps between its rows
+   * @param workspace scratch buffers owned by the calling thread
+   * @return A digit struct, with the result number and score
+   */
+  digit classify(const MatrixView& image, mlp_workspace& workspace) const;
+
+  /**
+   * activate the network on a batch of images, split across the pool
+   * threads. every thread runs its chunks in its own workspace, kept
+   * across calls.
+   * safe to call from many threads at once
+   * @param images every column is one vectorized image, a Matrix or a view.
+   * every chunk is a view of its columns, nothing is copied
+   * @param pool the threads to run on
+   * @return A digit struct for every column, in the same order
+   */
+  std::vector<digit> classify_batch(const MatrixView& images,
+                                    ThreadPool& pool) const;
+
+  /**
+   * sets the precision one layer reads its weights in, see
+   * Dense::set_precision
+   * @param index the layer index, 0 is the input layer
+   * @param precision the storage precision
+   * @throws out_of_range if there is no such layer
+   */
+  void set_precision(int index, weight_precision precision);
+
+  /**
+   * sets how 8 bit images are normalized, every pixel is read as
+   * pixel*scale + offset. both are folded into the first layer, the scale
+   * is applied to its outputs and the offset to its bias
+   * @param scale the value of one pixel step, default PIXEL_SCALE
+   * @param offset the value of a 0 pixel, default PIXEL_OFFSET
+   */
+  void set_pixel_normalization(float scale, float offset);
+
+  /**
+   * sets what the network computes from its last layer, default
+   * OUTPUT_DISTRIBUTION. OUTPUT_ARGMAX and OUTPUT_TOP_K stop a softmax last
+   * layer before its softmax and read the logits, the argmax is the same;
+   * other last layers report their outputs as they are. the digit of
+   * operator() and classify is the best class of the mode, with a NAN
+   * probability in OUTPUT_ARGMAX
+   * @param mode the output mode
+   * @param k the number of classes OUTPUT_TOP_K returns
+   * @throws out_of_range if k is not from 1 to the number of classes
+   */
+  void set_output_mode(output_mode mode, int k = MLP_TOP_K);
+
+  /**
+   * activate the network in the output mode,
+   * safe to call from many threads at once
+   * @param image A Matrix object or view, read as a long vector, see classify
+   * @param workspace scratch buffers owned by the calling thread
+   * @return OUTPUT_ARGMAX: the best class, its probability NAN.
+   * OUTPUT_TOP_K: the k best classes, best first. OUTPUT_DISTRIBUTION:
+   * every class, by value
+   */
+  std::vector<digit> predict(const MatrixView& image,
+                             mlp_workspace& workspace) const;
+
+  /**
+   * activate the network in the output mode on an 8 bit image, see predict
+   * @param image the pixels of one image, row after row
+   * @param workspace scratch buffers owned by the calling thread
+   */
+  std::vector<digit> predict(const uint8_t* image, mlp_workspace& workspace)
+  const;
+
+  /**
+   * predict on every column of a batch, split across the pool threads.
+   * safe to call from many threads at once
+   * @param images every column is one vectorized image, a Matrix or a view
+   * @param pool the threads to run on
+   * @return the classes of every column, in the same order
+   */
+  std::vector<std::vector<digit>> predict_batch(const MatrixView& images,
+                                                ThreadPool& pool) const;
+
+  /**
+   * predict on 8 bit images, split across the pool threads
+   * @param images count images back to back, row after row
+   * @param count number of images
+   * @param pool the threads to run on
+   * @return the classes of every image, in the same order
+   */
+  std::vector<std::vector<digit>> predict_batch(const uint8_t* images,
+                                                int count,
+                                                ThreadPool& pool) const;
+
+  /**
+   * activate the network on an 8 bit image
+   * runs in the network workspace, no allocation is made
+   * @param image the pixels of one image, row after row
+   * @return A digit struct, with the result number and score
+   */
+  digit operator()(const uint8_t* image);
+
+  /**
+   * activate the network on 8 bit images in one pass
+   * @param images count images back to back, row after row
+   * @param count number of images
+   * @return A digit struct for every image, in the same order
+   */
+  std::vector<digit> classify_batch(const uint8_t* images, int count);
+
+  /**
+   * activate the network on an 8 bit image,
+   * safe to call from many threads at once
+   * @param image the pixels of one image, row after row
+   * @param workspace scratch buffers owned by the calling thread
+   * @return A digit struct, with the result number and score
+   */
+  digit classify(const uint8_t* image, mlp_workspace& workspace) const;
+
+  /**
+   * activate the network on 8 bit images, split across the pool threads.
+   * safe to call from many threads at once
+   * @param images count images back to back, row after row
+   * @param count number of images
+   * @param pool the threads to run on
+   * @return A digit struct for every image, in the same order
+   */
+  std::vector<digit> classify_batch(const uint8_t* images, int count,
+                                    ThreadPool& pool) const;
+
   private:
-  //Network layers
-  Dense _layer_1;
-  Dense _layer_2;
-  Dense _layer_3;
-  Dense _layer_4;
+  //Network layers, the first one reads the input
+  std::vector<Dense> _layers;
+
+  //Layers outputs of the non const activations, allocated once and reused.
+  //those must not be called from two threads at once
+  mlp_workspace _workspace;
+
+  //8 bit input normalization, the first layer bias with the offset folded
+  //in. refreshed whenever the first layer changes, see fold_pixel_offset
+  float _pixel_scale;
+  float _pixel_offset;
+  Matrix _pixel_bias;
+
+  output_mode _output_mode;
+  int _top_k;
+
+  /**
+   * runs chunks of the batch columns on the pool threads, each chunk in the
+   * workspace of the thread running it
+   * @param images every column is one vectorized image
+   * @param read called with the image index, the last layer output and
+   * the image column in it, and the workspace
+   */
+  template <typename Read>
+  void run_batch(const MatrixView& images, ThreadPool& pool, Read read)
+  const;
+
+  /**
+   * run_batch on count 8 bit images back to back
+   */
+  template <typename Read>
+  void run_batch(const uint8_t* images, int count, ThreadPool& pool,
+                 Read read) const;
+
+  /**
+   * runs all layers, the result is left in the last workspace layer
+   * @param input every column is one vectorized image
+   * @param workspace the layers outputs
+   */
+  void forward(const MatrixView& input, mlp_workspace& workspace) const;
+
+  /**
+   * runs all layers on 8 bit images, see forward
+   * @param images count images back to back
+   * @param count number of images
+   * @param workspace the layers outputs
+   */
+  void forward(const uint8_t* images, int count, mlp_workspace& workspace)
+  const;
+
+  /**
+   * runs all layers after the first, on the first workspace layer
+   * @param workspace the layers outputs
+   */
+  void forward_hidden(mlp_workspace& workspace) const;
+
+  /**
+   * @return true if the last layer stops before its softmax, see
+   * set_output_mode
+   */
+  bool reads_logits() const;
+
+  /**
+   * folds _pixel_offset into the first layer bias as the layer reads its
+   * weights now, into _pixel_bias. called whenever either changes
+   */
+  void fold_pixel_offset();
+
+  /**
+   * @param output the last layer output
+   * @return the digit of every column of the output
+   */
+  std::vector<digit> to_digits(const Matrix& output) const;
+
+  /**
+   * @param output the last layer output
+   * @param col the column of the image
+   * @return the best class of one column of the output, see
+   * set_output_mode
+   */
+  digit to_digit(const Matrix& output, int col) const;
+
+  /**
+   * @param output the last layer output
+   * @param col the column of the image
+   * @param scores scratch for one output column
+   * @return the classes of one column of the output, see predict
+   */
+  std::vector<digit> to_classes(const Matrix& output, int col,
+                                std::vector<float>& scores) const;
 
 };
 
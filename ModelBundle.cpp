@@ -0,0 +1,511 @@
+#include "ModelBundle.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+static_assert(sizeof(bundle_header) == 64, "bundle header must be 64 bytes");
+static_assert(sizeof(bundle_layer) == 32, "bundle layer must be 32 bytes");
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  /**
+   * @return the CRC32 (IEEE 802.3) of len bytes, continuing from crc
+   */
+  uint32_t crc32(const char* data, size_t len, uint32_t crc = 0)
+  {
+    static const std::array<uint32_t, 256> table = []()
+    {
+      std::array<uint32_t, 256> entries;
+      for(uint32_t byte=0; byte<256; byte++)
+      {
+        uint32_t value = byte;
+        for(int bit=0; bit<8; bit++)
+        {
+          value = (value & 1U) ? (0xEDB88320U ^ (value >> 1)) : (value >> 1);
+        }
+        entries[byte] = value;
+      }
+      return entries;
+    }();
+    crc = ~crc;
+    for(size_t index=0; index<len; index++)
+    {
+      crc = table[(crc ^ (uint8_t) data[index]) & 0xFFU] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+
+  /**
+   * @return offset rounded up to BUNDLE_ALIGN
+   */
+  uint64_t align_up(uint64_t offset)
+  {
+    return (offset + BUNDLE_ALIGN - 1)/BUNDLE_ALIGN*BUNDLE_ALIGN;
+  }
+
+
+  /**
+   * @return the activation id of a layer function
+   */
+  uint32_t activation_id(activation_t activation_func)
+  {
+    if(activation_func == activation::relu)
+    {
+      return BUNDLE_RELU;
+    }
+    if(activation_func == activation::softmax)
+    {
+      return BUNDLE_SOFTMAX;
+    }
+    throw runtime_error(BUNDLE_ACTIVATION_ERR_MSG);
+  }
+
+
+  /**
+   * @return the layer function of an activation id
+   */
+  activation_t activation_func(uint32_t id)
+  {
+    return (id == BUNDLE_SOFTMAX) ? activation::softmax : activation::relu;
+  }
+
+
+  /**
+   * @return the CRC32 of a header and its layer table, header_crc as 0
+   */
+  uint32_t header_crc(const bundle_header& header, const bundle_layer* layers)
+  {
+    bundle_header copy = header;
+    copy.header_crc = 0;
+    const uint32_t crc = crc32((const char*) &copy, sizeof(copy));
+    return crc32((const char*) layers, header.layer_count*sizeof(bundle_layer),
+                 crc);
+  }
+
+
+  /**
+   * @return the offset of the first tensor, after a table of count layers
+   */
+  uint64_t payload_offset(uint32_t count)
+  {
+    return align_up(sizeof(bundle_header) + count*sizeof(bundle_layer));
+  }
+
+
+  /**
+   * flushes a file, or a directory entry list, to the disk
+   * @return false if it couldn't be opened or flushed
+   */
+  bool sync_path(const std::string& path)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+  }
+
+
+  /**
+   * @return the directory path is in, "." for a bare file name
+   */
+  std::string parent_dir(const std::string& path)
+  {
+    const size_t slash = path.find_last_of('/');
+    if(slash == std::string::npos)
+    {
+      return ".";
+    }
+    return slash ? path.substr(0, slash) : "/";
+  }
+
+
+  /**
+   * lays out a bundle, every tensor aligned, and writes it aside then
+   * renames it over path in one step. the new file is on the disk before
+   * the rename, and the rename is before returning, so a crash leaves
+   * either the old bundle or the new one, never a partial one
+   * @param layers the layer table, the offsets are filled in here
+   * @param weights the weights bytes of every layer
+   * @param biases the bias bytes of every layer
+   */
+  void write_file(const std::string& path, std::vector<bundle_layer>& layers,
+                  const std::vector<std::vector<char>>& weights,
+                  const std::vector<std::vector<char>>& biases)
+  {
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE);
+    header.version = BUNDLE_VERSION;
+    header.byte_order = BUNDLE_BYTE_ORDER;
+    header.layer_count = (uint32_t) layers.size();
+
+    const uint64_t payload_start = payload_offset(header.layer_count);
+    uint64_t offset = payload_start;
+    for(size_t layer=0; layer<layers.size(); layer++)
+    {
+      layers[layer].weights_offset = offset;
+      offset = align_up(offset + weights[layer].size());
+      layers[layer].bias_offset = offset;
+      offset = align_up(offset + biases[layer].size());
+    }
+    header.file_size = offset;
+
+    //build the payload, the padding is zeros
+    std::vector<char> payload(offset - payload_start, 0);
+    for(size_t layer=0; layer<layers.size(); layer++)
+    {
+      std::copy(weights[layer].begin(), weights[layer].end(),
+                payload.begin() + (layers[layer].weights_offset -
+                                   payload_start));
+      std::copy(biases[layer].begin(), biases[layer].end(),
+                payload.begin() + (layers[layer].bias_offset - payload_start));
+    }
+    header.payload_crc = crc32(payload.data(), payload.size());
+    header.header_crc = header_crc(header, layers.data());
+
+    const std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+      const size_t table_size = layers.size()*sizeof(bundle_layer);
+      const std::vector<char> gap(payload_start - sizeof(header) - table_size,
+                                  0);
+      os.write((const char*) &header, sizeof(header));
+      os.write((const char*) layers.data(), table_size);
+      os.write(gap.data(), gap.size());
+      os.write(payload.data(), payload.size());
+      os.close();
+      if(!os || !sync_path(tmp_path))
+      {
+        std::remove(tmp_path.c_str());
+        throw runtime_error(BUNDLE_WRITE_ERR_MSG);
+      }
+    }
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+      std::remove(tmp_path.c_str());
+      throw runtime_error(BUNDLE_WRITE_ERR_MSG);
+    }
+    if(!sync_path(parent_dir(path)))
+    {
+      throw runtime_error(BUNDLE_WRITE_ERR_MSG);
+    }
+  }
+
+
+  /**
+   * @return the bytes of len floats
+   */
+  std::vector<char> float_bytes(const float* data, size_t len)
+  {
+    return std::vector<char>((const char*) data,
+                             (const char*) (data + len));
+  }
+
+
+  /**
+   * @return the BUNDLE_CSR bytes of a weights matrix, see bundle_layer
+   */
+  std::vector<char> csr_bytes(const SparseMatrix& sparse)
+  {
+    const std::vector<int32_t>& row_starts = sparse.get_row_starts();
+    const std::vector<int32_t>& col_indexes = sparse.get_col_indexes();
+    std::vector<char> bytes((const char*) row_starts.data(),
+                            (const char*) (row_starts.data() +
+                                           row_starts.size()));
+    bytes.insert(bytes.end(), (const char*) col_indexes.data(),
+                 (const char*) (col_indexes.data() + col_indexes.size()));
+    const std::vector<char> values = float_bytes(sparse.get_values().data(),
+                                                 sparse.get_values().size());
+    bytes.insert(bytes.end(), values.begin(), values.end());
+    return bytes;
+  }
+
+
+  /**
+   * reads and validates the BUNDLE_CSR weights of a layer, straight from
+   * the mapped arrays
+   * @return the weights in CSR form
+   */
+  SparseMatrix read_csr(const MappedFile& file, const bundle_layer& entry)
+  {
+    const uint64_t starts_size = (entry.rows + 1ULL)*sizeof(int32_t);
+    if(entry.weights_offset > file.size() ||
+       starts_size > file.size() - entry.weights_offset)
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+    //BUNDLE_ALIGN aligned, so every array is aligned to its type
+    const char* data = file.data() + entry.weights_offset;
+    const int32_t* row_starts = (const int32_t*) data;
+    const int32_t nonzeros = row_starts[entry.rows];
+    if(nonzeros < 0 ||
+       ((uint64_t) nonzeros) > ((uint64_t) entry.rows)*entry.cols ||
+       2*((uint64_t) nonzeros)*CELL_SIZE >
+       file.size() - entry.weights_offset - starts_size)
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+    const int32_t* col_indexes = (const int32_t*) (data + starts_size);
+    const float* values = (const float*) (col_indexes + nonzeros);
+    try
+    {
+      return SparseMatrix((int) entry.rows, (int) entry.cols, row_starts,
+                          col_indexes, values, nonzeros);
+    }
+    catch(const runtime_error&)
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+  }
+
+
+  /**
+   * writes float layers, the weights in CSR form from DENSE_SPARSE_THRESHOLD
+   * zeros on
+   */
+  void write_float(const std::string& path, const Matrix weights[],
+                   const Matrix biases[], const activation_t activations[],
+                   size_t count)
+  {
+    std::vector<bundle_layer> layers(count);
+    std::vector<std::vector<char>> weights_bytes, biases_bytes;
+    for(size_t layer=0; layer<count; layer++)
+    {
+      if(biases[layer].get_cols() != ONE_COL ||
+         biases[layer].get_rows() != weights[layer].get_rows())
+      {
+        throw length_error(BIAS_SIZE_ERR_MSG);
+      }
+      memset(&layers[layer], 0, sizeof(bundle_layer));
+      layers[layer].rows = weights[layer].get_rows();
+      layers[layer].cols = weights[layer].get_cols();
+      layers[layer].activation = activation_id(activations[layer]);
+      const SparseMatrix sparse(weights[layer]);
+      if(sparse.sparsity() >= DENSE_SPARSE_THRESHOLD)
+      {
+        layers[layer].dtype = BUNDLE_CSR;
+        weights_bytes.push_back(csr_bytes(sparse));
+      }
+      else
+      {
+        layers[layer].dtype = BUNDLE_FLOAT32;
+        weights_bytes.push_back(float_bytes(weights[layer].data(),
+                                            ((size_t) layers[layer].rows)*
+                                            layers[layer].cols));
+      }
+      biases_bytes.push_back(float_bytes(biases[layer].data(),
+                                         layers[layer].rows));
+    }
+    write_file(path, layers, weights_bytes, biases_bytes);
+  }
+
+
+  /**
+   * validates a mapped bundle: header, layer table, payload checksum, and
+   * the shape and alignment of every layer
+   * @return the layer table
+   */
+  std::vector<bundle_layer> read_table(const MappedFile& file,
+                                       bool verify_payload)
+  {
+    if(file.size() < sizeof(bundle_header))
+    {
+      throw runtime_error(BUNDLE_FORMAT_ERR_MSG);
+    }
+    bundle_header header;
+    memcpy(&header, file.data(), sizeof(header));
+    if(memcmp(header.magic, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE) != 0 ||
+       header.byte_order != BUNDLE_BYTE_ORDER)
+    {
+      throw runtime_error(BUNDLE_FORMAT_ERR_MSG);
+    }
+    if(header.version < BUNDLE_MIN_VERSION || header.version > BUNDLE_VERSION)
+    {
+      throw runtime_error(BUNDLE_VERSION_ERR_MSG);
+    }
+    const uint64_t payload_start = payload_offset(header.layer_count);
+    if(header.file_size != file.size() || header.layer_count == 0 ||
+       payload_start > file.size())
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+
+    //version 1 wrote 0 in place of dtype, float32
+    std::vector<bundle_layer> layers(header.layer_count);
+    memcpy(layers.data(), file.data() + sizeof(header),
+           layers.size()*sizeof(bundle_layer));
+    if(header_crc(header, layers.data()) != header.header_crc)
+    {
+      throw runtime_error(BUNDLE_CRC_ERR_MSG);
+    }
+    if(verify_payload &&
+       crc32(file.data() + payload_start, file.size() - payload_start) !=
+       header.payload_crc)
+    {
+      throw runtime_error(BUNDLE_CRC_ERR_MSG);
+    }
+    for(const bundle_layer& entry : layers)
+    {
+      if(entry.rows == 0 || entry.rows > INT_MAX ||
+         entry.cols == 0 || entry.cols > INT_MAX ||
+         entry.activation > BUNDLE_SOFTMAX ||
+         entry.weights_offset % BUNDLE_ALIGN != 0 ||
+         entry.bias_offset % BUNDLE_ALIGN != 0)
+      {
+        throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+      }
+    }
+    return layers;
+  }
+}
+
+/////////////////////////////////// WRITE /////////////////////////////////////
+
+void bundle::write(const std::string& path, const Matrix weights[],
+                   const Matrix biases[])
+{
+  activation_t activations[MLP_SIZE];
+  for(int layer=0; layer<MLP_SIZE; layer++)
+  {
+    activations[layer] = (layer == MLP_SIZE-1) ? softmax : relu;
+  }
+  write_float(path, weights, biases, activations, MLP_SIZE);
+}
+
+
+void bundle::write(const std::string& path, const MlpNetwork& network)
+{
+  const int count = network.get_layer_count();
+  std::vector<Matrix> weights, biases;
+  std::vector<activation_t> activations;
+  for(int layer=0; layer<count; layer++)
+  {
+    weights.push_back(network.get_layer(layer).get_weights());
+    biases.push_back(network.get_layer(layer).get_bias());
+    activations.push_back(network.get_layer(layer).get_activation());
+  }
+  write_float(path, weights.data(), biases.data(), activations.data(),
+              count);
+}
+
+
+void bundle::write(const std::string& path, const QuantizedMlp& network)
+{
+  const std::vector<QuantizedDense>& quantized = network.get_layers();
+  std::vector<bundle_layer> layers(quantized.size());
+  std::vector<std::vector<char>> weights_bytes, biases_bytes;
+  for(size_t layer=0; layer<quantized.size(); layer++)
+  {
+    const QuantizedDense& dense = quantized[layer];
+    memset(&layers[layer], 0, sizeof(bundle_layer));
+    layers[layer].rows = dense.get_rows();
+    layers[layer].cols = dense.get_cols();
+    layers[layer].activation = activation_id(dense.get_activation());
+    layers[layer].dtype = BUNDLE_INT8;
+    const char* weights = (const char*) dense.get_weights();
+    weights_bytes.emplace_back(weights, weights + ((size_t) dense.get_rows())*
+                                                  dense.get_stride());
+
+    //biases, weight scales, input range
+    const quant_range input = dense.get_input_range();
+    std::vector<char> block = float_bytes(dense.get_bias().data(),
+                                          dense.get_rows());
+    const std::vector<char> scales = float_bytes(dense.get_scales().data(),
+                                                 dense.get_rows());
+    block.insert(block.end(), scales.begin(), scales.end());
+    block.insert(block.end(), (const char*) &input,
+                 (const char*) (&input + 1));
+    biases_bytes.push_back(block);
+  }
+  write_file(path, layers, weights_bytes, biases_bytes);
+}
+
+/////////////////////////////////// LOAD //////////////////////////////////////
+
+MlpNetwork bundle::load(const std::string& path, bool verify_payload)
+{
+  const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+  const std::vector<bundle_layer> layers = read_table(*file, verify_payload);
+
+  std::vector<Dense> network;
+  for(size_t layer=0; layer<layers.size(); layer++)
+  {
+    const bundle_layer& entry = layers[layer];
+    if((entry.dtype != BUNDLE_FLOAT32 && entry.dtype != BUNDLE_CSR) ||
+       (layer > 0 && entry.cols != layers[layer-1].rows))
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+    //map_matrix checks the tensors are inside the file
+    const Matrix bias = map_matrix(file, entry.bias_offset, entry.rows,
+                                   ONE_COL);
+    if(entry.dtype == BUNDLE_CSR)
+    {
+      network.emplace_back(read_csr(*file, entry), bias,
+                           activation_func(entry.activation));
+    }
+    else
+    {
+      network.emplace_back(map_matrix(file, entry.weights_offset, entry.rows,
+                                      entry.cols),
+                           bias, activation_func(entry.activation));
+    }
+  }
+  return MlpNetwork(network);
+}
+
+
+QuantizedMlp bundle::load_quantized(const std::string& path,
+                                    bool verify_payload)
+{
+  const std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+  const std::vector<bundle_layer> layers = read_table(*file, verify_payload);
+
+  std::vector<QuantizedDense> quantized;
+  for(const bundle_layer& entry : layers)
+  {
+    const int rows = (int) entry.rows;
+    const int cols = (int) entry.cols;
+    const uint64_t stride = (entry.cols + QUANT_ROW_ALIGN - 1)/
+                            QUANT_ROW_ALIGN*QUANT_ROW_ALIGN;
+    const uint64_t block_size = 2*entry.rows*CELL_SIZE + sizeof(quant_range);
+    if(entry.dtype != BUNDLE_INT8 ||
+       entry.weights_offset > file->size() ||
+       entry.rows*stride > file->size() - entry.weights_offset ||
+       entry.bias_offset > file->size() ||
+       block_size > file->size() - entry.bias_offset)
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+    quant_range input;
+    memcpy(&input, file->data() + entry.bias_offset + 2*entry.rows*CELL_SIZE,
+           sizeof(input));
+    if(!(input.scale > 0) || input.zero_point < 0 ||
+       input.zero_point > QUANT_ACT_MAX)
+    {
+      throw runtime_error(BUNDLE_LAYOUT_ERR_MSG);
+    }
+    const int8_t* weights = (const int8_t*) (file->data() +
+                                             entry.weights_offset);
+    quantized.push_back(QuantizedDense(
+        rows, cols, weights,
+        map_matrix(file, entry.bias_offset + entry.rows*CELL_SIZE, rows,
+                   ONE_COL),
+        map_matrix(file, entry.bias_offset, rows, ONE_COL),
+        activation_func(entry.activation),
+        input, file));
+  }
+  return QuantizedMlp(quantized);
+}
@@ -0,0 +1,150 @@
+// ModelBundle.h
+#ifndef MODELBUNDLE_H
+#define MODELBUNDLE_H
+
+#include "MlpNetwork.h"
+#include "QuantizedMlp.h"
+#include <cstdint>
+#include <string>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define BUNDLE_MAGIC "MLPMODEL"
+#define BUNDLE_MAGIC_SIZE 8
+#define BUNDLE_VERSION 3     // 2 added bundle_layer::dtype, 3 BUNDLE_CSR
+#define BUNDLE_MIN_VERSION 1 // oldest version read, all float32
+#define BUNDLE_BYTE_ORDER 0x01020304U
+#define BUNDLE_ALIGN 64
+#define BUNDLE_FORMAT_ERR_MSG "Not a model bundle"
+#define BUNDLE_VERSION_ERR_MSG "Unsupported model bundle version"
+#define BUNDLE_CRC_ERR_MSG "Model bundle checksum mismatch"
+#define BUNDLE_LAYOUT_ERR_MSG "Model bundle layers don't match the network"
+#define BUNDLE_WRITE_ERR_MSG "Could not write the model bundle"
+#define BUNDLE_ACTIVATION_ERR_MSG "Only relu and softmax layers are bundled"
+
+/**
+ * activation ids stored in a bundle
+ */
+enum bundle_activation : uint32_t
+{
+  BUNDLE_RELU = 0,
+  BUNDLE_SOFTMAX = 1
+};
+
+/**
+ * tensor types stored in a bundle
+ */
+enum bundle_dtype : uint32_t
+{
+  BUNDLE_FLOAT32 = 0,
+  BUNDLE_INT8 = 1,
+  BUNDLE_CSR = 2
+};
+
+/**
+ * @struct bundle_header
+ * @brief First 64 bytes of a bundle file. All fields use the byte order
+ *        of the writer, byte_order tells the reader if it matches.
+ * @var header_crc - CRC32 of the header and layer table, this field as 0
+ * @var payload_crc - CRC32 of every byte after the layer table
+ */
+typedef struct bundle_header
+{
+  char magic[BUNDLE_MAGIC_SIZE];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t layer_count;
+  uint32_t header_crc;
+  uint64_t file_size;
+  uint32_t payload_crc;
+  uint32_t reserved[7];
+} bundle_header;
+
+/**
+ * @struct bundle_layer
+ * @brief One layer table entry, follows the header.
+ *        The offsets are from the file start and BUNDLE_ALIGN aligned.
+ *        BUNDLE_FLOAT32 layers hold rows X cols weights and rows biases.
+ *        BUNDLE_INT8 layers hold rows X QUANT_ROW_ALIGN padded int8 weights,
+ *        and at bias_offset: rows biases, rows weight scales, then the
+ *        quant_range of the layer input.
+ *        BUNDLE_CSR layers hold rows + 1 int32 row starts, nnz int32 column
+ *        indexes and nnz float values, nnz = the last row start, see
+ *        SparseMatrix, and rows float biases.
+ */
+typedef struct bundle_layer
+{
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t activation;
+  uint32_t dtype;
+  uint64_t weights_offset;
+  uint64_t bias_offset;
+} bundle_layer;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A single file holding a whole network:
+ * header | layer table | weights and bias of every layer, each aligned to
+ * BUNDLE_ALIGN bytes. The tensors are row-major floats, so a loaded
+ * bundle is used in place through a file mapping.
+ */
+namespace bundle
+{
+    /**
+    * writes the network of MlpNetwork (relu, relu, relu, softmax) to one
+    * bundle file. the file is written aside and renamed into place, so
+    * readers see either the old file or the complete new one, also after a
+    * crash: both are synced to the disk around the rename. weights with
+    * at least DENSE_SPARSE_THRESHOLD zeros are stored as BUNDLE_CSR
+    * @param path the bundle path
+    * @param weights An array of MLP_SIZE weights matrices
+    * @param biases An array of MLP_SIZE biases vectors
+    */
+    void write(const std::string& path, const Matrix weights[],
+               const Matrix biases[]);
+
+
+    /**
+    * writes a network of any depth, see write
+    * @param path the bundle path
+    * @param network the network, relu and softmax layers only
+    * @throws runtime_error if a layer has another activation
+    */
+    void write(const std::string& path, const MlpNetwork& network);
+
+
+    /**
+    * maps a bundle file, validates it and builds the network over the
+    * mapped tensors without copying them. BUNDLE_CSR layers run on the
+    * sparse kernels, built straight from the mapped arrays
+    * @param path the bundle path
+    * @param verify_payload false skips the payload checksum, so pages are
+    * only read when the network first touches them
+    * @return the network, as deep as the bundle
+    * @throws runtime_error if the file is not a valid bundle of float layers
+    */
+    MlpNetwork load(const std::string& path, bool verify_payload = true);
+
+
+    /**
+    * writes a quantized network to one bundle file, see write
+    * @param path the bundle path
+    * @param network the quantized network
+    */
+    void write(const std::string& path, const QuantizedMlp& network);
+
+
+    /**
+    * maps a bundle of int8 layers, see load. the int8 weights are used in
+    * place, the other tensors are small
+    * @param path the bundle path
+    * @param verify_payload false skips the payload checksum
+    * @return the quantized network
+    * @throws runtime_error if the file is not a valid quantized bundle
+    */
+    QuantizedMlp load_quantized(const std::string& path,
+                                bool verify_payload = true);
+}
+
+#endif //MODELBUNDLE_H
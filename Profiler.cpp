@@ -0,0 +1,405 @@
+#include "Profiler.h"
+#include "MatrixAllocator.h"
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  //bucket bounds of every metric
+  const std::vector<double> SECONDS_BOUNDS = {
+      1e-7, 2.5e-7, 5e-7, 1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3,
+      2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1};
+  const std::vector<double> GFLOPS_BOUNDS = {
+      0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+  const std::vector<double> BYTES_BOUNDS = {
+      0, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216};
+  const std::vector<double> ALLOCS_BOUNDS = {0, 1, 2, 4, 8, 16, 32, 64, 128};
+
+  typedef std::vector<std::pair<std::string, std::string>> label_list;
+
+  /**
+   * one histogram of a metric, for one set of labels
+   */
+  struct series
+  {
+    const char* name;
+    const char* help;
+    label_list labels;
+    Histogram histogram;
+  };
+
+  //layer index, rows, cols and activation name
+  typedef std::tuple<int, int, int, const char*> layer_key;
+
+  /**
+   * every recorded series, in creation order, and where to find them
+   */
+  struct registry
+  {
+    std::mutex mutex;
+    std::vector<series> all;
+    std::map<layer_key, size_t> layer_series; // the seconds one, gflops next
+    size_t call_series = 0; // the seconds one, bytes and allocs next
+    bool has_call_series = false;
+  };
+
+  registry& shared_registry()
+  {
+    static registry instance;
+    return instance;
+  }
+
+
+  /**
+   * @return value as a Prometheus or JSON number
+   */
+  std::string number(double value)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", value);
+    return text;
+  }
+
+
+  /**
+   * @return the labels in the Prometheus form, name="value",...
+   */
+  std::string prometheus_labels(const label_list& labels)
+  {
+    std::string text;
+    for(const std::pair<std::string, std::string>& label : labels)
+    {
+      text += (text.empty() ? "" : ",") + label.first + "=\"" +
+              label.second + "\"";
+    }
+    return text;
+  }
+
+
+  /**
+   * @return hits out of all allocations of stats, 0 before the first one
+   */
+  double hit_rate(const allocator_stats& stats)
+  {
+    const unsigned long total = stats.hits + stats.misses;
+    return total ? ((double) stats.hits)/total : 0;
+  }
+}
+
+//////////////////////////////// HISTOGRAM ////////////////////////////////////
+
+Histogram::Histogram(const std::vector<double>& bounds):
+    _bounds(bounds), _counts(bounds.size() + 1, 0), _sum(0), _count(0)
+{
+}
+
+
+const std::vector<double>& Histogram::get_bounds() const
+{
+  return _bounds;
+}
+
+
+const std::vector<unsigned long>& Histogram::get_counts() const
+{
+  return _counts;
+}
+
+
+unsigned long Histogram::count() const
+{
+  return _count;
+}
+
+
+double Histogram::sum() const
+{
+  return _sum;
+}
+
+
+void Histogram::observe(double value)
+{
+  size_t bucket = 0;
+  while(bucket < _bounds.size() && value > _bounds[bucket])
+  {
+    bucket++;
+  }
+  _counts[bucket]++;
+  _sum += value;
+  _count++;
+}
+
+
+double Histogram::quantile(double q) const
+{
+  if(!(q >= 0 && q <= 1))
+  {
+    throw std::out_of_range(QUANTILE_ERR_MSG);
+  }
+  if(_count == 0)
+  {
+    return 0;
+  }
+  const double rank = q*_count;
+  double below = 0;
+  for(size_t bucket=0; bucket<_bounds.size(); bucket++)
+  {
+    if(below + _counts[bucket] >= rank && _counts[bucket] > 0)
+    {
+      const double lower = (bucket == 0) ? 0 : _bounds[bucket - 1];
+      const double upper = _bounds[bucket];
+      return lower + (upper - lower)*(rank - below)/_counts[bucket];
+    }
+    below += _counts[bucket];
+  }
+  return _bounds.empty() ? 0 : _bounds.back();
+}
+
+//////////////////////////////// RECORDING ////////////////////////////////////
+
+std::atomic<bool> profile::active(false);
+
+
+void profile::set_enabled(bool enabled)
+{
+  active.store(enabled, std::memory_order_relaxed);
+}
+
+
+void profile::reset()
+{
+  registry& reg = shared_registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  reg.all.clear();
+  reg.layer_series.clear();
+  reg.has_call_series = false;
+}
+
+
+alloc_counters& profile::thread_allocs()
+{
+  static thread_local alloc_counters counters = {0, 0};
+  return counters;
+}
+
+
+void profile::record_layer(int index, int rows, int cols, int count,
+                           const char* activation, double seconds)
+{
+  const double gflops = (seconds > 0) ? 2.0*rows*cols*count/(seconds*1e9)
+                                      : 0;
+  registry& reg = shared_registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  const layer_key key(index, rows, cols, activation);
+  auto found = reg.layer_series.find(key);
+  if(found == reg.layer_series.end())
+  {
+    const label_list labels = {{"layer", std::to_string(index)},
+                               {"shape", std::to_string(rows) + "x" +
+                                         std::to_string(cols)},
+                               {"activation", activation}};
+    found = reg.layer_series.emplace(key, reg.all.size()).first;
+    reg.all.push_back(series{"mlp_layer_seconds",
+                             "Wall time of one Dense layer call", labels,
+                             Histogram(SECONDS_BOUNDS)});
+    reg.all.push_back(series{"mlp_layer_gflops",
+                             "Achieved GFLOP/s of one Dense layer call",
+                             labels, Histogram(GFLOPS_BOUNDS)});
+  }
+  reg.all[found->second].histogram.observe(seconds);
+  reg.all[found->second + 1].histogram.observe(gflops);
+}
+
+
+void profile::record_call(double seconds, const alloc_counters& allocs)
+{
+  registry& reg = shared_registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  if(!reg.has_call_series)
+  {
+    reg.call_series = reg.all.size();
+    reg.has_call_series = true;
+    reg.all.push_back(series{"mlp_call_seconds",
+                             "Wall time of one MlpNetwork forward pass", {},
+                             Histogram(SECONDS_BOUNDS)});
+    reg.all.push_back(series{"mlp_call_alloc_bytes",
+                             "Matrix bytes allocated by one forward pass",
+                             {}, Histogram(BYTES_BOUNDS)});
+    reg.all.push_back(series{"mlp_call_allocs",
+                             "Matrix allocations of one forward pass", {},
+                             Histogram(ALLOCS_BOUNDS)});
+  }
+  reg.all[reg.call_series].histogram.observe(seconds);
+  reg.all[reg.call_series + 1].histogram.observe((double) allocs.bytes);
+  reg.all[reg.call_series + 2].histogram.observe((double) allocs.count);
+}
+
+///////////////////////////////// EXPORT //////////////////////////////////////
+
+std::string profile::to_prometheus()
+{
+  registry& reg = shared_registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  //every series of a metric in one group, metrics in creation order
+  std::vector<const char*> names;
+  for(const series& s : reg.all)
+  {
+    bool seen = false;
+    for(const char* name : names)
+    {
+      seen = seen || std::string(name) == s.name;
+    }
+    if(!seen)
+    {
+      names.push_back(s.name);
+    }
+  }
+  std::string text;
+  for(const char* name : names)
+  {
+    bool described = false;
+    for(const series& s : reg.all)
+    {
+      if(std::string(name) != s.name)
+      {
+        continue;
+      }
+      if(!described)
+      {
+        described = true;
+        text += std::string("# HELP ") + s.name + " " + s.help +
+                "\n# TYPE " + s.name + " histogram\n";
+      }
+      const std::string labels = prometheus_labels(s.labels);
+      const std::string prefix = labels.empty() ? "" : labels + ",";
+      const Histogram& hist = s.histogram;
+      unsigned long cumulative = 0;
+      for(size_t bucket=0; bucket<=hist.get_bounds().size(); bucket++)
+      {
+        cumulative += hist.get_counts()[bucket];
+        const std::string le = (bucket < hist.get_bounds().size())
+                               ? number(hist.get_bounds()[bucket]) : "+Inf";
+        text += std::string(s.name) + "_bucket{" + prefix + "le=\"" + le +
+                "\"} " + std::to_string(cumulative) + "\n";
+      }
+      const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+      text += std::string(s.name) + "_sum" + braces + " " +
+              number(hist.sum()) + "\n";
+      text += std::string(s.name) + "_count" + braces + " " +
+              std::to_string(hist.count()) + "\n";
+    }
+  }
+  const allocator_stats alloc = matrix_alloc::get_default().stats();
+  const std::pair<const char*, unsigned long> counters[] = {
+      {"hits", alloc.hits}, {"misses", alloc.misses},
+      {"recycled", alloc.recycled}, {"released", alloc.released}};
+  for(const std::pair<const char*, unsigned long>& counter : counters)
+  {
+    const std::string name = std::string("matrix_alloc_") + counter.first +
+                             "_total";
+    text += "# HELP " + name + " Matrix allocator " + counter.first +
+            "\n# TYPE " + name + " counter\n" + name + " " +
+            std::to_string(counter.second) + "\n";
+  }
+  text += "# HELP matrix_alloc_cached_bytes Free bytes kept for reuse\n"
+          "# TYPE matrix_alloc_cached_bytes gauge\n"
+          "matrix_alloc_cached_bytes " + std::to_string(alloc.cached_bytes) +
+          "\n# HELP matrix_alloc_hit_rate Allocations served from freed "
+          "blocks\n# TYPE matrix_alloc_hit_rate gauge\n"
+          "matrix_alloc_hit_rate " + number(hit_rate(alloc)) + "\n";
+  return text;
+}
+
+
+std::string profile::to_json()
+{
+  registry& reg = shared_registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  std::string text = "{\"metrics\": [";
+  for(size_t index=0; index<reg.all.size(); index++)
+  {
+    const series& s = reg.all[index];
+    const Histogram& hist = s.histogram;
+    text += std::string(index ? "," : "") + "\n  {\"name\": \"" + s.name +
+            "\", \"labels\": {";
+    for(size_t label=0; label<s.labels.size(); label++)
+    {
+      text += std::string(label ? ", " : "") + "\"" + s.labels[label].first +
+              "\": \"" + s.labels[label].second + "\"";
+    }
+    text += "}, \"count\": " + std::to_string(hist.count()) +
+            ", \"sum\": " + number(hist.sum()) +
+            ", \"p50\": " + number(hist.quantile(0.5)) +
+            ", \"p90\": " + number(hist.quantile(0.9)) +
+            ", \"p99\": " + number(hist.quantile(0.99)) + ", \"buckets\": [";
+    for(size_t bucket=0; bucket<=hist.get_bounds().size(); bucket++)
+    {
+      const std::string le = (bucket < hist.get_bounds().size())
+                             ? number(hist.get_bounds()[bucket]) : "\"+Inf\"";
+      text += std::string(bucket ? ", " : "") + "{\"le\": " + le +
+              ", \"count\": " + std::to_string(hist.get_counts()[bucket]) +
+              "}";
+    }
+    text += "]}";
+  }
+  const allocator_stats alloc = matrix_alloc::get_default().stats();
+  text += "\n], \"allocator\": {\"hits\": " + std::to_string(alloc.hits) +
+          ", \"misses\": " + std::to_string(alloc.misses) +
+          ", \"recycled\": " + std::to_string(alloc.recycled) +
+          ", \"released\": " + std::to_string(alloc.released) +
+          ", \"cached_bytes\": " + std::to_string(alloc.cached_bytes) +
+          ", \"hit_rate\": " + number(hit_rate(alloc)) + "}}\n";
+  return text;
+}
+
+////////////////////////////////// SCOPES /////////////////////////////////////
+
+profile::layer_scope::layer_scope(int index, int rows, int cols, int count,
+                                  const char* activation):
+    _on(enabled()), _index(index), _rows(rows), _cols(cols), _count(count),
+    _activation(activation)
+{
+  if(_on)
+  {
+    _start = profile_clock::now();
+  }
+}
+
+
+profile::layer_scope::~layer_scope()
+{
+  if(_on)
+  {
+    record_layer(_index, _rows, _cols, _count, _activation,
+                 std::chrono::duration<double>(profile_clock::now() -
+                                               _start).count());
+  }
+}
+
+
+profile::call_scope::call_scope(): _on(enabled()), _allocs{0, 0}
+{
+  if(_on)
+  {
+    _allocs = thread_allocs();
+    _start = profile_clock::now();
+  }
+}
+
+
+profile::call_scope::~call_scope()
+{
+  if(_on)
+  {
+    const double seconds = std::chrono::duration<double>(
+        profile_clock::now() - _start).count();
+    const alloc_counters& now = thread_allocs();
+    record_call(seconds, alloc_counters{now.bytes - _allocs.bytes,
+                                        now.count - _allocs.count});
+  }
+}
@@ -0,0 +1,216 @@
+// Profiler.h
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define QUANTILE_ERR_MSG "A quantile must be from 0 to 1"
+
+typedef std::chrono::steady_clock profile_clock;
+
+/**
+ * @struct alloc_counters
+ * @brief Matrix storage allocated by one thread while profiling is on.
+ */
+typedef struct alloc_counters
+{
+  unsigned long bytes;
+  unsigned long count;
+} alloc_counters;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A histogram over fixed bucket bounds, in the Prometheus layout: bucket i
+ * counts the values <= bounds[i], the last bucket the values above all of
+ * them.
+ */
+class Histogram
+{
+ public:
+  //constructor
+  /**
+   * @param bounds the increasing upper bounds of the buckets
+   */
+  explicit Histogram(const std::vector<double>& bounds);
+
+  //getters
+  /**
+   * @returns the upper bounds of the buckets, without the last one
+   */
+  const std::vector<double>& get_bounds() const;
+
+  /**
+   * @returns the values in every bucket, bounds size + 1 of them, not
+   * cumulative
+   */
+  const std::vector<unsigned long>& get_counts() const;
+
+  /**
+   * @returns the number of values
+   */
+  unsigned long count() const;
+
+  /**
+   * @returns the sum of the values
+   */
+  double sum() const;
+
+  //methods
+  /**
+   * adds a value
+   */
+  void observe(double value);
+
+  /**
+   * estimates a quantile, linear inside its bucket
+   * @param q the quantile, e.g 0.99
+   * @return the estimate, 0 with no values; the largest bound if it falls
+   * in the last bucket
+   * @throws out_of_range if q is not from 0 to 1
+   */
+  double quantile(double q) const;
+
+ private:
+  std::vector<double> _bounds;
+  std::vector<unsigned long> _counts;
+  double _sum;
+  unsigned long _count;
+};
+
+
+/**
+ * Opt-in instrumentation of the inference path. While it is off, every hook
+ * costs one relaxed atomic load. While it is on, MlpNetwork records:
+ *   mlp_layer_seconds      wall time of every Dense layer call
+ *   mlp_layer_gflops       GFLOP/s of every Dense layer call, 2 per
+ *                          multiply-add of its product
+ *   mlp_call_seconds       wall time of every forward pass
+ *   mlp_call_alloc_bytes   Matrix bytes allocated by the calling thread
+ *                          during a forward pass
+ *   mlp_call_allocs        Matrix allocations of the same
+ * layer series are labeled by layer index, shape and activation. a parallel
+ * batch records one forward pass per chunk. both exports end with the
+ * stats of the default Matrix allocator, matrix_alloc_* and its hit rate.
+ */
+namespace profile
+{
+    extern std::atomic<bool> active;
+
+    /**
+     * @return true while profiling is on
+     */
+    inline bool enabled()
+    {
+      return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * turns profiling on or off, off by default. the recorded histograms
+     * are kept either way
+     */
+    void set_enabled(bool enabled);
+
+    /**
+     * drops every recorded histogram
+     */
+    void reset();
+
+    /**
+     * @return the Matrix allocations of the calling thread since profiling
+     * was first turned on in it
+     */
+    alloc_counters& thread_allocs();
+
+    /**
+     * counts a Matrix storage allocation of the calling thread
+     * @param bytes the allocation size
+     */
+    inline void record_alloc(size_t bytes)
+    {
+      if(enabled())
+      {
+        alloc_counters& counters = thread_allocs();
+        counters.bytes += bytes;
+        counters.count++;
+      }
+    }
+
+    /**
+     * records one Dense layer call, see the metrics above
+     * @param index the layer index in its network
+     * @param rows the layer outputs
+     * @param cols the layer inputs
+     * @param count the inputs of the call, batch columns
+     * @param activation the activation name
+     * @param seconds the wall time of the call
+     */
+    void record_layer(int index, int rows, int cols, int count,
+                      const char* activation, double seconds);
+
+    /**
+     * records one forward pass, see the metrics above
+     */
+    void record_call(double seconds, const alloc_counters& allocs);
+
+    /**
+     * @return every histogram in the Prometheus text exposition format
+     */
+    std::string to_prometheus();
+
+    /**
+     * @return every histogram as a JSON object, with its count, sum,
+     * p50/p90/p99 estimates and buckets
+     */
+    std::string to_json();
+
+
+    /**
+     * times a Dense layer call, from construction to destruction, when
+     * profiling is on at construction
+     */
+    class layer_scope
+    {
+     public:
+      layer_scope(int index, int rows, int cols, int count,
+                  const char* activation);
+      ~layer_scope();
+
+      layer_scope(const layer_scope&) = delete;
+      layer_scope& operator=(const layer_scope&) = delete;
+
+     private:
+      bool _on;
+      int _index, _rows, _cols, _count;
+      const char* _activation;
+      profile_clock::time_point _start;
+    };
+
+
+    /**
+     * times a forward pass and counts its allocations, from construction
+     * to destruction, when profiling is on at construction
+     */
+    class call_scope
+    {
+     public:
+      call_scope();
+      ~call_scope();
+
+      call_scope(const call_scope&) = delete;
+      call_scope& operator=(const call_scope&) = delete;
+
+     private:
+      bool _on;
+      alloc_counters _allocs;
+      profile_clock::time_point _start;
+    };
+}
+
+#endif //PROFILER_H
@@ -0,0 +1,411 @@
+#include "QuantizedMlp.h"
+#include "Kernels.h"
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define QUANT_CLAMP 256.0F        // past any zero_point + QUANT_ACT_MAX
+#define QUANT_ROUND 12582912.0F   // 1.5*2^23, floats past it are integers
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  /**
+   * @return cols rounded up to QUANT_ROW_ALIGN
+   */
+  int row_stride(int cols)
+  {
+    return (cols + QUANT_ROW_ALIGN - 1)/QUANT_ROW_ALIGN*QUANT_ROW_ALIGN;
+  }
+
+
+  /**
+   * @return x quantized into [0, QUANT_ACT_MAX]
+   */
+  inline uint8_t quantize_value(float x, float inv_scale, int32_t zero_point)
+  {
+    //zero_point is in [0, QUANT_ACT_MAX], so clamping into +-QUANT_CLAMP
+    //first keeps the result, NaN included, and lets adding and taking off
+    //QUANT_ROUND round to nearest even like lrint, without a libm call
+    float v = x*inv_scale;
+    v = (v >= -QUANT_CLAMP) ? v : -QUANT_CLAMP;
+    v = (v <= QUANT_CLAMP) ? v : QUANT_CLAMP;
+    const int32_t q = (int32_t) ((v + QUANT_ROUND) - QUANT_ROUND) + zero_point;
+    return (uint8_t) ((q < 0) ? 0 : (q > QUANT_ACT_MAX) ? QUANT_ACT_MAX : q);
+  }
+
+
+  /**
+   * @return the range of all values of mat, widened to hold zero
+   */
+  quant_range calibrated_range(const Matrix& mat)
+  {
+    const float* coords = mat.data();
+    float min = 0, max = 0;
+    for(int index=0; index<mat.get_rows()*mat.get_cols(); index++)
+    {
+      min = (coords[index] < min) ? coords[index] : min;
+      max = (coords[index] > max) ? coords[index] : max;
+    }
+    quant_range range;
+    range.scale = (max > min) ? (max - min)/QUANT_ACT_MAX : 1.0F;
+    range.zero_point = (int32_t) std::lrint(-min/range.scale);
+    return range;
+  }
+
+
+  /**
+   * throws unless activation_func is one a quantized layer runs
+   */
+  void check_activation(activation_t activation_func)
+  {
+    if(activation_func != activation::relu &&
+       activation_func != activation::softmax)
+    {
+      throw runtime_error(QUANT_ACTIVATION_ERR_MSG);
+    }
+  }
+
+
+  /**
+   * @return the sum of every weights row
+   */
+  std::vector<int32_t> row_sums(const int8_t* weights, int rows, int stride)
+  {
+    std::vector<int32_t> sums(rows, 0);
+    for(int row=0; row<rows; row++)
+    {
+      for(int p=0; p<stride; p++)
+      {
+        sums[row] += weights[row*stride + p];
+      }
+    }
+    return sums;
+  }
+
+
+  /**
+   * @return the digit of one column of a network output
+   */
+  digit column_digit(const Matrix& output, int col)
+  {
+    const float* coords = output.data();
+    const int cols = output.get_cols();
+    int max_row = 0;
+    for(int row=1; row<output.get_rows(); row++)
+    {
+      if(coords[row*cols + col] > coords[max_row*cols + col])
+      {
+        max_row = row;
+      }
+    }
+    return digit{(unsigned int) max_row, coords[max_row*cols + col]};
+  }
+}
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+QuantizedDense::QuantizedDense(const Dense& layer, quant_range input):
+    _rows(layer.get_weights().get_rows()),
+    _cols(layer.get_weights().get_cols()), _stride(row_stride(_cols)),
+    _weights(nullptr), _scales(_rows, ONE_COL), _bias(layer.get_bias()),
+    _activation_func(layer.get_activation()), _input(input)
+{
+  check_activation(_activation_func);
+  std::shared_ptr<std::vector<int8_t>> weights =
+      std::make_shared<std::vector<int8_t>>(((size_t) _rows)*_stride, 0);
+  const float* coords = layer.get_weights().data();
+  for(int row=0; row<_rows; row++)
+  {
+    //symmetric per row, the largest weight maps to QUANT_WEIGHT_MAX
+    const float* w_row = coords + row*_cols;
+    float max = 0;
+    for(int p=0; p<_cols; p++)
+    {
+      max = (std::fabs(w_row[p]) > max) ? std::fabs(w_row[p]) : max;
+    }
+    const float scale = (max > 0) ? max/QUANT_WEIGHT_MAX : 1.0F;
+    for(int p=0; p<_cols; p++)
+    {
+      (*weights)[row*_stride + p] = (int8_t) std::lrint(w_row[p]/scale);
+    }
+    _scales[row] = scale;
+  }
+  _weights = weights->data();
+  _owner = weights;
+  _row_sums = row_sums(_weights, _rows, _stride);
+}
+
+
+QuantizedDense::QuantizedDense(int rows, int cols, const int8_t* weights,
+                               const Matrix& scales, const Matrix& bias,
+                               activation_t activation_func,
+                               quant_range input,
+                               std::shared_ptr<const void> owner):
+    _rows(rows), _cols(cols), _stride(row_stride(cols)),
+    _owner(std::move(owner)), _weights(weights),
+    _row_sums(row_sums(weights, rows, _stride)), _scales(scales),
+    _bias(bias), _activation_func(activation_func), _input(input)
+{
+  check_activation(_activation_func);
+  if(scales.get_rows() != rows || scales.get_cols() != ONE_COL ||
+     bias.get_rows() != rows || bias.get_cols() != ONE_COL)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+}
+
+
+QuantizedMlp::QuantizedMlp(const std::vector<QuantizedDense>& layers):
+    _layers(layers)
+{
+  if(_layers.empty())
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  for(size_t index=1; index<_layers.size(); index++)
+  {
+    if(_layers[index-1].get_rows() != _layers[index].get_cols())
+    {
+      throw length_error(WEIGHT_SIZE_ERR_MSG);
+    }
+  }
+}
+
+
+QuantizedMlp QuantizedMlp::calibrate(const MlpNetwork& network,
+                                     const Matrix& samples)
+{
+  if(samples.get_rows() != network.get_layer(0).get_weights().get_cols())
+  {
+    throw length_error(QUANT_SAMPLES_ERR_MSG);
+  }
+  //every layer input range is measured on the float outputs before it
+  std::vector<QuantizedDense> layers;
+  Matrix input = samples;
+  Matrix output;
+  for(int index=0; index<network.get_layer_count(); index++)
+  {
+    const Dense& layer = network.get_layer(index);
+    layers.push_back(QuantizedDense(layer, calibrated_range(input)));
+    layer(input, output);
+    std::swap(input, output);
+  }
+  return QuantizedMlp(layers);
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+int QuantizedDense::get_rows() const
+{
+  return _rows;
+}
+
+
+int QuantizedDense::get_cols() const
+{
+  return _cols;
+}
+
+
+int QuantizedDense::get_stride() const
+{
+  return _stride;
+}
+
+
+const int8_t* QuantizedDense::get_weights() const
+{
+  return _weights;
+}
+
+
+const Matrix& QuantizedDense::get_scales() const
+{
+  return _scales;
+}
+
+
+const Matrix& QuantizedDense::get_bias() const
+{
+  return _bias;
+}
+
+
+activation_t QuantizedDense::get_activation() const
+{
+  return _activation_func;
+}
+
+
+quant_range QuantizedDense::get_input_range() const
+{
+  return _input;
+}
+
+
+const std::vector<QuantizedDense>& QuantizedMlp::get_layers() const
+{
+  return _layers;
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+void QuantizedDense::quantize(const float* input, int count,
+                              std::vector<uint8_t>& q) const
+{
+  q.assign(((size_t) count)*_stride, 0);
+  const float inv_scale = 1/_input.scale;
+  if(count == ONE_COL)
+  {
+    for(int p=0; p<_cols; p++)
+    {
+      q[p] = quantize_value(input[p], inv_scale, _input.zero_point);
+    }
+    return;
+  }
+  //one input coordinate of every input quantized in a contiguous pass, then
+  //spread to where each input keeps it
+  static thread_local std::vector<uint8_t> row;
+  row.resize(count);
+  uint8_t* row_q = row.data();
+  for(int p=0; p<_cols; p++)
+  {
+    const float* in_row = input + ((long) p)*count;
+    for(int col=0; col<count; col++)
+    {
+      row_q[col] = quantize_value(in_row[col], inv_scale, _input.zero_point);
+    }
+    uint8_t* q_col = q.data() + p;
+    for(int col=0; col<count; col++)
+    {
+      q_col[((long) col)*_stride] = row_q[col];
+    }
+  }
+}
+
+
+void QuantizedDense::operator()(const uint8_t* q, int count,
+                                Matrix& output) const
+{
+  const kernel_table& table = kernels::active();
+  output.resize(_rows, count);
+  float* coords = output.data();
+  const float* scales = _scales.data();
+  const float* bias = _bias.data();
+  const bool relu = (_activation_func == activation::relu);
+  //every q*w product in int32 tiles, then dequantized row after row
+  static thread_local std::vector<int32_t> acc;
+  acc.resize(((size_t) _rows)*count);
+  table.gemm_u8s8(_rows, count, _stride, _weights, _stride, q, _stride,
+                  acc.data(), count);
+  for(int row=0; row<_rows; row++)
+  {
+    //sum((q - zero_point)*w) = sum(q*w) - zero_point*sum(w)
+    const int32_t shift = _input.zero_point*_row_sums[row];
+    const float scale = scales[row]*_input.scale;
+    const float row_bias = bias[row];
+    const int32_t* acc_row = acc.data() + ((long) row)*count;
+    float* out_row = coords + ((long) row)*count;
+    for(int col=0; col<count; col++)
+    {
+      out_row[col] = (acc_row[col] - shift)*scale + row_bias;
+    }
+    if(relu)
+    {
+      for(int col=0; col<count; col++)
+      {
+        out_row[col] = (out_row[col] <= 0) ? 0 : out_row[col];
+      }
+    }
+  }
+  if(!relu)
+  {
+    activation::softmax_cols_in_place(output);
+  }
+}
+
+
+digit QuantizedMlp::classify(const Matrix& image, quant_workspace& workspace)
+const
+{
+  if(image.get_rows()*image.get_cols() != _layers[0].get_cols())
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  forward(image.data(), ONE_COL, workspace);
+  return column_digit(workspace.output, 0);
+}
+
+
+std::vector<digit> QuantizedMlp::classify_batch(const Matrix& images) const
+{
+  if(images.get_rows() != _layers[0].get_cols())
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  quant_workspace workspace;
+  forward(images.data(), images.get_cols(), workspace);
+  std::vector<digit> digits;
+  digits.reserve(images.get_cols());
+  for(int col=0; col<images.get_cols(); col++)
+  {
+    digits.push_back(column_digit(workspace.output, col));
+  }
+  return digits;
+}
+
+
+quant_report QuantizedMlp::compare(const MlpNetwork& network,
+                                   const Matrix& images) const
+{
+  //the full softmax probabilities, whatever mode the network is in: the
+  //other modes report NAN or top-k renormalized ones
+  std::vector<digit> expected;
+  if(network.get_output_mode() == OUTPUT_DISTRIBUTION)
+  {
+    expected = network.classify_batch(images, ThreadPool::shared());
+  }
+  else
+  {
+    MlpNetwork distribution = network;
+    distribution.set_output_mode(OUTPUT_DISTRIBUTION);
+    expected = distribution.classify_batch(images, ThreadPool::shared());
+  }
+  const std::vector<digit> actual = classify_batch(images);
+  quant_report report = {(int) expected.size(), 1.0F, 0.0F, 0.0F};
+  int agreed = 0;
+  double diff_sum = 0;
+  for(size_t index=0; index<expected.size(); index++)
+  {
+    if(expected[index].value != actual[index].value)
+    {
+      continue;
+    }
+    const float diff = std::fabs(expected[index].probability -
+                                 actual[index].probability);
+    report.max_prob_diff = (diff > report.max_prob_diff) ?
+                           diff : report.max_prob_diff;
+    diff_sum += diff;
+    agreed++;
+  }
+  if(report.samples > 0)
+  {
+    report.agreement = ((float) agreed)/report.samples;
+  }
+  if(agreed > 0)
+  {
+    report.mean_prob_diff = (float) (diff_sum/agreed);
+  }
+  return report;
+}
+
+
+void QuantizedMlp::forward(const float* images, int count,
+                           quant_workspace& workspace) const
+{
+  for(const QuantizedDense& layer : _layers)
+  {
+    layer.quantize(images, count, workspace.input);
+    layer(workspace.input.data(), count, workspace.output);
+    images = workspace.output.data();
+  }
+}
@@ -0,0 +1,237 @@
+// QuantizedMlp.h
+#ifndef QUANTIZEDMLP_H
+#define QUANTIZEDMLP_H
+
+#include "MlpNetwork.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define QUANT_WEIGHT_MAX 127 // int8 weights use [-127, 127]
+#define QUANT_ACT_MAX 127    // activations use 7 bits, see dot_u8s8
+#define QUANT_ROW_ALIGN 64   // int8 weight rows are padded to this many bytes
+#define QUANT_ACTIVATION_ERR_MSG "Only relu and softmax layers are quantized"
+#define QUANT_SAMPLES_ERR_MSG "Calibration samples don't match the network"
+
+/**
+ * @struct quant_range
+ * @brief Affine quantization of a layer input, an input x is stored as
+ *        q = round(x/scale) + zero_point, clamped to [0, QUANT_ACT_MAX]
+ */
+typedef struct quant_range
+{
+  float scale;
+  int32_t zero_point;
+} quant_range;
+
+/**
+ * @struct quant_report
+ * @brief Agreement of a quantized network with the float network it was
+ *        calibrated from, over the same images.
+ * @var samples - number of images compared
+ * @var agreement - fraction of images with the same digit
+ * @var mean_prob_diff - mean |probability difference| of agreeing digits
+ * @var max_prob_diff - largest |probability difference| of agreeing digits
+ */
+typedef struct quant_report
+{
+  int samples;
+  float agreement;
+  float mean_prob_diff;
+  float max_prob_diff;
+} quant_report;
+
+/**
+ * @struct quant_workspace
+ * @brief Scratch buffers of one quantized network activation, each thread
+ *        needs its own.
+ */
+typedef struct quant_workspace
+{
+  std::vector<uint8_t> input;
+  Matrix output;
+} quant_workspace;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A Dense layer with int8 weights, quantized per output channel (row), run
+ * on 7 bit inputs with 32 bit accumulation. Only relu and softmax layers.
+ */
+class QuantizedDense
+{
+ public:
+  //constructors
+  /**
+   * quantizes a float layer, every weights row gets the scale
+   * max(|row|)/QUANT_WEIGHT_MAX
+   * @param layer a relu or softmax layer
+   * @param input the calibrated range of the layer inputs
+   * @throws runtime_error for any other activation
+   */
+  QuantizedDense(const Dense& layer, quant_range input);
+
+  /**
+   * builds a layer over stored tensors, no weight is copied
+   * @param rows num of rows
+   * @param cols num of cols
+   * @param weights rows X get_stride() int8 weights, zero padded
+   * @param scales the weight scale of every row, a Vector
+   * @param bias a Vector
+   * @param activation_func relu or softmax
+   * @param input the range of the layer inputs
+   * @param owner keeps weights alive, may be empty
+   */
+  QuantizedDense(int rows, int cols, const int8_t* weights,
+                 const Matrix& scales, const Matrix& bias,
+                 activation_t activation_func, quant_range input,
+                 std::shared_ptr<const void> owner);
+
+  //getters
+  /**
+   * @returns the number of outputs
+   */
+  int get_rows() const;
+
+  /**
+   * @returns the number of inputs
+   */
+  int get_cols() const;
+
+  /**
+   * @return bytes between two weights rows, cols rounded up to
+   * QUANT_ROW_ALIGN
+   */
+  int get_stride() const;
+
+  /**
+   * @returns the int8 weights, get_rows() X get_stride()
+   */
+  const int8_t* get_weights() const;
+
+  /**
+   * @returns the weight scale of every row
+   */
+  const Matrix& get_scales() const;
+
+  /**
+   * @returns the bias Matrix object
+   */
+  const Matrix& get_bias() const;
+
+  /**
+   * @returns the activation function
+   */
+  activation_t get_activation() const;
+
+  /**
+   * @returns the range the inputs are quantized into
+   */
+  quant_range get_input_range() const;
+
+  //methods
+  /**
+   * quantizes float inputs into the layer input range
+   * @param input get_cols() X count row-major floats, one column per input
+   * @param count number of inputs
+   * @param q resized to count X get_stride() bytes, one input after the
+   * other
+   */
+  void quantize(const float* input, int count, std::vector<uint8_t>& q)
+  const;
+
+  /**
+   * activate the layer on quantized inputs
+   * @param q count inputs from quantize
+   * @param count number of inputs
+   * @param output resized to get_rows() X count, one column per input
+   */
+  void operator()(const uint8_t* q, int count, Matrix& output) const;
+
+ private:
+  int _rows;
+  int _cols;
+  int _stride;
+  std::shared_ptr<const void> _owner;
+  const int8_t* _weights;
+  std::vector<int32_t> _row_sums; // sum of every weights row, for zero_point
+  Matrix _scales;
+  Matrix _bias;
+  activation_t _activation_func;
+  quant_range _input;
+};
+
+
+/**
+ * int8 counterpart of MlpNetwork. Built offline from a float network and a
+ * sample of images, stored in a model bundle and loaded with
+ * bundle::load_quantized.
+ */
+class QuantizedMlp
+{
+ public:
+  //constructors
+  /**
+   * @param layers the quantized layers, first to last
+   */
+  explicit QuantizedMlp(const std::vector<QuantizedDense>& layers);
+
+  /**
+   * quantizes a network. the input range of every layer is the range of
+   * values it gets over the samples, zero included
+   * @param network the float network
+   * @param samples calibration images, one per column
+   * @return the quantized network
+   * @throws length_error if the samples don't fit the network
+   */
+  static QuantizedMlp calibrate(const MlpNetwork& network,
+                                const Matrix& samples);
+
+  //getters
+  /**
+   * @returns the layers, first to last
+   */
+  const std::vector<QuantizedDense>& get_layers() const;
+
+  //methods
+  /**
+   * activate the network, safe to call from many threads at once
+   * @param image A Matrix object, read as a long vector
+   * @param workspace scratch buffers owned by the calling thread
+   * @return A digit struct, with the result number and score
+   */
+  digit classify(const Matrix& image, quant_workspace& workspace) const;
+
+  /**
+   * activate the network on a batch of images
+   * @param images A Matrix object, every column is one vectorized image
+   * @return A digit struct for every column, in the same order
+   */
+  std::vector<digit> classify_batch(const Matrix& images) const;
+
+  /**
+   * classifies images with both networks, to check the quantization
+   * before rolling it out
+   * @param network the float network, read as OUTPUT_DISTRIBUTION whatever
+   * its output mode
+   * @param images one image per column
+   * @return how far the two networks agree
+   */
+  quant_report compare(const MlpNetwork& network, const Matrix& images)
+  const;
+
+ private:
+  std::vector<QuantizedDense> _layers;
+
+  /**
+   * runs all layers, the result is left in workspace.output
+   * @param images one image per column, see QuantizedDense::quantize
+   * @param count number of images
+   * @param workspace the scratch buffers
+   */
+  void forward(const float* images, int count, quant_workspace& workspace)
+  const;
+};
+
+#endif //QUANTIZEDMLP_H
@@ -0,0 +1,291 @@
+#include "SparseMatrix.h"
+#include "Gemm.h"
+#include "ThreadPool.h"
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using linalg::vec_t;
+
+//////////////////////////////// HELPERS //////////////////////////////////////
+namespace
+{
+  /**
+   * @return the sum of values[index]*x[cols[index]] for index in
+   * [first, last), gathered a full register at a time when the target can
+   */
+  inline float gather_dot(const float* values, const int32_t* cols,
+                          int32_t first, int32_t last, const float* x)
+  {
+    int32_t index = first;
+    float sum = 0.0F;
+#if defined(__AVX512F__)
+    //masked forms, the unmasked ones read an undefined source register
+    __m512 acc = _mm512_setzero_ps();
+    for(; index + 16 <= last; index += 16)
+    {
+      const __m512i offsets = _mm512_loadu_si512(cols + index);
+      const __m512 gathered = _mm512_mask_i32gather_ps(
+          _mm512_setzero_ps(), (__mmask16) 0xFFFF, offsets, x, sizeof(float));
+      acc = _mm512_fmadd_ps(_mm512_loadu_ps(values + index), gathered, acc);
+    }
+    float lanes[16];
+    _mm512_storeu_ps(lanes, acc);
+#elif defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+    for(; index + 8 <= last; index += 8)
+    {
+      const __m256i offsets = _mm256_loadu_si256((const __m256i*)
+                                                 (cols + index));
+      const __m256 gathered = _mm256_i32gather_ps(x, offsets, sizeof(float));
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(values + index),
+                                             gathered));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+#endif
+#if defined(__AVX512F__) || defined(__AVX2__)
+    for(float lane : lanes)
+    {
+      sum += lane;
+    }
+#endif
+    //two sums to overlap the dependent adds
+    float sums[2] = {sum, 0.0F};
+    for(; index + 2 <= last; index += 2)
+    {
+      sums[0] += values[index]*x[cols[index]];
+      sums[1] += values[index + 1]*x[cols[index + 1]];
+    }
+    if(index < last)
+    {
+      sums[0] += values[index]*x[cols[index]];
+    }
+    return sums[0] + sums[1];
+  }
+}
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+SparseMatrix::SparseMatrix(const Matrix& mat):
+    _rows(mat.get_rows()), _cols(mat.get_cols()), _row_starts(_rows + 1, 0)
+{
+  const float* coords = mat.data();
+  for(int row=0; row<_rows; row++)
+  {
+    for(int col=0; col<_cols; col++)
+    {
+      const float value = coords[row*_cols + col];
+      if(value != 0)
+      {
+        _col_indexes.push_back(col);
+        _values.push_back(value);
+      }
+    }
+    _row_starts[row + 1] = (int32_t) _values.size();
+  }
+}
+
+
+SparseMatrix::SparseMatrix(int rows, int cols, const int32_t* row_starts,
+                           const int32_t* col_indexes, const float* values,
+                           int32_t nonzeros):
+    _rows(rows), _cols(cols)
+{
+  if(rows <= 0 || cols <= 0)
+  {
+    throw length_error(LEN_ERR_MSG);
+  }
+  if(nonzeros < 0 || row_starts[0] != 0 || row_starts[rows] != nonzeros)
+  {
+    throw runtime_error(CSR_ERR_MSG);
+  }
+  _row_starts.assign(row_starts, row_starts + rows + 1);
+  _col_indexes.assign(col_indexes, col_indexes + nonzeros);
+  _values.assign(values, values + nonzeros);
+  for(int row=0; row<rows; row++)
+  {
+    if(_row_starts[row] > _row_starts[row + 1])
+    {
+      throw runtime_error(CSR_ERR_MSG);
+    }
+    for(int32_t index=_row_starts[row]; index<_row_starts[row + 1]; index++)
+    {
+      const bool increasing = (index == _row_starts[row] ||
+                               _col_indexes[index] > _col_indexes[index - 1]);
+      if(_col_indexes[index] < 0 || _col_indexes[index] >= cols ||
+         !increasing)
+      {
+        throw runtime_error(CSR_ERR_MSG);
+      }
+    }
+  }
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+int SparseMatrix::get_rows() const
+{
+  return _rows;
+}
+
+
+int SparseMatrix::get_cols() const
+{
+  return _cols;
+}
+
+
+int SparseMatrix::nonzeros() const
+{
+  return (int) _values.size();
+}
+
+
+float SparseMatrix::sparsity() const
+{
+  return 1 - ((float) _values.size())/(((float) _rows)*_cols);
+}
+
+
+const std::vector<int32_t>& SparseMatrix::get_row_starts() const
+{
+  return _row_starts;
+}
+
+
+const std::vector<int32_t>& SparseMatrix::get_col_indexes() const
+{
+  return _col_indexes;
+}
+
+
+const std::vector<float>& SparseMatrix::get_values() const
+{
+  return _values;
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+Matrix SparseMatrix::to_dense() const
+{
+  Matrix mat(_rows, _cols);
+  float* coords = mat.data();
+  for(int row=0; row<_rows; row++)
+  {
+    for(int32_t index=_row_starts[row]; index<_row_starts[row + 1]; index++)
+    {
+      coords[row*_cols + _col_indexes[index]] = _values[index];
+    }
+  }
+  return mat;
+}
+
+
+void SparseMatrix::multiply(const MatrixView& rhs, Matrix& output) const
+{
+  if(rhs.get_rows() != _cols)
+  {
+    throw length_error(MAT_MULT_ERR_MSG);
+  }
+  const int n = rhs.get_cols();
+  output.resize(_rows, n);
+  //a vector is gathered from, it has to be contiguous
+  static thread_local std::vector<float> scratch;
+  const MatrixView b_view = (n == ONE_COL) ? rhs.contiguous(scratch)
+                                           : rhs.with_contiguous_rows(scratch);
+  multiply_block(n, b_view.data(), b_view.get_row_stride(), output.data(),
+                 n);
+}
+
+
+void SparseMatrix::multiply_block(int n, const float* b, int ldb, float* c,
+                                  int ldc) const
+{
+  ThreadPool& pool = ThreadPool::shared();
+  if(((long) nonzeros())*n < linalg::parallel_threshold() ||
+     pool.size() == 1 || ThreadPool::in_parallel())
+  {
+    multiply_rows(0, _rows, n, b, ldb, c, ldc);
+    return;
+  }
+  pool.parallel_for(_rows, SPARSE_ROW_GRAIN, [&](int begin, int end, int)
+  {
+    multiply_rows(begin, end, n, b, ldb, c, ldc);
+  });
+}
+
+
+void SparseMatrix::multiply_rows(int begin, int end, int n, const float* b,
+                                 int ldb, float* c, int ldc) const
+{
+  const int32_t* cols = _col_indexes.data();
+  const float* values = _values.data();
+  if(n == ONE_COL)
+  {
+    for(int row=begin; row<end; row++)
+    {
+      c[((long) row)*ldc] = gather_dot(values, cols, _row_starts[row],
+                                       _row_starts[row + 1], b);
+    }
+    return;
+  }
+  //every nonzero scales one row of b, a tile of c rows stays in registers
+  const int n_main = n - (n % SPARSE_NR);
+  for(int row=begin; row<end; row++)
+  {
+    const int32_t first = _row_starts[row], last = _row_starts[row + 1];
+    float* c_row = c + ((long) row)*ldc;
+    for(int j=0; j<n_main; j+=SPARSE_NR)
+    {
+      vec_t acc[SPARSE_NR/VEC_WIDTH] = {};
+      for(int32_t index=first; index<last; index++)
+      {
+        const float* b_row = b + ((long) cols[index])*ldb + j;
+        for(int t=0; t<SPARSE_NR/VEC_WIDTH; t++)
+        {
+          vec_t b_vec;
+          memcpy(&b_vec, b_row + t*VEC_WIDTH, sizeof(b_vec));
+          acc[t] += values[index]*b_vec;
+        }
+      }
+      memcpy(c_row + j, acc, sizeof(acc));
+    }
+    for(int j=n_main; j<n; j++)
+    {
+      float sum = 0.0F;
+      for(int32_t index=first; index<last; index++)
+      {
+        sum += values[index]*b[((long) cols[index])*ldb + j];
+      }
+      c_row[j] = sum;
+    }
+  }
+}
+
+
+void SparseMatrix::multiply_u8t(const uint8_t* bt, int count,
+                                Matrix& output) const
+{
+  output.resize(_rows, count);
+  float* c = output.data();
+  //a cols X SPARSE_U8_COLS float block, column j the input img + j
+  static thread_local std::vector<float> block;
+  for(int img=0; img<count; img+=SPARSE_U8_COLS)
+  {
+    const int n = (count - img < SPARSE_U8_COLS) ? count - img
+                                                 : SPARSE_U8_COLS;
+    block.resize(((size_t) _cols)*n);
+    for(int j=0; j<n; j++)
+    {
+      const uint8_t* x = bt + ((long) (img + j))*_cols;
+      for(int col=0; col<_cols; col++)
+      {
+        block[((long) col)*n + j] = x[col];
+      }
+    }
+    multiply_block(n, block.data(), n, c + img, count);
+  }
+}
@@ -0,0 +1,136 @@
+// SparseMatrix.h
+#ifndef SPARSEMATRIX_H
+#define SPARSEMATRIX_H
+
+#include "Gemm.h"
+#include "Matrix.h"
+#include <cstdint>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define SPARSE_ROW_GRAIN 8 // fewest rows of a parallel product task
+#define SPARSE_NR (4*VEC_WIDTH) // product columns kept in registers
+#define SPARSE_U8_COLS 64 // 8 bit inputs multiply_u8t converts at once
+#define CSR_ERR_MSG "Invalid compressed sparse rows"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A matrix in compressed sparse row (CSR) form: the nonzero values of every
+ * row, row after row, with their column indexes. Products cost one
+ * multiply-add per nonzero, so they beat the dense kernels on heavily
+ * pruned weights.
+ */
+class SparseMatrix
+{
+ public:
+  //constructors
+  /**
+   * compresses a dense matrix, every exact zero is dropped
+   * @param mat the dense matrix
+   */
+  explicit SparseMatrix(const Matrix& mat);
+
+  /**
+   * builds a matrix from its CSR arrays, e.g mapped from a file
+   * @param rows num of rows
+   * @param cols num of cols
+   * @param row_starts rows + 1 offsets, row r is [row_starts[r],
+   * row_starts[r+1]) in the other arrays
+   * @param col_indexes the column of every value, increasing in a row
+   * @param values the nonzero values
+   * @param nonzeros the length of col_indexes and values
+   * @throws runtime_error if the arrays are not a valid CSR matrix
+   */
+  SparseMatrix(int rows, int cols, const int32_t* row_starts,
+               const int32_t* col_indexes, const float* values,
+               int32_t nonzeros);
+
+  //getters
+  /**
+   * @returns amount of rows as int
+   */
+  int get_rows() const;
+
+  /**
+   * @returns amount of cols as int
+   */
+  int get_cols() const;
+
+  /**
+   * @returns the number of stored values
+   */
+  int nonzeros() const;
+
+  /**
+   * @returns the fraction of zero coordinates, 0 to 1
+   */
+  float sparsity() const;
+
+  /**
+   * @returns the row offsets, see the array constructor
+   */
+  const std::vector<int32_t>& get_row_starts() const;
+
+  /**
+   * @returns the column of every value
+   */
+  const std::vector<int32_t>& get_col_indexes() const;
+
+  /**
+   * @returns the nonzero values, row after row
+   */
+  const std::vector<float>& get_values() const;
+
+  //methods
+  /**
+   * @return the dense matrix
+   */
+  Matrix to_dense() const;
+
+  /**
+   * output = this*rhs, one multiply-add per nonzero and rhs column.
+   * products of at least linalg::parallel_threshold() multiply-adds are
+   * split by rows across ThreadPool::shared()
+   * @param rhs a get_cols() rows Matrix or view, read in place when its rows
+   * are contiguous
+   * @param output resized to get_rows() X rhs columns, not viewed by rhs
+   */
+  void multiply(const MatrixView& rhs, Matrix& output) const;
+
+  /**
+   * output = this*bt^T for 8 bit bt, see linalg::gemm_u8t. SPARSE_U8_COLS
+   * inputs at a time are converted to float columns for the multiply kernels
+   * @param bt count inputs of get_cols() bytes, back to back
+   * @param count number of inputs
+   * @param output resized to get_rows() X count
+   */
+  void multiply_u8t(const uint8_t* bt, int count, Matrix& output) const;
+
+ private:
+  int _rows;
+  int _cols;
+  std::vector<int32_t> _row_starts;
+  std::vector<int32_t> _col_indexes;
+  std::vector<float> _values;
+
+  /**
+   * c = this*b, split by rows across ThreadPool::shared() when large
+   * enough, see multiply
+   * @param n columns of b and c
+   * @param ldb row stride of b, contiguous if n is 1
+   * @param ldc row stride of c
+   */
+  void multiply_block(int n, const float* b, int ldb, float* c,
+                      int ldc) const;
+
+  /**
+   * c rows [begin, end) of this*b, b and c row-major with n columns
+   * @param ldb row stride of b, contiguous if n is 1
+   * @param ldc row stride of c
+   */
+  void multiply_rows(int begin, int end, int n, const float* b, int ldb,
+                     float* c, int ldc) const;
+};
+
+#endif //SPARSEMATRIX_H
@@ -0,0 +1,254 @@
+// StaticMatrix.h
+#ifndef STATICMATRIX_H
+#define STATICMATRIX_H
+
+#include "Activation.h"
+#include "Gemm.h"
+#include "Matrix.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define STATIC_ALIGN 64     // alignment of the inline storage, one cache line
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * STATIC_ALIGN aligned heap allocation, plain new only guarantees that
+ * since c++17. used as the class operator new of the static types
+ */
+inline void* static_aligned_new(size_t size)
+{
+  void* ptr = nullptr;
+  if(posix_memalign(&ptr, STATIC_ALIGN, size) != 0)
+  {
+    throw bad_alloc();
+  }
+  return ptr;
+}
+
+/**
+ * A Rows X Cols matrix with the shape fixed at compile time.
+ * The coordinates are stored inline (row after row), so small matrices
+ * live on the stack, and no access is bounds checked.
+ * Use Matrix for shapes known only at run time.
+ */
+template <int Rows, int Cols>
+class StaticMatrix
+{
+  static_assert(Rows > 0 && Cols > 0, "StaticMatrix dimensions must be > 0");
+
+ public:
+  //constructors
+
+  /**
+   * builds a Rows X Cols matrix of zeros
+   */
+  StaticMatrix()
+  {
+    memset(_matrix, 0, sizeof(_matrix));
+  }
+
+  /**
+   * copies a dynamic Matrix, as a long vector if the shapes differ
+   * @param mat a Matrix object with Rows*Cols coordinates
+   */
+  explicit StaticMatrix(const Matrix& mat)
+  {
+    if(mat.get_rows()*mat.get_cols() != Rows*Cols)
+    {
+      throw length_error(LEN_ERR_MSG);
+    }
+    memcpy(_matrix, mat.data(), sizeof(_matrix));
+  }
+
+  static void* operator new(size_t size)
+  {
+    return static_aligned_new(size);
+  }
+
+  static void operator delete(void* ptr)
+  {
+    free(ptr);
+  }
+
+  //getters
+
+  /**
+   * @return the rows number of the matrix
+   */
+  static constexpr int get_rows()
+  {
+    return Rows;
+  }
+
+  /**
+   * @return the columns number of the matrix
+   */
+  static constexpr int get_cols()
+  {
+    return Cols;
+  }
+
+  /**
+   * @return pointer to the coordinates, row after row
+   */
+  float* data()
+  {
+    return _matrix;
+  }
+
+  /**
+   * @return pointer to the coordinates, row after row, read only
+   */
+  const float* data() const
+  {
+    return _matrix;
+  }
+
+  //methods
+
+  /**
+   * @return a new allocated dynamic Matrix copy of this matrix
+   */
+  Matrix to_matrix() const
+  {
+    Matrix mat(Rows, Cols);
+    memcpy(mat.data(), _matrix, sizeof(_matrix));
+    return mat;
+  }
+
+  /**
+   * @returns the index of the first largest coordinate of the matrix
+   */
+  int argmax() const
+  {
+    int max_index = 0;
+    for(int index=1; index<Rows*Cols; index++)
+    {
+      if(_matrix[index] > _matrix[max_index])
+      {
+        max_index = index;
+      }
+    }
+    return max_index;
+  }
+
+  //operators
+
+  /**
+   * @return Matrix[i][j], unchecked
+   */
+  const float& operator()(int i, int j) const
+  {
+    return _matrix[i*Cols + j];
+  }
+
+  /**
+   * @return Matrix[i][j], unchecked, allows change
+   */
+  float& operator()(int i, int j)
+  {
+    return _matrix[i*Cols + j];
+  }
+
+  /**
+   * @return the value of the index as if the matrix is a vector, unchecked
+   */
+  const float& operator[](int index) const
+  {
+    return _matrix[index];
+  }
+
+  /**
+   * @return the value of the index as if the matrix is a vector, unchecked,
+   * allows change
+   */
+  float& operator[](int index)
+  {
+    return _matrix[index];
+  }
+
+ private:
+  alignas(STATIC_ALIGN) float _matrix[Rows*Cols];
+};
+
+////////////////////////////// STATIC KERNELS /////////////////////////////////
+
+namespace static_linalg
+{
+    /**
+    * the dot product of every row of a with x, handed to store(row, dot).
+    * same scheme as linalg::gemv, but all loop bounds are compile time
+    * constants so small layers are fully unrolled
+    * @param a Rows X Cols matrix
+    * @param x Cols X 1 vector
+    * @param store called once per row, in order
+    */
+    template <int Rows, int Cols, typename Store>
+    inline void gemv_rows(const StaticMatrix<Rows, Cols>& a,
+                          const StaticMatrix<Cols, ONE_COL>& x, Store store)
+    {
+      const int k_main = Cols - (Cols % VEC_WIDTH);
+      const float* x_data = x.data();
+      for(int row=0; row<Rows; row++)
+      {
+        const float* a_row = a.data() + row*Cols;
+        linalg::vec_t acc = {};
+        for(int p=0; p<k_main; p+=VEC_WIDTH)
+        {
+          linalg::vec_t x_vec, a_vec;
+          memcpy(&x_vec, x_data + p, sizeof(x_vec));
+          memcpy(&a_vec, a_row + p, sizeof(a_vec));
+          acc += a_vec*x_vec;
+        }
+        float sum = 0.0F;
+        for(int l=0; l<VEC_WIDTH; l++)
+        {
+          sum += acc[l];
+        }
+        for(int p=k_main; p<Cols; p++)
+        {
+          sum += a_row[p]*x_data[p];
+        }
+        store(row, sum);
+      }
+    }
+
+
+    /**
+    * y = relu(a*x + bias)
+    */
+    template <int Rows, int Cols>
+    inline void dense_relu(const StaticMatrix<Rows, Cols>& a,
+                           const StaticMatrix<Cols, ONE_COL>& x,
+                           const StaticMatrix<Rows, ONE_COL>& bias,
+                           StaticMatrix<Rows, ONE_COL>& y)
+    {
+      gemv_rows(a, x, [&y, &bias](int row, float dot)
+      {
+        const float val = dot + bias[row];
+        y[row] = (val <= 0) ? 0 : val;
+      });
+    }
+
+
+    /**
+    * y = softmax(a*x + bias), the max is subtracted before exp
+    */
+    template <int Rows, int Cols>
+    inline void dense_softmax(const StaticMatrix<Rows, Cols>& a,
+                              const StaticMatrix<Cols, ONE_COL>& x,
+                              const StaticMatrix<Rows, ONE_COL>& bias,
+                              StaticMatrix<Rows, ONE_COL>& y)
+    {
+      gemv_rows(a, x, [&y, &bias](int row, float dot)
+      {
+        y[row] = dot + bias[row];
+      });
+      activation::softmax_span(y.data(), Rows);
+    }
+}
+
+#endif //STATICMATRIX_H
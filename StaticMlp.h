@@ -0,0 +1,167 @@
+// StaticMlp.h
+#ifndef STATICMLP_H
+#define STATICMLP_H
+
+#include "MlpNetwork.h"
+#include "StaticMatrix.h"
+
+/**
+ * The layers of a StaticMlp, built recursively from the layer sizes.
+ * Every layer but the last uses relu, the last one uses softmax.
+ */
+template <int... Dims>
+class StaticLayers;
+
+
+/**
+ * last layer, In inputs and Out outputs, softmax activation
+ */
+template <int In, int Out>
+class StaticLayers<In, Out>
+{
+ public:
+  /**
+   * @param weights weights[0] is an Out X In Matrix
+   * @param biases biases[0] is an Out X 1 Matrix
+   */
+  StaticLayers(const Matrix weights[], const Matrix biases[]):
+      _weights(checked(weights[0], Out, In, WEIGHT_SIZE_ERR_MSG)),
+      _bias(checked(biases[0], Out, ONE_COL, BIAS_SIZE_ERR_MSG))
+  {}
+
+  /**
+   * activates this layer
+   * @return the softmax output, valid until the next activation
+   */
+  const StaticMatrix<Out, ONE_COL>& forward(const StaticMatrix<In, ONE_COL>&
+  input)
+  {
+    static_linalg::dense_softmax(_weights, input, _bias, _output);
+    return _output;
+  }
+
+  /**
+   * @throws length_error if mat is not rows X cols
+   * @return mat
+   */
+  static const Matrix& checked(const Matrix& mat, int rows, int cols,
+                               const char* msg)
+  {
+    if(mat.get_rows() != rows || mat.get_cols() != cols)
+    {
+      throw length_error(msg);
+    }
+    return mat;
+  }
+
+ private:
+  StaticMatrix<Out, In> _weights;
+  StaticMatrix<Out, ONE_COL> _bias;
+  StaticMatrix<Out, ONE_COL> _output;
+};
+
+
+/**
+ * hidden layer, In inputs and Out outputs, relu activation,
+ * followed by the layers Out -> Next -> Rest...
+ */
+template <int In, int Out, int Next, int... Rest>
+class StaticLayers<In, Out, Next, Rest...>
+{
+ public:
+  /**
+   * @param weights weights[0] is an Out X In Matrix, the rest are passed on
+   * @param biases biases[0] is an Out X 1 Matrix, the rest are passed on
+   */
+  StaticLayers(const Matrix weights[], const Matrix biases[]):
+      _weights(StaticLayers<In, Out>::checked(weights[0], Out, In,
+                                              WEIGHT_SIZE_ERR_MSG)),
+      _bias(StaticLayers<In, Out>::checked(biases[0], Out, ONE_COL,
+                                           BIAS_SIZE_ERR_MSG)),
+      _rest(weights + 1, biases + 1)
+  {}
+
+  /**
+   * activates this layer and all the layers after it
+   * @return the last layer output, valid until the next activation
+   */
+  auto forward(const StaticMatrix<In, ONE_COL>& input)
+  -> decltype(std::declval<StaticLayers<Out, Next, Rest...>&>()
+                  .forward(std::declval<StaticMatrix<Out, ONE_COL>&>()))
+  {
+    static_linalg::dense_relu(_weights, input, _bias, _output);
+    return _rest.forward(_output);
+  }
+
+ private:
+  StaticMatrix<Out, In> _weights;
+  StaticMatrix<Out, ONE_COL> _bias;
+  StaticMatrix<Out, ONE_COL> _output;
+  StaticLayers<Out, Next, Rest...> _rest;
+};
+
+
+/**
+ * An Mlp network with the layer sizes fixed at compile time,
+ * e.g StaticMlp<784, 128, 64, 20, 10> is the network of MlpNetwork.
+ * All weights and layer outputs are stored inline, the object is large
+ * (about 400KB for the digits network) and should be heap allocated.
+ */
+template <int In, int... Dims>
+class StaticMlp
+{
+  static_assert(sizeof...(Dims) > 0, "StaticMlp needs at least one layer");
+
+ public:
+  //constructor
+  /**
+   * @param weights An array of Matrix objects - the weights matrices,
+   * must match the layer sizes exactly
+   * @param biases An array of biases vectors
+   */
+  StaticMlp(const Matrix weights[], const Matrix biases[]):
+      _layers(weights, biases)
+  {}
+
+  static void* operator new(size_t size)
+  {
+    return static_aligned_new(size);
+  }
+
+  static void operator delete(void* ptr)
+  {
+    free(ptr);
+  }
+
+  //operators
+  /**
+   * activate the network, no shape checks and no allocations
+   * @param image The input vector
+   * @return A digit struct, with the result number and score
+   */
+  digit operator()(const StaticMatrix<In, ONE_COL>& image)
+  {
+    const auto& output = _layers.forward(image);
+    const int max_index = output.argmax();
+    return digit{(unsigned int) max_index, output[max_index]};
+  }
+
+  /**
+   * activate the network
+   * @param image A Matrix object with In coordinates
+   * @return A digit struct, with the result number and score
+   */
+  digit operator()(const Matrix& image)
+  {
+    _input = StaticMatrix<In, ONE_COL>(image);
+    return (*this)(_input);
+  }
+
+ private:
+  StaticLayers<In, Dims...> _layers;
+  StaticMatrix<In, ONE_COL> _input;
+};
+
+typedef StaticMlp<784, 128, 64, 20, 10> StaticMnistMlp;
+
+#endif //STATICMLP_H
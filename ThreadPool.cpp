@@ -0,0 +1,234 @@
+#include "ThreadPool.h"
+
+struct pool_job
+{
+  const std::function<void(int, int, int)>* func;
+  std::atomic<int> remaining;
+  std::mutex lock;
+  std::condition_variable done;
+  std::exception_ptr error;
+};
+
+namespace
+{
+  //number of loop bodies the current thread is inside of
+  thread_local int parallel_depth = 0;
+}
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+ThreadPool::ThreadPool(int threads):
+    _queued(0), _stop(false)
+{
+  if(threads <= 0)
+  {
+    threads = (int) std::thread::hardware_concurrency();
+    threads = (threads <= 0) ? 1 : threads;
+  }
+  //the calling thread is the last worker, it needs no thread or deque
+  for(int worker=0; worker<threads-1; worker++)
+  {
+    _queues.emplace_back(new worker_queue());
+  }
+  for(int worker=0; worker<threads-1; worker++)
+  {
+    _threads.emplace_back(&ThreadPool::worker_loop, this, worker);
+  }
+}
+
+//////////////////////////////////// DESTRUCTOR ///////////////////////////////
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(_sleep_lock);
+    _stop = true;
+  }
+  _wake.notify_all();
+  for(std::thread& thread : _threads)
+  {
+    thread.join();
+  }
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+int ThreadPool::size() const
+{
+  return (int) _threads.size() + 1;
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+void ThreadPool::parallel_for(int n, int grain,
+                              const std::function<void(int, int, int)>& func)
+{
+  grain = (grain < 1) ? 1 : grain;
+  const int caller = size() - 1;
+  if(n <= grain || _threads.empty())
+  {
+    parallel_depth++;
+    try
+    {
+      for(int begin=0; begin<n; begin+=grain)
+      {
+        func(begin, (n - begin < grain) ? n : begin + grain, caller);
+      }
+    }
+    catch(...)
+    {
+      parallel_depth--;
+      throw;
+    }
+    parallel_depth--;
+    return;
+  }
+
+  pool_job job;
+  job.func = &func;
+  job.remaining = (n + grain - 1)/grain;
+
+  //deal the chunks round robin, idle workers steal to rebalance
+  int chunk = 0;
+  for(int begin=0; begin<n; begin+=grain, chunk++)
+  {
+    worker_queue& queue = *_queues[chunk % _queues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(pool_task{&job, begin,
+                                    (n - begin < grain) ? n : begin + grain});
+  }
+  {
+    std::lock_guard<std::mutex> guard(_sleep_lock);
+    _queued += chunk;
+  }
+  _wake.notify_all();
+
+  //help with this loop only, our own scratch may be in use by an outer task
+  pool_task task;
+  while(pop_job_task(&job, task))
+  {
+    run_task(task, caller);
+  }
+  std::unique_lock<std::mutex> lock(job.lock);
+  job.done.wait(lock, [&job]()
+  {
+    return job.remaining.load() == 0;
+  });
+  if(job.error)
+  {
+    std::rethrow_exception(job.error);
+  }
+}
+
+
+bool ThreadPool::in_parallel()
+{
+  return parallel_depth > 0;
+}
+
+
+ThreadPool& ThreadPool::shared()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+
+void ThreadPool::worker_loop(int worker)
+{
+  pool_task task;
+  while(true)
+  {
+    if(pop_task(worker, task))
+    {
+      run_task(task, worker);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_sleep_lock);
+    _wake.wait(lock, [this]()
+    {
+      return _stop || _queued.load() > 0;
+    });
+    if(_stop && _queued.load() == 0)
+    {
+      return;
+    }
+  }
+}
+
+
+bool ThreadPool::pop_task(int worker, pool_task& task)
+{
+  //newest task of our own deque first, it is likely still in cache
+  {
+    worker_queue& own = *_queues[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if(!own.tasks.empty())
+    {
+      task = own.tasks.back();
+      own.tasks.pop_back();
+      _queued--;
+      return true;
+    }
+  }
+  //steal the oldest task of the other workers
+  for(size_t offset=1; offset<_queues.size(); offset++)
+  {
+    worker_queue& victim = *_queues[(worker + offset) % _queues.size()];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if(!victim.tasks.empty())
+    {
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      _queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool ThreadPool::pop_job_task(const pool_job* job, pool_task& task)
+{
+  for(const std::unique_ptr<worker_queue>& queue : _queues)
+  {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    for(auto it=queue->tasks.begin(); it!=queue->tasks.end(); ++it)
+    {
+      if(it->job == job)
+      {
+        task = *it;
+        queue->tasks.erase(it);
+        _queued--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+void ThreadPool::run_task(const pool_task& task, int worker)
+{
+  pool_job& job = *task.job;
+  parallel_depth++;
+  try
+  {
+    (*job.func)(task.begin, task.end, worker);
+  }
+  catch(...)
+  {
+    std::lock_guard<std::mutex> guard(job.lock);
+    if(!job.error)
+    {
+      job.error = std::current_exception();
+    }
+  }
+  parallel_depth--;
+  //the last chunk wakes the caller, under the lock so it can't miss it
+  std::lock_guard<std::mutex> guard(job.lock);
+  if(--job.remaining == 0)
+  {
+    job.done.notify_all();
+  }
+}
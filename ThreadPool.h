@@ -0,0 +1,114 @@
+// ThreadPool.h
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @struct pool_job
+ * @brief One parallel_for call, shared by all its chunks.
+ */
+struct pool_job;
+
+/**
+ * @struct pool_task
+ * @brief A chunk [begin, end) of a parallel_for call.
+ */
+typedef struct pool_task
+{
+  pool_job* job;
+  int begin, end;
+} pool_task;
+
+/**
+ * A fixed set of threads running parallel loops with work stealing.
+ * Every thread has its own task deque, it pops its newest task and when
+ * empty steals the oldest task of another thread.
+ * The thread calling parallel_for takes part in its own loop, so nested
+ * loops (e.g a parallel product inside a parallel batch) don't deadlock.
+ */
+class ThreadPool
+{
+ public:
+  //constructor
+  /**
+   * @param threads total number of threads running a loop, including the
+   * calling thread. 0 means one per hardware thread
+   */
+  explicit ThreadPool(int threads = 0);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  //destructor
+  /**
+   * waits for the running tasks and joins all threads
+   */
+  ~ThreadPool();
+
+  //getters
+  /**
+   * @return number of threads running a loop, including the calling thread.
+   * worker indices passed to loop bodies are in [0, size())
+   */
+  int size() const;
+
+  //methods
+  /**
+   * runs func(begin, end, worker) on chunks of [0, n) in parallel and
+   * returns when all chunks are done. the calling thread always gets
+   * worker index size()-1, so per-worker scratch indexed by worker is
+   * never used by two chunks at once.
+   * the first exception thrown by func is rethrown here.
+   * @param n number of iterations
+   * @param grain iterations per chunk, at least 1
+   * @param func the loop body
+   */
+  void parallel_for(int n, int grain,
+                    const std::function<void(int, int, int)>& func);
+
+  /**
+   * @return true when called from inside a parallel_for loop body,
+   * of any pool. used to keep inner operations from splitting again
+   */
+  static bool in_parallel();
+
+  /**
+   * @return a pool with one thread per hardware thread, shared by the
+   * library operations that split themselves (e.g large products)
+   */
+  static ThreadPool& shared();
+
+ private:
+  /**
+   * @struct worker_queue
+   * @brief The task deque of one worker thread.
+   */
+  typedef struct worker_queue
+  {
+    std::mutex lock;
+    std::deque<pool_task> tasks;
+  } worker_queue;
+
+  std::vector<std::unique_ptr<worker_queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::mutex _sleep_lock;
+  std::condition_variable _wake;
+  std::atomic<int> _queued;
+  bool _stop;
+
+  void worker_loop(int worker);
+  bool pop_task(int worker, pool_task& task);
+  bool pop_job_task(const pool_job* job, pool_task& task);
+  static void run_task(const pool_task& task, int worker);
+};
+
+#endif //THREADPOOL_H
@@ -0,0 +1,212 @@
+#include "Trainer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+//////////////////////////////// CONSTRUCTORS /////////////////////////////////
+
+Trainer::Trainer(const std::vector<Dense>& layers, const train_config& config):
+    _layers(layers), _config(config), _steps(0), _rng(config.seed)
+{
+  //the network constructor checks that the layers chain
+  (void) MlpNetwork(layers);
+  for(size_t layer=0; layer<_layers.size(); layer++)
+  {
+    const activation_t expected = (layer + 1 == _layers.size())
+                                  ? activation::softmax : activation::relu;
+    if(_layers[layer].get_activation() != expected)
+    {
+      throw runtime_error(TRAIN_LAYERS_ERR_MSG);
+    }
+    //backward reads the float weights, so forward has to as well
+    _layers[layer].set_precision(PRECISION_FP32);
+  }
+  if(_config.batch_size <= 0)
+  {
+    throw length_error(TRAIN_BATCH_ERR_MSG);
+  }
+  if(_config.learning_rate <= 0)
+  {
+    _config.learning_rate = (_config.optimizer == OPTIMIZER_SGD)
+                            ? SGD_LEARNING_RATE : ADAM_LEARNING_RATE;
+  }
+  for(int state=0; state<2; state++)
+  {
+    for(const Dense& layer : _layers)
+    {
+      const Matrix& weights = layer.get_weights();
+      _weights_state[state].emplace_back(weights.get_rows(),
+                                         weights.get_cols());
+      _bias_state[state].emplace_back(weights.get_rows(), ONE_COL);
+    }
+  }
+  _outputs.resize(_layers.size());
+}
+
+
+std::vector<Dense> Trainer::init_layers(const std::vector<layer_spec>& spec,
+                                        unsigned int seed)
+{
+  std::mt19937 rng(seed);
+  std::vector<Dense> layers;
+  for(const layer_spec& layer : spec)
+  {
+    const int rows = layer.dims.rows, cols = layer.dims.cols;
+    const float limit = (layer.activation == activation::relu)
+                        ? std::sqrt(6.0F/cols)
+                        : std::sqrt(6.0F/(cols + rows));
+    std::uniform_real_distribution<float> uniform(-limit, limit);
+    Matrix weights(rows, cols);
+    float* coords = weights.data();
+    for(long index=0; index<((long) rows)*cols; index++)
+    {
+      coords[index] = uniform(rng);
+    }
+    layers.emplace_back(weights, Matrix(rows, ONE_COL), layer.activation);
+  }
+  return layers;
+}
+
+//////////////////////////////// GETTERS //////////////////////////////////////
+
+const std::vector<Dense>& Trainer::get_layers() const
+{
+  return _layers;
+}
+
+
+long Trainer::get_steps() const
+{
+  return _steps;
+}
+
+////////////////////////////// OTHER METHODS //////////////////////////////////
+
+MlpNetwork Trainer::network() const
+{
+  return MlpNetwork(_layers);
+}
+
+
+epoch_stats Trainer::train_epoch(const uint8_t* images,
+                                 const uint8_t* labels, int count)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const int img_size = _layers.front().get_weights().get_cols();
+  _order.resize(count);
+  std::iota(_order.begin(), _order.end(), 0);
+  std::shuffle(_order.begin(), _order.end(), _rng);
+
+  double loss = 0;
+  for(int first=0; first<count; first+=_config.batch_size)
+  {
+    const int batch = std::min(_config.batch_size, count - first);
+
+    //gather the shuffled images, one per column, normalized as MlpNetwork
+    //reads 8 bit images
+    _input.resize(img_size, batch);
+    _batch_labels.resize(batch);
+    float* coords = _input.data();
+    for(int col=0; col<batch; col++)
+    {
+      const int img = _order[first + col];
+      const uint8_t* pixels = images + ((long) img)*img_size;
+      for(int pixel=0; pixel<img_size; pixel++)
+      {
+        coords[pixel*batch + col] = pixels[pixel]*PIXEL_SCALE + PIXEL_OFFSET;
+      }
+      _batch_labels[col] = labels[img];
+    }
+    loss += ((double) train_batch(_input, _batch_labels.data()))*batch;
+  }
+
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  return epoch_stats{(float) (loss/count), seconds, count/seconds};
+}
+
+
+float Trainer::train_batch(const Matrix& input, const uint8_t* labels)
+{
+  const int last = (int) _layers.size() - 1;
+  for(int layer=0; layer<=last; layer++)
+  {
+    _layers[layer](layer ? _outputs[layer - 1] : input, _outputs[layer]);
+  }
+
+  //the softmax output turns into the gradient by the logits, then every
+  //layer hands the gradient by its input to the relu before it
+  std::swap(_grad, _outputs[last]);
+  const float loss = activation::cross_entropy_backward(_grad, labels);
+  for(int layer=last; layer>0; layer--)
+  {
+    _layers[layer].backward(_outputs[layer - 1], _grad, _input_grad);
+    activation::relu_backward(_outputs[layer - 1], _input_grad);
+    std::swap(_grad, _input_grad);
+  }
+  _layers[0].backward(input, _grad);
+
+  _steps++;
+  for(int layer=0; layer<=last; layer++)
+  {
+    optimize(_layers[layer].get_weights_grad(), _weights_state[0][layer],
+             _weights_state[1][layer], _weights_step);
+    optimize(_layers[layer].get_bias_grad(), _bias_state[0][layer],
+             _bias_state[1][layer], _bias_step);
+    _layers[layer].apply_step(_weights_step, _bias_step);
+  }
+  return loss;
+}
+
+
+float Trainer::accuracy(const uint8_t* images, const uint8_t* labels,
+                        int count, ThreadPool& pool) const
+{
+  const std::vector<digit> digits = network().classify_batch(images, count,
+                                                             pool);
+  int correct = 0;
+  for(int img=0; img<count; img++)
+  {
+    correct += (digits[img].value == labels[img]);
+  }
+  return ((float) correct)/count;
+}
+
+
+void Trainer::optimize(const Matrix& grad, Matrix& first, Matrix& second,
+                       Matrix& step) const
+{
+  const long size = ((long) grad.get_rows())*grad.get_cols();
+  step.resize(grad.get_rows(), grad.get_cols());
+  const float* g = grad.data();
+  float* m = first.data();
+  float* s = step.data();
+  const float rate = _config.learning_rate;
+  if(_config.optimizer == OPTIMIZER_SGD)
+  {
+    //velocity = momentum*velocity + grad, step = rate*velocity
+    const float momentum = _config.momentum;
+    for(long index=0; index<size; index++)
+    {
+      m[index] = momentum*m[index] + g[index];
+      s[index] = rate*m[index];
+    }
+    return;
+  }
+
+  //the bias corrections of both moments fold into the step size
+  float* v = second.data();
+  const float beta1 = _config.beta1, beta2 = _config.beta2;
+  const float epsilon = _config.epsilon;
+  const float corrected_rate =
+      rate*std::sqrt(1 - std::pow(beta2, (float) _steps))/
+      (1 - std::pow(beta1, (float) _steps));
+  for(long index=0; index<size; index++)
+  {
+    m[index] = beta1*m[index] + (1 - beta1)*g[index];
+    v[index] = beta2*v[index] + (1 - beta2)*g[index]*g[index];
+    s[index] = corrected_rate*m[index]/(std::sqrt(v[index]) + epsilon);
+  }
+}
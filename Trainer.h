@@ -0,0 +1,178 @@
+// Trainer.h
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "MlpNetwork.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define TRAIN_BATCH 64 // default mini-batch size
+#define SGD_LEARNING_RATE 0.05F
+#define SGD_MOMENTUM 0.9F
+#define ADAM_LEARNING_RATE 1e-3F
+#define ADAM_BETA1 0.9F
+#define ADAM_BETA2 0.999F
+#define ADAM_EPSILON 1e-8F
+#define TRAIN_LAYERS_ERR_MSG "Training needs relu layers and a softmax " \
+                             "last layer"
+#define TRAIN_BATCH_ERR_MSG "The mini-batch size must be positive"
+
+/**
+ * the update rule of a training step
+ */
+enum optimizer_kind
+{
+  OPTIMIZER_SGD, // mini-batch SGD with momentum
+  OPTIMIZER_ADAM // Adam, bias corrected moments
+};
+
+/**
+ * @struct train_config
+ * @brief The optimizer and its hyperparameters.
+ * @var learning_rate - 0 picks the default of the optimizer
+ * @var momentum - the SGD velocity decay, 0 for plain SGD
+ * @var beta1, beta2, epsilon - the Adam moments decays and denominator term
+ * @var batch_size - images per mini-batch
+ * @var seed - of the mini-batch shuffles
+ */
+typedef struct train_config
+{
+  optimizer_kind optimizer = OPTIMIZER_ADAM;
+  float learning_rate = 0.0F;
+  float momentum = SGD_MOMENTUM;
+  float beta1 = ADAM_BETA1;
+  float beta2 = ADAM_BETA2;
+  float epsilon = ADAM_EPSILON;
+  int batch_size = TRAIN_BATCH;
+  unsigned int seed = 0;
+} train_config;
+
+/**
+ * @struct epoch_stats
+ * @brief What one pass over the training images took.
+ * @var loss - the mean cross-entropy loss of its mini-batches
+ * @var seconds - wall-clock time of the pass
+ * @var samples_per_sec - training images per second
+ */
+typedef struct epoch_stats
+{
+  float loss;
+  double seconds;
+  double samples_per_sec;
+} epoch_stats;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Trains a network of Dense layers by backpropagation: relu hidden layers
+ * and a softmax last layer under the cross-entropy loss. Every mini-batch
+ * runs forward and backward as whole matrix products, which the gemm
+ * spreads across ThreadPool::shared().
+ */
+class Trainer
+{
+ public:
+  //constructor
+  /**
+   * @param layers the starting layers, e.g. from init_layers or a bundle.
+   * they train in PRECISION_FP32 whatever precision they ran in, see
+   * MlpNetwork::set_precision for the network() of the trained ones
+   * @param config the optimizer and its hyperparameters
+   * @throws length_error if the layers don't chain
+   * @throws runtime_error if a layer activation can't be trained
+   */
+  Trainer(const std::vector<Dense>& layers, const train_config& config);
+
+  /**
+   * fresh layers of a spec: uniform He weights for relu layers, uniform
+   * Glorot weights for the others, zero biases
+   * @param spec the shape and activation of every layer
+   * @param seed of the weights
+   * @return the layers
+   */
+  static std::vector<Dense> init_layers(const std::vector<layer_spec>& spec,
+                                        unsigned int seed);
+
+  //getters
+  /**
+   * @returns the layers as trained so far
+   */
+  const std::vector<Dense>& get_layers() const;
+
+  /**
+   * @returns the number of steps taken so far
+   */
+  long get_steps() const;
+
+  //methods
+  /**
+   * @return a network of the layers as trained so far
+   */
+  MlpNetwork network() const;
+
+  /**
+   * one pass over the training images in a fresh random order, one
+   * optimizer step per mini-batch. pixels are read as
+   * pixel*PIXEL_SCALE + PIXEL_OFFSET, as MlpNetwork reads them by default
+   * @param images count 8 bit images back to back
+   * @param labels the class of every image
+   * @param count number of images
+   * @return the loss, time and throughput of the pass
+   */
+  epoch_stats train_epoch(const uint8_t* images, const uint8_t* labels,
+                          int count);
+
+  /**
+   * one optimizer step on a mini-batch
+   * @param input a Matrix object, every column is one input
+   * @param labels the class of every column
+   * @return the mean cross-entropy loss of the mini-batch, before the step
+   */
+  float train_batch(const Matrix& input, const uint8_t* labels);
+
+  /**
+   * @param images count 8 bit images back to back
+   * @param labels the class of every image
+   * @param count number of images
+   * @param pool the threads to classify on
+   * @return the fraction of images the network of the layers classifies
+   * as labeled
+   */
+  float accuracy(const uint8_t* images, const uint8_t* labels, int count,
+                 ThreadPool& pool) const;
+
+ private:
+  std::vector<Dense> _layers;
+  train_config _config;
+  long _steps;
+  std::mt19937 _rng;
+
+  //optimizer state of every layer: the SGD velocity, or the Adam first
+  //and second moments
+  std::vector<Matrix> _weights_state[2];
+  std::vector<Matrix> _bias_state[2];
+
+  //mini-batch buffers, reused from step to step
+  std::vector<int> _order;
+  std::vector<uint8_t> _batch_labels;
+  Matrix _input;
+  std::vector<Matrix> _outputs;
+  Matrix _grad;
+  Matrix _input_grad;
+  Matrix _weights_step;
+  Matrix _bias_step;
+
+  /**
+   * turns a gradient into a step under the optimizer, updating its state
+   * @param grad the gradient of one parameter Matrix
+   * @param first the SGD velocity or Adam first moment of that Matrix
+   * @param second the Adam second moment of that Matrix
+   * @param step resized to the gradient size
+   */
+  void optimize(const Matrix& grad, Matrix& first, Matrix& second,
+                Matrix& step) const;
+};
+
+#endif //TRAINER_H
@@ -0,0 +1,905 @@
+// Benchmark.cpp
+// build from the repository root, with all library sources:
+//   g++ -std=c++14 -O3 -march=native -pthread *.cpp bench/Benchmark.cpp
+// usage:
+//   benchmark [--filter <substring>] [--min-time <seconds>]
+//             [--json <results out>] [--baseline <saved results>]
+//             [--threshold <fraction>]
+// every benchmark prints a row: its name, the time of one iteration, the
+// iterations run and the items processed per second. --json writes the rows
+// in the Google Benchmark JSON layout, so a saved run is a baseline:
+// --baseline compares against one and exits with a failure if a benchmark
+// got slower by more than the threshold, default BENCH_THRESHOLD
+
+#include "../Kernels.h"
+#include "../Profiler.h"
+#include "../QuantizedMlp.h"
+#include "../Trainer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define MIN_BENCH_SECONDS 0.2
+#define BENCH_THRESHOLD 0.1 // slowdown fraction reported as a regression
+#define THROUGHPUT_BATCH 10000
+#define ACCURACY_IMAGES 10000
+#define SPARSE_BATCH 256
+#define USAGE_MSG "Usage: benchmark [--filter <substring>] " \
+                  "[--min-time <seconds>] [--json <results out>] " \
+                  "[--baseline <saved results>] [--threshold <fraction>]"
+#define OPEN_ERR_MSG "Could not open "
+
+/**
+ * @struct bench_result
+ * @brief One row of the report.
+ * @var counters - extra named values, e.g. a speedup or an agreement rate
+ */
+typedef struct bench_result
+{
+  std::string name;
+  long iterations;
+  double ns;
+  double items_per_sec;
+  std::vector<std::pair<std::string, double>> counters;
+} bench_result;
+
+///////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  std::mt19937 rng(2020);
+  std::vector<bench_result> results;
+  std::string filter;
+  double min_seconds = MIN_BENCH_SECONDS;
+  volatile float sink;
+
+  /**
+   * @return a rows X cols Matrix with normal random values
+   */
+  Matrix random_matrix(int rows, int cols, float stddev)
+  {
+    std::normal_distribution<float> dist(0.0F, stddev);
+    Matrix mat(rows, cols);
+    for(int index=0; index<rows*cols; index++)
+    {
+      mat[index] = dist(rng);
+    }
+    return mat;
+  }
+
+
+  /**
+   * @return "rows x cols", the size part of a benchmark name
+   */
+  std::string shape(int rows, int cols)
+  {
+    return std::to_string(rows) + "x" + std::to_string(cols);
+  }
+
+
+  /**
+   * runs func repeatedly for at least min_seconds, after one warm up call,
+   * and prints and records the result row, unless the filter skips it
+   * @param name the benchmark name, unique in the suite
+   * @param items the items one call processes, e.g. images or coordinates
+   * @return the mean time of one call in nanoseconds, 0 if skipped
+   */
+  template <typename Func>
+  double run(const std::string& name, double items, Func func)
+  {
+    if(name.find(filter) == std::string::npos)
+    {
+      return 0;
+    }
+    typedef std::chrono::steady_clock clock;
+    func();
+    long iterations = 0;
+    const clock::time_point start = clock::now();
+    double elapsed = 0;
+    do
+    {
+      for(int i=0; i<64; i++)
+      {
+        func();
+      }
+      iterations += 64;
+      elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < min_seconds);
+
+    const double ns = elapsed*1e9/iterations;
+    const double per_sec = items/(ns*1e-9);
+    results.push_back(bench_result{name, iterations, ns, per_sec, {}});
+    printf("%-52s %14.1f ns %10ld %14.4g items/s\n", name.c_str(), ns,
+           iterations, per_sec);
+    return ns;
+  }
+
+
+  /**
+   * adds a named value to the last recorded row, and prints it
+   */
+  void counter(const std::string& key, double value)
+  {
+    results.back().counters.emplace_back(key, value);
+    printf("%-52s %14.4g %s\n", "", value, key.c_str());
+  }
+
+
+  /**
+   * @return a network of the default spec shapes with random weights
+   */
+  MlpNetwork random_network()
+  {
+    Matrix weights[MLP_SIZE], biases[MLP_SIZE];
+    for(int layer=0; layer<MLP_SIZE; layer++)
+    {
+      weights[layer] = random_matrix(weights_dims[layer].rows,
+                                     weights_dims[layer].cols, 0.1F);
+      biases[layer] = random_matrix(bias_dims[layer].rows, ONE_COL, 0.1F);
+    }
+    return MlpNetwork(weights, biases);
+  }
+
+////////////////////////////// BENCHMARKS /////////////////////////////////////
+
+  /**
+   * every Matrix operator on one shape, items are coordinates
+   */
+  void bench_matrix_ops(int rows, int cols)
+  {
+    const std::string size = shape(rows, cols);
+    const double coords = ((double) rows)*cols;
+    const Matrix a = random_matrix(rows, cols, 1.0F);
+    const Matrix b = random_matrix(rows, cols, 1.0F);
+    const Matrix x = random_matrix(cols, ONE_COL, 1.0F);
+    Matrix c = a;
+
+    run("Matrix/copy/" + size, coords, [&]()
+    {
+      const Matrix copy(a);
+      sink = copy[0];
+    });
+    run("Matrix/assign/" + size, coords, [&]()
+    {
+      c = a;
+      sink = c[0];
+    });
+    run("Matrix/add/" + size, coords, [&]()
+    {
+      sink = Matrix(a + b)[0];
+    });
+    run("Matrix/add_assign/" + size, coords, [&]()
+    {
+      c += b;
+      sink = c[0];
+    });
+    run("Matrix/scale/" + size, coords, [&]()
+    {
+      sink = Matrix(a*0.5F)[0];
+    });
+    run("Matrix/scale_assign/" + size, coords, [&]()
+    {
+      c *= -1.0F;
+      sink = c[0];
+    });
+    run("Matrix/dot/" + size, coords, [&]()
+    {
+      sink = Matrix(a.dot(b))[0];
+    });
+    //a chain evaluated in one pass, against one matrix per operator
+    const double steps = run("Matrix/chain_steps/" + size, coords, [&]()
+    {
+      const Matrix added = a + b;
+      const Matrix halved = added*0.5F;
+      const Matrix dotted = a.dot(b);
+      c = halved + dotted;
+      sink = c[0];
+    });
+    const double fused = run("Matrix/chain_fused/" + size, coords, [&]()
+    {
+      c = (a + b)*0.5F + a.dot(b);
+      sink = c[0];
+    });
+    if(steps > 0 && fused > 0)
+    {
+      counter("speedup", steps/fused);
+    }
+    run("Matrix/mult_vector/" + size, coords, [&]()
+    {
+      sink = (a*x)[0];
+    });
+    run("Matrix/transpose/" + size, coords, [&]()
+    {
+      c.transpose();
+      sink = c[0];
+    });
+    run("Matrix/index/" + size, coords, [&]()
+    {
+      float sum = 0;
+      for(int row=0; row<rows; row++)
+      {
+        for(int col=0; col<cols; col++)
+        {
+          sum += a(row, col);
+        }
+      }
+      sink = sum;
+    });
+    run("Matrix/sum/" + size, coords, [&]()
+    {
+      sink = a.sum();
+    });
+    run("Matrix/norm/" + size, coords, [&]()
+    {
+      sink = a.norm();
+    });
+    run("Matrix/argmax/" + size, coords, [&]()
+    {
+      sink = (float) a.argmax();
+    });
+
+    std::string bytes(((size_t) rows)*cols*CELL_SIZE, '\0');
+    memcpy(&bytes[0], a.data(), bytes.size());
+    std::istringstream is(bytes);
+    run("Matrix/read/" + size, coords, [&]()
+    {
+      is.clear();
+      is >> c;
+      sink = c[0];
+    });
+  }
+
+
+  /**
+   * matrix-matrix products, items are multiply-adds
+   */
+  void bench_matrix_mult(int m, int k, int n)
+  {
+    const Matrix a = random_matrix(m, k, 1.0F);
+    const Matrix b = random_matrix(k, n, 1.0F);
+    Matrix c;
+    run("Matrix/mult/" + shape(m, k) + "*" + shape(k, n),
+        ((double) m)*k*n, [&]()
+    {
+      sink = (a*b)[0];
+    });
+    run("Matrix/assign_product/" + shape(m, k) + "*" + shape(k, n),
+        ((double) m)*k*n, [&]()
+    {
+      c.assign_product(a, b);
+      sink = c[0];
+    });
+  }
+
+
+  /**
+   * a temporary of every layer shape, from the default pool and straight
+   * from the system allocator, items are matrices
+   */
+  void bench_allocator()
+  {
+    SystemAllocator system;
+    for(int layer=0; layer<MLP_SIZE; layer++)
+    {
+      const int rows = weights_dims[layer].rows;
+      const int cols = weights_dims[layer].cols;
+      const allocator_stats before = matrix_alloc::get_default().stats();
+      const double pool_ns = run("MatrixAllocator/pool/" + shape(rows, cols),
+                                 1, [&]()
+      {
+        sink = Matrix(rows, cols)[0];
+      });
+      if(pool_ns > 0)
+      {
+        const allocator_stats after = matrix_alloc::get_default().stats();
+        const double total = (double) (after.hits + after.misses -
+                                       before.hits - before.misses);
+        counter("hit_rate", total ? (after.hits - before.hits)/total : 0);
+      }
+      run("MatrixAllocator/system/" + shape(rows, cols), 1, [&]()
+      {
+        sink = Matrix(rows, cols, system)[0];
+      });
+    }
+  }
+
+
+  /**
+   * every activation on one output shape, items are coordinates
+   */
+  void bench_activation(int rows, int cols)
+  {
+    const std::string size = shape(rows, cols);
+    const double coords = ((double) rows)*cols;
+    const Matrix mat = random_matrix(rows, cols, 1.0F);
+    Matrix scratch = mat;
+
+    run("activation/relu/" + size, coords, [&]()
+    {
+      sink = activation::relu(mat)[0];
+    });
+    run("activation/softmax/" + size, coords, [&]()
+    {
+      sink = activation::softmax(mat)[0];
+    });
+    run("activation/relu_in_place/" + size, coords, [&]()
+    {
+      activation::relu_in_place(scratch);
+      sink = scratch[0];
+    });
+    run("activation/softmax_in_place/" + size, coords, [&]()
+    {
+      activation::softmax_in_place(scratch);
+      sink = scratch[0];
+    });
+    if(cols != ONE_COL)
+    {
+      run("activation/softmax_cols/" + size, coords, [&]()
+      {
+        activation::softmax_cols_in_place(scratch);
+        sink = scratch[0];
+      });
+    }
+  }
+
+
+  /**
+   * one layer shape: the fused Dense kernel against the unfused product,
+   * bias add and activation passes, the allocating call, a batch, and a
+   * strided view of half a batch against a copy of it. items are inputs
+   */
+  void bench_dense(int layer)
+  {
+    const int rows = weights_dims[layer].rows, cols = weights_dims[layer].cols;
+    const activation_t act = (layer == MLP_SIZE-1) ? softmax : relu;
+    const std::string size = shape(rows, cols);
+    const Matrix weights = random_matrix(rows, cols, 0.1F);
+    const Matrix bias = random_matrix(rows, ONE_COL, 0.1F);
+    const Matrix input = random_matrix(cols, ONE_COL, 1.0F);
+    const Matrix batch = random_matrix(cols, SPARSE_BATCH, 1.0F);
+    Dense dense(weights, bias, act);
+    Matrix output(rows, ONE_COL);
+
+    const double unfused = run("Dense/unfused/" + size, 1, [&]()
+    {
+      Matrix result = weights*input;
+      result += bias;
+      sink = act(result)[0];
+    });
+    const double fused = run("Dense/fused/" + size, 1, [&]()
+    {
+      dense(input, output);
+      sink = output[0];
+    });
+    if(unfused > 0 && fused > 0)
+    {
+      counter("speedup", unfused/fused);
+    }
+    run("Dense/allocating/" + size, 1, [&]()
+    {
+      sink = dense(input)[0];
+    });
+    run("Dense/batch/" + size + "/" + std::to_string(SPARSE_BATCH),
+        SPARSE_BATCH, [&]()
+    {
+      dense(batch, output);
+      sink = output[0];
+    });
+    //half of the batch columns, strided, copied out first against in place
+    const int half = SPARSE_BATCH/2;
+    const MatrixView columns = MatrixView(batch).block(0, 0, cols, half);
+    const std::string half_size = size + "/" + std::to_string(half);
+    const double copied = run("Dense/batch_copy/" + half_size, half, [&]()
+    {
+      dense(columns.to_matrix(), output);
+      sink = output[0];
+    });
+    const double viewed = run("Dense/batch_view/" + half_size, half, [&]()
+    {
+      dense(columns, output);
+      sink = output[0];
+    });
+    if(copied > 0 && viewed > 0)
+    {
+      counter("speedup", copied/viewed);
+    }
+  }
+
+
+  /**
+   * end to end latency of one image, items are images
+   */
+  void bench_network_latency()
+  {
+    MlpNetwork network = random_network();
+    const Matrix image = random_matrix(img_dims.rows, img_dims.cols, 1.0F);
+    Matrix input = image;
+    mlp_workspace workspace;
+    run("MlpNetwork/operator()", 1, [&]()
+    {
+      input = image;
+      sink = network(input).probability;
+    });
+    run("MlpNetwork/classify", 1, [&]()
+    {
+      sink = network.classify(image, workspace).probability;
+    });
+
+    //the same with profiling on, against the row above for its overhead
+    profile::set_enabled(true);
+    run("MlpNetwork/classify/profiled", 1, [&]()
+    {
+      sink = network.classify(image, workspace).probability;
+    });
+    profile::set_enabled(false);
+    profile::reset();
+  }
+
+
+  /**
+   * images per second of a THROUGHPUT_BATCH images batch,
+   * from one thread up to one per hardware thread
+   */
+  void bench_parallel_batch()
+  {
+    const MlpNetwork network = random_network();
+    const Matrix images = random_matrix(img_dims.rows*img_dims.cols,
+                                        THROUGHPUT_BATCH, 1.0F);
+    int max_threads = (int) std::thread::hardware_concurrency();
+    max_threads = (max_threads <= 0) ? 1 : max_threads;
+
+    double single = 0;
+    for(int threads=1; threads<=max_threads; threads++)
+    {
+      ThreadPool pool(threads);
+      const double batch_ns = run("MlpNetwork/classify_batch/" +
+                                  std::to_string(THROUGHPUT_BATCH) +
+                                  "/threads:" + std::to_string(threads),
+                                  THROUGHPUT_BATCH, [&]()
+      {
+        sink = network.classify_batch(images, pool)[0].probability;
+      });
+      single = (threads == 1) ? batch_ns : single;
+      if(single > 0 && batch_ns > 0)
+      {
+        counter("scaling", single/batch_ns);
+      }
+    }
+  }
+
+
+  /**
+   * single image latency and batch throughput of every output mode
+   */
+  void bench_output_modes()
+  {
+    const char* names[] = {"distribution", "top-k", "argmax"};
+    const output_mode modes[] = {OUTPUT_DISTRIBUTION, OUTPUT_TOP_K,
+                                 OUTPUT_ARGMAX};
+    MlpNetwork network = random_network();
+    const Matrix image = random_matrix(img_dims.rows*img_dims.cols, ONE_COL,
+                                       1.0F);
+    const Matrix images = random_matrix(img_dims.rows*img_dims.cols,
+                                        SPARSE_BATCH, 1.0F);
+    mlp_workspace workspace;
+    ThreadPool pool(1);
+    for(int index=0; index<3; index++)
+    {
+      network.set_output_mode(modes[index]);
+      const std::string name = string("MlpNetwork/predict/") + names[index];
+      run(name, 1, [&]()
+      {
+        sink = (float) network.predict(image, workspace)[0].value;
+      });
+      run(name + "/batch/" + std::to_string(SPARSE_BATCH), SPARSE_BATCH,
+          [&]()
+      {
+        sink = (float) network.predict_batch(images, pool)[0][0].value;
+      });
+    }
+  }
+
+
+  /**
+   * the first layer shape with a sparsity fraction of random zeros, dense
+   * kernels against the CSR ones on one image and on a SPARSE_BATCH batch.
+   * the CSR row runs the kernels directly, a sparse Dense runs single
+   * images dense below DENSE_SPARSE_GEMV_THRESHOLD
+   */
+  void bench_sparse(float sparsity)
+  {
+    const int rows = weights_dims[0].rows, cols = weights_dims[0].cols;
+    Matrix weights = random_matrix(rows, cols, 0.1F);
+    std::bernoulli_distribution zero(sparsity);
+    for(int index=0; index<rows*cols; index++)
+    {
+      weights[index] = zero(rng) ? 0.0F : weights[index];
+    }
+    const Matrix bias = random_matrix(rows, ONE_COL, 0.1F);
+    Dense dense(weights, bias, relu);
+    dense.set_sparse(false);
+    const SparseMatrix csr(weights);
+
+    const int batches[] = {ONE_COL, SPARSE_BATCH};
+    for(int cols_count : batches)
+    {
+      const Matrix input = random_matrix(cols, cols_count, 1.0F);
+      Matrix output;
+      const std::string name = "Dense/sparse" +
+                               std::to_string((int) (100*sparsity + 0.5F)) +
+                               "/" + shape(rows, cols) + "/" +
+                               std::to_string(cols_count);
+      const double dense_ns = run(name + "/dense", cols_count, [&]()
+      {
+        dense(input, output);
+        sink = output[0];
+      });
+      const double sparse_ns = run(name + "/csr", cols_count, [&]()
+      {
+        csr.multiply(input, output);
+        output.broadcast_add(bias);
+        activation::relu_in_place(output);
+        sink = output[0];
+      });
+      if(dense_ns > 0 && sparse_ns > 0)
+      {
+        counter("speedup", dense_ns/sparse_ns);
+      }
+    }
+  }
+
+
+  /**
+   * single image latency with all weights stored in each precision, and
+   * how often the digit matches the fp32 network
+   */
+  void bench_precision()
+  {
+    const char* names[] = {"fp32", "fp16", "bf16"};
+    const weight_precision precisions[] = {PRECISION_FP32, PRECISION_FP16,
+                                           PRECISION_BF16};
+    MlpNetwork network = random_network();
+    const Matrix image = random_matrix(img_dims.rows*img_dims.cols, ONE_COL,
+                                       1.0F);
+    const Matrix images = random_matrix(img_dims.rows*img_dims.cols,
+                                        ACCURACY_IMAGES, 1.0F);
+    const std::vector<digit> expected = network.classify_batch(images);
+    mlp_workspace workspace;
+
+    for(int index=0; index<3; index++)
+    {
+      for(int layer=0; layer<MLP_SIZE; layer++)
+      {
+        network.set_precision(layer, precisions[index]);
+      }
+      const double image_ns = run(string("MlpNetwork/weights/") +
+                                  names[index], 1, [&]()
+      {
+        sink = network.classify(image, workspace).probability;
+      });
+      if(image_ns == 0)
+      {
+        continue;
+      }
+      const std::vector<digit> digits = network.classify_batch(images);
+      int agreed = 0;
+      float max_diff = 0;
+      for(int img=0; img<ACCURACY_IMAGES; img++)
+      {
+        if(digits[img].value == expected[img].value)
+        {
+          agreed++;
+          const float diff = std::fabs(digits[img].probability -
+                                       expected[img].probability);
+          max_diff = (diff > max_diff) ? diff : max_diff;
+        }
+      }
+      counter("agreement", ((double) agreed)/ACCURACY_IMAGES);
+      counter("max_prob_diff", max_diff);
+    }
+  }
+
+
+  /**
+   * the int8 network against the float one it is calibrated from, on one
+   * image and on a SPARSE_BATCH batch. items are images
+   */
+  void bench_quantized()
+  {
+    const MlpNetwork network = random_network();
+    const Matrix image = random_matrix(img_dims.rows*img_dims.cols, ONE_COL,
+                                       1.0F);
+    const Matrix images = random_matrix(img_dims.rows*img_dims.cols,
+                                        SPARSE_BATCH, 1.0F);
+    const QuantizedMlp quantized = QuantizedMlp::calibrate(network, images);
+    mlp_workspace workspace;
+    quant_workspace quant;
+    const std::string batch = std::to_string(SPARSE_BATCH);
+
+    const double float_image = run("QuantizedMlp/image/fp32", 1, [&]()
+    {
+      sink = network.classify(image, workspace).probability;
+    });
+    const double int8_image = run("QuantizedMlp/image/int8", 1, [&]()
+    {
+      sink = quantized.classify(image, quant).probability;
+    });
+    if(float_image > 0 && int8_image > 0)
+    {
+      counter("speedup", float_image/int8_image);
+    }
+    const double float_batch = run("QuantizedMlp/batch/fp32/" + batch,
+                                   SPARSE_BATCH, [&]()
+    {
+      sink = network.classify_batch(images, ThreadPool::shared())[0]
+             .probability;
+    });
+    const double int8_batch = run("QuantizedMlp/batch/int8/" + batch,
+                                  SPARSE_BATCH, [&]()
+    {
+      sink = quantized.classify_batch(images)[0].probability;
+    });
+    if(float_batch > 0 && int8_batch > 0)
+    {
+      counter("speedup", float_batch/int8_batch);
+    }
+  }
+
+
+  /**
+   * one training step of a TRAIN_BATCH mini-batch, items are samples
+   */
+  void bench_training()
+  {
+    const optimizer_kind optimizers[] = {OPTIMIZER_SGD, OPTIMIZER_ADAM};
+    const char* names[] = {"sgd", "adam"};
+    const Matrix input = random_matrix(img_dims.rows*img_dims.cols,
+                                       TRAIN_BATCH, 1.0F);
+    std::vector<uint8_t> labels(TRAIN_BATCH);
+    for(int col=0; col<TRAIN_BATCH; col++)
+    {
+      labels[col] = (uint8_t) (col % weights_dims[MLP_SIZE - 1].rows);
+    }
+    for(int index=0; index<2; index++)
+    {
+      train_config config;
+      config.optimizer = optimizers[index];
+      Trainer trainer(Trainer::init_layers(MlpNetwork::default_spec(), 1),
+                      config);
+      run(string("Trainer/train_batch/") + names[index] + "/" +
+          std::to_string(TRAIN_BATCH), TRAIN_BATCH, [&]()
+      {
+        sink = trainer.train_batch(input, labels.data());
+      });
+    }
+  }
+
+/////////////////////////////// REPORTING /////////////////////////////////////
+
+  /**
+   * @return s with the JSON string escapes
+   */
+  std::string json_escape(const std::string& s)
+  {
+    std::string escaped;
+    for(char ch : s)
+    {
+      if(ch == '"' || ch == '\\')
+      {
+        escaped += '\\';
+      }
+      escaped += ch;
+    }
+    return escaped;
+  }
+
+
+  /**
+   * writes the results in the Google Benchmark JSON layout, one benchmark
+   * object per line
+   */
+  void write_json(const char* path)
+  {
+    std::ofstream os(path);
+    if(!os)
+    {
+      throw runtime_error(string(OPEN_ERR_MSG) + path);
+    }
+    char date[64];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S",
+                  std::localtime(&now));
+    os << "{\n  \"context\": {\"date\": \"" << date << "\", \"num_cpus\": "
+       << std::thread::hardware_concurrency() << ", \"kernels\": \""
+       << json_escape(kernels::active().name) << "\", \"vec_width\": "
+       << VEC_WIDTH << "},\n  \"benchmarks\": [\n";
+    char number[32];
+    for(size_t index=0; index<results.size(); index++)
+    {
+      const bench_result& result = results[index];
+      snprintf(number, sizeof(number), "%.6g", result.ns);
+      os << "    {\"name\": \"" << json_escape(result.name)
+         << "\", \"iterations\": " << result.iterations
+         << ", \"real_time\": " << number << ", \"time_unit\": \"ns\"";
+      snprintf(number, sizeof(number), "%.6g", result.items_per_sec);
+      os << ", \"items_per_second\": " << number;
+      for(const std::pair<std::string, double>& item : result.counters)
+      {
+        snprintf(number, sizeof(number), "%.6g", item.second);
+        os << ", \"" << json_escape(item.first) << "\": " << number;
+      }
+      os << ((index + 1 < results.size()) ? "},\n" : "}\n");
+    }
+    os << "  ]\n}\n";
+  }
+
+
+  /**
+   * @return the real_time of every benchmark of a JSON results file, by
+   * name. reads what write_json and Google Benchmark write
+   */
+  std::map<std::string, double> read_json(const char* path)
+  {
+    std::ifstream is(path);
+    if(!is)
+    {
+      throw runtime_error(string(OPEN_ERR_MSG) + path);
+    }
+    std::stringstream buffer;
+    buffer << is.rdbuf();
+    const std::string json = buffer.str();
+    const std::string name_key = "\"name\": \"", time_key = "\"real_time\": ";
+
+    std::map<std::string, double> times;
+    size_t pos = json.find(name_key);
+    while(pos != std::string::npos)
+    {
+      const size_t name_start = pos + name_key.size();
+      const size_t name_end = json.find('"', name_start);
+      const size_t time_pos = json.find(time_key, name_end);
+      if(name_end == std::string::npos || time_pos == std::string::npos)
+      {
+        break;
+      }
+      times[json.substr(name_start, name_end - name_start)] =
+          std::strtod(json.c_str() + time_pos + time_key.size(), nullptr);
+      pos = json.find(name_key, time_pos);
+    }
+    return times;
+  }
+
+
+  /**
+   * prints every result against its baseline time
+   * @return the number of results slower than the baseline by more than
+   * threshold
+   */
+  int compare(const std::map<std::string, double>& baseline,
+              double threshold)
+  {
+    printf("\n%-52s %14s %14s %9s\n", "benchmark", "baseline ns",
+           "current ns", "change");
+    int regressions = 0;
+    for(const bench_result& result : results)
+    {
+      const auto base = baseline.find(result.name);
+      if(base == baseline.end() || base->second <= 0)
+      {
+        printf("%-52s %14s %14.1f %9s\n", result.name.c_str(), "-",
+               result.ns, "new");
+        continue;
+      }
+      const double change = result.ns/base->second - 1;
+      const bool regressed = change > threshold;
+      regressions += regressed;
+      printf("%-52s %14.1f %14.1f %+8.1f%%%s\n", result.name.c_str(),
+             base->second, result.ns, 100*change,
+             regressed ? "  REGRESSION" : "");
+    }
+    printf("%d regressions over %.1f%%\n", regressions, 100*threshold);
+    return regressions;
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  const char* json_path = nullptr;
+  const char* baseline_path = nullptr;
+  double threshold = BENCH_THRESHOLD;
+  for(int arg=1; arg<argc; arg++)
+  {
+    const bool has_value = arg + 1 < argc;
+    if(has_value && strcmp(argv[arg], "--filter") == 0)
+    {
+      filter = argv[++arg];
+    }
+    else if(has_value && strcmp(argv[arg], "--min-time") == 0)
+    {
+      min_seconds = std::atof(argv[++arg]);
+    }
+    else if(has_value && strcmp(argv[arg], "--json") == 0)
+    {
+      json_path = argv[++arg];
+    }
+    else if(has_value && strcmp(argv[arg], "--baseline") == 0)
+    {
+      baseline_path = argv[++arg];
+    }
+    else if(has_value && strcmp(argv[arg], "--threshold") == 0)
+    {
+      threshold = std::atof(argv[++arg]);
+    }
+    else
+    {
+      std::cerr << USAGE_MSG << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  try
+  {
+    //read the baseline first, a bad path fails before the long run
+    std::map<std::string, double> baseline;
+    if(baseline_path)
+    {
+      baseline = read_json(baseline_path);
+    }
+
+    for(int layer=0; layer<MLP_SIZE; layer++)
+    {
+      bench_matrix_ops(weights_dims[layer].rows, weights_dims[layer].cols);
+    }
+    const int squares[] = {64, 128, 256};
+    for(int size : squares)
+    {
+      bench_matrix_mult(size, size, size);
+    }
+    bench_matrix_mult(weights_dims[0].rows, weights_dims[0].cols,
+                      SPARSE_BATCH);
+    bench_allocator();
+    for(int layer=0; layer<MLP_SIZE; layer++)
+    {
+      bench_activation(weights_dims[layer].rows, ONE_COL);
+    }
+    bench_activation(weights_dims[0].rows, SPARSE_BATCH);
+    for(int layer=0; layer<MLP_SIZE; layer++)
+    {
+      bench_dense(layer);
+    }
+    bench_network_latency();
+    bench_parallel_batch();
+    bench_precision();
+    bench_quantized();
+    bench_output_modes();
+    const float sparsities[] = {0.5F, 0.8F, 0.95F};
+    for(float sparsity : sparsities)
+    {
+      bench_sparse(sparsity);
+    }
+    bench_training();
+
+    if(json_path)
+    {
+      write_json(json_path);
+    }
+    if(baseline_path && compare(baseline, threshold) > 0)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+  catch(const std::exception& e)
+  {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
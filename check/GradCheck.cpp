@@ -0,0 +1,290 @@
+// GradCheck.cpp
+// checks backpropagation against finite differences, build from the
+// repository root, with all library sources:
+//   g++ -std=c++14 -O3 -march=native -pthread *.cpp check/GradCheck.cpp
+// usage:
+//   grad_check
+// the gradients Dense::backward and Trainer::train_batch compute, by every
+// weight, bias and input of small random layers, must match central
+// differences of a double precision forward pass within GRAD_TOLERANCE.
+// prints one line per failure and exits with a failure if there was any
+
+#include "../Trainer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define GRAD_EPSILON 1e-6 // the central differences step
+#define GRAD_TOLERANCE 1e-3 // relative, past GRAD_FLOOR
+#define GRAD_FLOOR 1e-2 // gradients smaller than it compare absolutely
+
+///////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  std::mt19937 rng(2020);
+  int failures = 0;
+
+  /**
+   * a layer in double precision, weights and bias of a Dense
+   */
+  typedef struct ref_layer
+  {
+    int rows;
+    int cols;
+    std::vector<double> weights;
+    std::vector<double> bias;
+  } ref_layer;
+
+
+  /**
+   * @return a rows X cols Matrix of normal random values
+   */
+  Matrix random_matrix(int rows, int cols)
+  {
+    std::normal_distribution<float> dist(0.0F, 1.0F);
+    Matrix mat(rows, cols);
+    float* coords = mat.data();
+    for(long index=0; index<((long) rows)*cols; index++)
+    {
+      coords[index] = dist(rng);
+    }
+    return mat;
+  }
+
+
+  /**
+   * @return the weights and bias of layer in double precision
+   */
+  ref_layer to_ref(const Dense& layer)
+  {
+    const Matrix& weights = layer.get_weights();
+    ref_layer ref;
+    ref.rows = weights.get_rows();
+    ref.cols = weights.get_cols();
+    const float* w = weights.data();
+    ref.weights.assign(w, w + ((long) ref.rows)*ref.cols);
+    const float* b = layer.get_bias().data();
+    ref.bias.assign(b, b + ref.rows);
+    return ref;
+  }
+
+
+  /**
+   * @return weights*x + bias, x and the result one column per input
+   */
+  std::vector<double> pre_activation(const ref_layer& layer,
+                                     const std::vector<double>& x, int count)
+  {
+    std::vector<double> out(((size_t) layer.rows)*count);
+    for(int row=0; row<layer.rows; row++)
+    {
+      for(int col=0; col<count; col++)
+      {
+        double sum = layer.bias[row];
+        for(int k=0; k<layer.cols; k++)
+        {
+          sum += layer.weights[((long) row)*layer.cols + k]*x[k*count + col];
+        }
+        out[((long) row)*count + col] = sum;
+      }
+    }
+    return out;
+  }
+
+
+  /**
+   * @return the mean cross-entropy loss of relu layers and a softmax last
+   * layer, as Trainer trains them
+   */
+  double network_loss(const std::vector<ref_layer>& layers,
+                      std::vector<double> x, int count,
+                      const uint8_t* labels)
+  {
+    for(size_t layer=0; layer<layers.size(); layer++)
+    {
+      x = pre_activation(layers[layer], x, count);
+      if(layer + 1 < layers.size())
+      {
+        for(double& value : x)
+        {
+          value = (value > 0) ? value : 0;
+        }
+      }
+    }
+    const int classes = layers.back().rows;
+    double loss = 0;
+    for(int col=0; col<count; col++)
+    {
+      double max = x[col], sum = 0;
+      for(int row=1; row<classes; row++)
+      {
+        max = std::max(max, x[row*count + col]);
+      }
+      for(int row=0; row<classes; row++)
+      {
+        sum += std::exp(x[row*count + col] - max);
+      }
+      loss -= x[labels[col]*count + col] - max - std::log(sum);
+    }
+    return loss/count;
+  }
+
+
+  /**
+   * checks an analytic gradient against the central difference of loss by
+   * param, which loss reads
+   */
+  template <typename Loss>
+  void check_param(const std::string& name, double& param, float analytic,
+                   Loss loss)
+  {
+    const double value = param;
+    param = value + GRAD_EPSILON;
+    const double up = loss();
+    param = value - GRAD_EPSILON;
+    const double down = loss();
+    param = value;
+    const double numeric = (up - down)/(2*GRAD_EPSILON);
+    if(std::fabs(analytic - numeric) >
+       GRAD_TOLERANCE*std::max(std::fabs(numeric), GRAD_FLOOR))
+    {
+      failures++;
+      printf("FAIL %s: got %g, expected %g\n", name.c_str(), analytic,
+             numeric);
+    }
+  }
+
+
+  /**
+   * checks every gradient of a list of parameters
+   * @param analytic the gradient by params[i] at i
+   */
+  template <typename Loss>
+  void check_params(const std::string& name, std::vector<double>& params,
+                    const float* analytic, Loss loss)
+  {
+    for(size_t index=0; index<params.size(); index++)
+    {
+      check_param(name + "[" + std::to_string(index) + "]", params[index],
+                  analytic[index], loss);
+    }
+  }
+
+
+  /**
+   * Dense::backward under the loss sum(grad . pre-activation), by the
+   * weights, the bias and a strided view input
+   */
+  void check_dense(int rows, int cols, int count)
+  {
+    const Dense layer(random_matrix(rows, cols), random_matrix(rows, ONE_COL),
+                      activation::relu);
+    const Matrix batch = random_matrix(cols, count + 3);
+    const MatrixView input = MatrixView(batch).block(0, 2, cols, count);
+    const Matrix grad = random_matrix(rows, count);
+    Dense backward = layer;
+    Matrix input_grad;
+    backward.backward(input, grad, input_grad);
+
+    ref_layer ref = to_ref(layer);
+    std::vector<double> x(((size_t) cols)*count);
+    for(int k=0; k<cols; k++)
+    {
+      for(int col=0; col<count; col++)
+      {
+        x[k*count + col] = input(k, col);
+      }
+    }
+    const auto loss = [&]()
+    {
+      const std::vector<double> out = pre_activation(ref, x, count);
+      double sum = 0;
+      for(size_t index=0; index<out.size(); index++)
+      {
+        sum += grad.data()[index]*out[index];
+      }
+      return sum;
+    };
+    const std::string name = "Dense " + std::to_string(rows) + "x" +
+                             std::to_string(cols) + " batch " +
+                             std::to_string(count);
+    check_params(name + " weights", ref.weights,
+                 backward.get_weights_grad().data(), loss);
+    check_params(name + " bias", ref.bias, backward.get_bias_grad().data(),
+                 loss);
+    check_params(name + " input", x, input_grad.data(), loss);
+  }
+
+
+  /**
+   * the gradients of one Trainer::train_batch step by every weight and bias
+   * of a network, read before the step changes them
+   */
+  void check_trainer(const std::vector<layer_spec>& spec, int count)
+  {
+    std::vector<Dense> layers = Trainer::init_layers(spec, rng());
+    for(size_t layer=0; layer<layers.size(); layer++)
+    {
+      layers[layer] = Dense(layers[layer].get_weights(),
+                            random_matrix(spec[layer].dims.rows, ONE_COL),
+                            spec[layer].activation);
+    }
+    //trains in float whatever the precision the layers run in
+    layers[0].set_precision(PRECISION_BF16);
+    const Matrix input = random_matrix(spec[0].dims.cols, count);
+    std::vector<uint8_t> labels(count);
+    std::uniform_int_distribution<int> label(0, spec.back().dims.rows - 1);
+    for(uint8_t& value : labels)
+    {
+      value = (uint8_t) label(rng);
+    }
+    Trainer trainer(layers, train_config());
+    trainer.train_batch(input, labels.data());
+
+    std::vector<ref_layer> refs;
+    for(const Dense& layer : layers)
+    {
+      refs.push_back(to_ref(layer));
+    }
+    const float* coords = input.data();
+    const std::vector<double> x(coords, coords + input.get_rows()*count);
+    const auto loss = [&]()
+    {
+      return network_loss(refs, x, count, labels.data());
+    };
+    for(size_t layer=0; layer<layers.size(); layer++)
+    {
+      const Dense& trained = trainer.get_layers()[layer];
+      const std::string name = "Trainer batch " + std::to_string(count) +
+                               " layer " + std::to_string(layer + 1);
+      check_params(name + " weights", refs[layer].weights,
+                   trained.get_weights_grad().data(), loss);
+      check_params(name + " bias", refs[layer].bias,
+                   trained.get_bias_grad().data(), loss);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  check_dense(1, 1, 1);
+  check_dense(7, 9, 1);
+  check_dense(7, 9, 5);
+  check_dense(16, 33, 17);
+
+  const std::vector<layer_spec> spec = {{{12, 20}, activation::relu},
+                                        {{9, 12}, activation::relu},
+                                        {{10, 9}, activation::softmax}};
+  check_trainer(spec, 1);
+  check_trainer(spec, 6);
+  check_trainer({{{10, 15}, activation::softmax}}, 4);
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,362 @@
+// KernelCheck.cpp
+// checks every kernel table this cpu runs against the scalar reference,
+// build from the repository root, with all library sources:
+//   g++ -std=c++14 -O3 -march=native -pthread *.cpp check/KernelCheck.cpp
+// usage:
+//   kernel_check
+// every table of kernels::supported() runs on random arrays of edge case
+// and random lengths, and on ties, infinities and NaNs. element-wise
+// kernels, argmax, dot_u8s8 and gemm_u8s8 must match kernels::scalar()
+// exactly, sum and sum_sq within KERNEL_REDUCE_ULP. prints one line per
+// failure and exits with a failure if there was any
+
+#include "../Kernels.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define RANDOM_LENGTHS 200
+#define MAX_RANDOM_LENGTH 5000
+#define LONG_LENGTH 100003
+#define REDUCE_BLOCK 1024 // elements the KERNEL_REDUCE_ULP budget is for
+
+///////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  std::mt19937 rng(2020);
+  int failures = 0;
+
+  /**
+   * prints a failure of table on a length n array
+   */
+  void fail(const kernel_table& table, const char* kernel, int n,
+            const std::string& what)
+  {
+    failures++;
+    printf("FAIL %s %s n=%d: %s\n", table.name, kernel, n, what.c_str());
+  }
+
+
+  /**
+   * @return n normal random floats, scaled by stddev
+   */
+  std::vector<float> random_floats(int n, float stddev)
+  {
+    std::normal_distribution<float> dist(0.0F, stddev);
+    std::vector<float> values(n);
+    for(float& value : values)
+    {
+      value = dist(rng);
+    }
+    return values;
+  }
+
+
+  /**
+   * @return true if a and b hold the same bits, so NaNs compare equal
+   */
+  bool same_bits(float a, float b)
+  {
+    return memcmp(&a, &b, sizeof(float)) == 0;
+  }
+
+
+  /**
+   * @return the distance from x to the next float away from zero
+   */
+  double ulp(float x)
+  {
+    x = std::fabs(x);
+    return std::nextafter(x, std::numeric_limits<float>::infinity()) - x;
+  }
+
+
+  /**
+   * checks a reduction of table against the scalar one: the difference is
+   * at most KERNEL_REDUCE_ULP ULPs of magnitude per REDUCE_BLOCK elements
+   * @param magnitude sum of the absolute values of the terms
+   */
+  void check_reduction(const kernel_table& table, const char* kernel, int n,
+                       float got, float expected, float magnitude)
+  {
+    //infinities and NaNs propagate the same way whatever the order
+    if(!std::isfinite(expected))
+    {
+      if(!same_bits(got, expected) && !(std::isnan(got) &&
+                                        std::isnan(expected)))
+      {
+        fail(table, kernel, n, "got " + std::to_string(got) +
+                               ", expected " + std::to_string(expected));
+      }
+      return;
+    }
+    const int blocks = (n + REDUCE_BLOCK - 1)/REDUCE_BLOCK;
+    const double tolerance = KERNEL_REDUCE_ULP*ulp(magnitude)*
+                             (blocks ? blocks : 1);
+    if(std::fabs((double) got - expected) > tolerance)
+    {
+      fail(table, kernel, n, "got " + std::to_string(got) + ", expected " +
+                             std::to_string(expected) + ", tolerance " +
+                             std::to_string(tolerance));
+    }
+  }
+
+
+  /**
+   * add, mul and scale into a separate output and in place, against the
+   * scalar results bit by bit
+   */
+  void check_elementwise(const kernel_table& table, const float* a,
+                         const float* b, int n)
+  {
+    const kernel_table& ref = kernels::scalar();
+    std::vector<float> got(n + 1), expected(n + 1), in_place(a, a + n);
+    const float c = 0.7F;
+    //one float past the end catches writes out of bounds
+    const float guard = 12345.0F;
+
+    struct
+    {
+      const char* name;
+      void (*kernel)(const float*, const float*, float*, int);
+      void (*reference)(const float*, const float*, float*, int);
+    } binary[] = {{"add", table.add, ref.add}, {"mul", table.mul, ref.mul}};
+    for(const auto& op : binary)
+    {
+      got[n] = guard;
+      op.kernel(a, b, got.data(), n);
+      op.reference(a, b, expected.data(), n);
+      in_place.assign(a, a + n);
+      op.kernel(in_place.data(), b, in_place.data(), n);
+      for(int i=0; i<n; i++)
+      {
+        if(!same_bits(got[i], expected[i]) ||
+           !same_bits(in_place[i], expected[i]))
+        {
+          fail(table, op.name, n, "differs at " + std::to_string(i));
+          break;
+        }
+      }
+      if(got[n] != guard)
+      {
+        fail(table, op.name, n, "wrote past the end");
+      }
+    }
+
+    got[n] = guard;
+    table.scale(a, c, got.data(), n);
+    ref.scale(a, c, expected.data(), n);
+    in_place.assign(a, a + n);
+    table.scale(in_place.data(), c, in_place.data(), n);
+    for(int i=0; i<n; i++)
+    {
+      if(!same_bits(got[i], expected[i]) ||
+         !same_bits(in_place[i], expected[i]))
+      {
+        fail(table, "scale", n, "differs at " + std::to_string(i));
+        break;
+      }
+    }
+    if(got[n] != guard)
+    {
+      fail(table, "scale", n, "wrote past the end");
+    }
+  }
+
+
+  /**
+   * sum, sum_sq and argmax of a, against the scalar results
+   */
+  void check_reductions(const kernel_table& table, const float* a, int n)
+  {
+    const kernel_table& ref = kernels::scalar();
+    double magnitude = 0, magnitude_sq = 0;
+    for(int i=0; i<n; i++)
+    {
+      magnitude += std::fabs(a[i]);
+      magnitude_sq += ((double) a[i])*a[i];
+    }
+    check_reduction(table, "sum", n, table.sum(a, n), ref.sum(a, n),
+                    (float) magnitude);
+    check_reduction(table, "sum_sq", n, table.sum_sq(a, n), ref.sum_sq(a, n),
+                    (float) magnitude_sq);
+    if(n > 0 && table.argmax(a, n) != ref.argmax(a, n))
+    {
+      fail(table, "argmax", n, "got " + std::to_string(table.argmax(a, n)) +
+                               ", expected " +
+                               std::to_string(ref.argmax(a, n)));
+    }
+  }
+
+
+  /**
+   * dot_u8s8 on random quantized values, which must be exact
+   */
+  void check_dot_u8s8(const kernel_table& table, int n)
+  {
+    std::uniform_int_distribution<int> u8(0, 127), s8(-128, 127);
+    std::vector<uint8_t> a(n);
+    std::vector<int8_t> b(n);
+    for(int i=0; i<n; i++)
+    {
+      a[i] = (uint8_t) u8(rng);
+      b[i] = (int8_t) s8(rng);
+    }
+    const int32_t got = table.dot_u8s8(a.data(), b.data(), n);
+    const int32_t expected = kernels::scalar().dot_u8s8(a.data(), b.data(),
+                                                        n);
+    if(got != expected)
+    {
+      fail(table, "dot_u8s8", n, "got " + std::to_string(got) +
+                                 ", expected " + std::to_string(expected));
+    }
+  }
+
+
+  /**
+   * gemm_u8s8 of an m x k weights block and n inputs, every row padded,
+   * which must be exact, tiles, edges and k tails alike
+   */
+  void check_gemm_u8s8(const kernel_table& table, int m, int n, int k)
+  {
+    std::uniform_int_distribution<int> u8(0, 127), s8(-128, 127);
+    const int ldw = k + 3, ldx = k + 5, ldc = n + 2;
+    std::vector<int8_t> w(((size_t) m)*ldw);
+    std::vector<uint8_t> x(((size_t) n)*ldx);
+    for(int8_t& value : w)
+    {
+      value = (int8_t) s8(rng);
+    }
+    for(uint8_t& value : x)
+    {
+      value = (uint8_t) u8(rng);
+    }
+    const int32_t guard = 12345;
+    std::vector<int32_t> got(((size_t) m)*ldc, guard);
+    std::vector<int32_t> expected(((size_t) m)*ldc, guard);
+    table.gemm_u8s8(m, n, k, w.data(), ldw, x.data(), ldx, got.data(), ldc);
+    kernels::scalar().gemm_u8s8(m, n, k, w.data(), ldw, x.data(), ldx,
+                                expected.data(), ldc);
+    if(got != expected)
+    {
+      fail(table, "gemm_u8s8", k, "differs at " + std::to_string(m) + "x" +
+                                  std::to_string(n));
+    }
+  }
+
+
+  /**
+   * every kernel of table on length n random arrays
+   */
+  void check_length(const kernel_table& table, int n)
+  {
+    const std::vector<float> a = random_floats(n, 1.0F);
+    const std::vector<float> b = random_floats(n, 1.0F);
+    check_elementwise(table, a.data(), b.data(), n);
+    check_reductions(table, a.data(), n);
+    check_dot_u8s8(table, n);
+  }
+
+
+  /**
+   * the arrays vectorized argmax and reductions get wrong most easily:
+   * ties, the max in the tail, infinities and NaNs
+   */
+  void check_edge_values(const kernel_table& table, int n)
+  {
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> a(n, 1.0F);
+    check_reductions(table, a.data(), n);
+
+    //the max in the last, scalar tail element
+    a[n - 1] = 2.0F;
+    check_reductions(table, a.data(), n);
+
+    //ties: the first index of the max wins
+    std::vector<float> ties = random_floats(n, 1.0F);
+    ties[n/3] = 10.0F;
+    ties[n - 1] = 10.0F;
+    check_reductions(table, ties.data(), n);
+
+    //NaNs after the first element never become the max
+    std::vector<float> nans = random_floats(n, 1.0F);
+    for(int i=1; i<n; i+=3)
+    {
+      nans[i] = nan;
+    }
+    if(n > 0 && table.argmax(nans.data(), n) !=
+                kernels::scalar().argmax(nans.data(), n))
+    {
+      fail(table, "argmax", n, "NaNs");
+    }
+    check_elementwise(table, nans.data(), ties.data(), n);
+
+    std::vector<float> infs = random_floats(n, 1.0F);
+    infs[n/2] = -inf;
+    check_reductions(table, infs.data(), n);
+    infs[n/2] = inf;
+    if(table.argmax(infs.data(), n) != kernels::scalar().argmax(infs.data(),
+                                                                n))
+    {
+      fail(table, "argmax", n, "infinity");
+    }
+    check_elementwise(table, infs.data(), a.data(), n);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  //every length up to two AVX-512 unrolled blocks hits each tail case
+  std::vector<int> lengths;
+  for(int n=0; n<=130; n++)
+  {
+    lengths.push_back(n);
+  }
+  const int edges[] = {255, 256, 257, 1023, 1024, 1025, 4095, 4096, 4097,
+                       LONG_LENGTH};
+  lengths.insert(lengths.end(), std::begin(edges), std::end(edges));
+  std::uniform_int_distribution<int> random_length(1, MAX_RANDOM_LENGTH);
+  for(int index=0; index<RANDOM_LENGTHS; index++)
+  {
+    lengths.push_back(random_length(rng));
+  }
+
+  for(const kernel_table* table : kernels::supported())
+  {
+    const int before = failures;
+    for(int n : lengths)
+    {
+      check_length(*table, n);
+      if(n > 0)
+      {
+        check_edge_values(*table, n);
+      }
+    }
+    //around the register tile sizes, the row block and the step lengths
+    const int rows[] = {1, 2, 3, 4, 5, 7, 8, 63, 64, 65, 130};
+    const int cols[] = {1, 3, 4, 5, 8, 17};
+    const int depths[] = {1, 31, 32, 33, 64, 65, 784, 832};
+    for(int m : rows)
+    {
+      for(int n : cols)
+      {
+        for(int k : depths)
+        {
+          check_gemm_u8s8(*table, m, n, k);
+        }
+      }
+    }
+    printf("%-12s %s\n", table->name, failures == before ? "ok" : "FAILED");
+  }
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+// Prune.cpp
+// magnitude pruning, build from the repository root:
+//   g++ -std=c++14 -O3 -march=native -pthread *.cpp tools/Prune.cpp
+// usage:
+//   prune <model bundle> <sparsity> <pruned bundle out>
+// zeroes the smallest magnitude weights of every layer until the given
+// fraction of them, 0 to 1, is zero. layers from DENSE_SPARSE_THRESHOLD
+// on are written in CSR form and run batches on the sparse kernels when
+// loaded, single images too from DENSE_SPARSE_GEMV_THRESHOLD
+
+#include "../ModelBundle.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define USAGE_MSG "Usage: prune <model bundle> <sparsity> <pruned bundle out>"
+#define SPARSITY_ERR_MSG "The sparsity must be from 0 to 1"
+
+///////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  /**
+   * @return a copy of weights with the smallest magnitude fraction of
+   * them set to zero, ties at the cut are zeroed too
+   */
+  Matrix prune(const Matrix& weights, float sparsity)
+  {
+    Matrix pruned(weights);
+    const int size = weights.get_rows()*weights.get_cols();
+    const int cut = (int) std::lround(sparsity*size);
+    if(cut == 0)
+    {
+      return pruned;
+    }
+    std::vector<float> magnitudes(size);
+    for(int index=0; index<size; index++)
+    {
+      magnitudes[index] = std::fabs(weights[index]);
+    }
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + (cut - 1),
+                     magnitudes.end());
+    const float threshold = magnitudes[cut - 1];
+    for(int index=0; index<size; index++)
+    {
+      if(std::fabs(pruned[index]) <= threshold)
+      {
+        pruned[index] = 0;
+      }
+    }
+    return pruned;
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  if(argc != 4)
+  {
+    std::cerr << USAGE_MSG << endl;
+    return EXIT_FAILURE;
+  }
+  try
+  {
+    char* end = nullptr;
+    const float sparsity = std::strtof(argv[2], &end);
+    if(*end != '\0' || !(sparsity >= 0 && sparsity <= 1))
+    {
+      throw runtime_error(SPARSITY_ERR_MSG);
+    }
+    const MlpNetwork network = bundle::load(argv[1]);
+    std::vector<Dense> layers;
+    for(int layer=0; layer<network.get_layer_count(); layer++)
+    {
+      const Dense& dense = network.get_layer(layer);
+      layers.emplace_back(prune(dense.get_weights(), sparsity),
+                          dense.get_bias(), dense.get_activation());
+    }
+    bundle::write(argv[3], MlpNetwork(layers));
+
+    //report from the written file, not the matrices in memory
+    const MlpNetwork pruned = bundle::load(argv[3]);
+    for(int layer=0; layer<pruned.get_layer_count(); layer++)
+    {
+      const Dense& dense = pruned.get_layer(layer);
+      const SparseMatrix sparse(dense.get_weights());
+      printf("layer %d  %4dx%-4d  sparsity %.4f  %s\n", layer + 1,
+             sparse.get_rows(), sparse.get_cols(), sparse.sparsity(),
+             dense.is_sparse() ? "csr" : "dense");
+    }
+  }
+  catch(const std::exception& e)
+  {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+// Quantize.cpp
+// offline int8 quantizer, build from the repository root:
+//   g++ -std=c++14 -O3 -march=native -pthread *.cpp tools/Quantize.cpp
+// usage:
+//   quantize <model bundle> <calibration IDX images> <int8 bundle out>
+//            [<evaluation IDX images>]
+// the agreement report uses the evaluation images, or the calibration ones
+
+#include "../ImageStream.h"
+#include "../ModelBundle.h"
+#include <cstdio>
+#include <fstream>
+
+/////////////////////////// DEFINES & TYPEDEFS ////////////////////////////////
+#define CALIBRATION_IMAGES 2048 // most calibration images used
+#define EVALUATION_IMAGES 10000 // most evaluation images compared
+#define USAGE_MSG "Usage: quantize <model bundle> <calibration images> " \
+                  "<int8 bundle out> [<evaluation images>]"
+#define OPEN_ERR_MSG "Could not open "
+
+///////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  /**
+   * reads up to max_images images of an IDX file, one per column
+   */
+  Matrix read_images(const char* path, int max_images)
+  {
+    std::ifstream is(path, std::ios::binary);
+    if(!is)
+    {
+      throw runtime_error(string(OPEN_ERR_MSG) + path);
+    }
+    ImageStream images(is, IMAGE_IDX);
+    Matrix batch;
+    if(images.read_batch(batch, max_images) == 0)
+    {
+      throw runtime_error(string(OPEN_ERR_MSG) + path);
+    }
+    return batch;
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  if(argc != 4 && argc != 5)
+  {
+    std::cerr << USAGE_MSG << endl;
+    return EXIT_FAILURE;
+  }
+  try
+  {
+    const MlpNetwork network = bundle::load(argv[1]);
+    const QuantizedMlp quantized =
+        QuantizedMlp::calibrate(network, read_images(argv[2],
+                                                     CALIBRATION_IMAGES));
+    bundle::write(argv[3], quantized);
+
+    //check the written file, not the network in memory
+    const QuantizedMlp loaded = bundle::load_quantized(argv[3]);
+    const Matrix images = read_images((argc == 5) ? argv[4] : argv[2],
+                                      EVALUATION_IMAGES);
+    const quant_report report = loaded.compare(network, images);
+    printf("images          %d\n", report.samples);
+    printf("argmax agreed   %.4f%%\n", 100*report.agreement);
+    printf("mean prob diff  %.6f\n", report.mean_prob_diff);
+    printf("max prob diff   %.6f\n", report.max_prob_diff);
+  }
+  catch(const std::exception& e)
+  {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}